@@ -0,0 +1,358 @@
+#include "sys.h"
+#include "CachingFileSystem.h"
+#include "utils/AIAlert.h"
+#include "llvm/ADT/SmallString.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Path.h"
+#include <chrono>
+#include <format>
+#include <fstream>
+#include <unistd.h>
+#include "debug.h"
+
+namespace {
+
+// The first line of a snapshot file.
+constexpr char const* snapshot_magic = "cwformat-stat-snapshot 2";
+
+// A directory that was modified less than this long before it was read might be modified again with the same modification
+// time (file systems with a timestamp granularity of a second exist).
+constexpr int64_t racy_interval_ns = 1000000000;
+
+int64_t to_ns(llvm::sys::TimePoint<> time_point)
+{
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(time_point.time_since_epoch()).count();
+}
+
+// Return `status` with the name that it was looked up with (like the real file system does).
+llvm::ErrorOr<llvm::vfs::Status> with_name(llvm::ErrorOr<llvm::vfs::Status> const& status, llvm::Twine const& path)
+{
+  if (!status)
+    return status.getError();
+  return llvm::vfs::Status::copyWithNewName(*status, path);
+}
+
+} // namespace
+
+// Iterates over a cached directory listing.
+class CachingFileSystem::ListingIterator : public llvm::vfs::detail::DirIterImpl
+{
+ private:
+  std::string dir_;
+  std::shared_ptr<Listing const> listing_;
+  llvm::StringMap<llvm::sys::fs::file_type>::const_iterator next_;
+
+ public:
+  ListingIterator(std::string dir, std::shared_ptr<Listing const> listing) :
+    dir_(std::move(dir)), listing_(std::move(listing)), next_(listing_->entries_.begin())
+  {
+    increment();
+  }
+
+  std::error_code increment() override
+  {
+    if (next_ == listing_->entries_.end())
+      CurrentEntry = llvm::vfs::directory_entry();
+    else
+    {
+      llvm::SmallString<256> path(dir_);
+      llvm::sys::path::append(path, next_->getKey());
+      CurrentEntry = llvm::vfs::directory_entry(std::string(path), next_->getValue());
+      ++next_;
+    }
+    return {};
+  }
+};
+
+CachingFileSystem::CachingFileSystem(llvm::IntrusiveRefCntPtr<llvm::vfs::FileSystem> underlying_file_system, std::filesystem::path const& snapshot_path) :
+  ProxyFileSystem(std::move(underlying_file_system)), snapshot_path_(snapshot_path)
+{
+  if (!snapshot_path_.empty())
+    load();
+}
+
+//static
+bool CachingFileSystem::is_missing(std::error_code ec)
+{
+  return ec == std::errc::no_such_file_or_directory || ec == std::errc::not_a_directory;
+}
+
+// Turn `path` into the key of statuses_ and listings_: the absolute path, without "." components.
+// Returns false if that doesn't work, or if the path ends on "..": then the path is not cached.
+bool CachingFileSystem::make_key(llvm::Twine const& path, llvm::SmallVectorImpl<char>& key) const
+{
+  path.toVector(key);
+  if (key.empty() || makeAbsolute(key))
+    return false;
+  // Don't remove ".." components: that is only correct if what comes before them isn't a symbolic link.
+  llvm::sys::path::remove_dots(key, /*remove_dot_dot=*/false);
+  return llvm::sys::path::filename(llvm::StringRef(key.data(), key.size())) != "..";
+}
+
+std::optional<llvm::ErrorOr<llvm::vfs::Status>> CachingFileSystem::find_status(llvm::StringRef key) const
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto status = statuses_.find(key.str());
+  if (status == statuses_.end())
+    return std::nullopt;
+  return status->second;
+}
+
+void CachingFileSystem::store_status(llvm::StringRef key, llvm::ErrorOr<llvm::vfs::Status> const& status)
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  statuses_.try_emplace(key.str(), status);
+}
+
+std::shared_ptr<CachingFileSystem::Listing const> CachingFileSystem::get_listing(llvm::StringRef dir)
+{
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto listing = listings_.find(dir.str());
+    if (listing != listings_.end())
+      return listing->second;
+  }
+
+  auto listing = std::make_shared<Listing>();
+  llvm::vfs::FileSystem& underlying_file_system = getUnderlyingFS();
+  if (llvm::ErrorOr<llvm::vfs::Status> dir_status = underlying_file_system.status(dir))
+  {
+    listing->mtime_ns_ = to_ns(dir_status->getLastModificationTime());
+    listing->racy_ = to_ns(std::chrono::time_point_cast<std::chrono::nanoseconds>(std::chrono::system_clock::now())) - listing->mtime_ns_ < racy_interval_ns;
+  }
+  std::error_code ec;
+  llvm::vfs::directory_iterator entry = underlying_file_system.dir_begin(dir, ec);
+  if (ec)
+  {
+    // A directory that can't be read for another reason (like missing read permission) might still have entries that can be accessed.
+    if (is_missing(ec))
+      listing->error_ = ec;
+  }
+  else
+  {
+    for (llvm::vfs::directory_iterator end; !ec && entry != end; entry.increment(ec))
+      listing->entries_.try_emplace(llvm::sys::path::filename(entry->path()), entry->type());
+    listing->complete_ = !ec;
+  }
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  return listings_.try_emplace(dir.str(), std::move(listing)).first->second;
+}
+
+// Return an error if the parent directory of `key` says that it doesn't exist.
+std::error_code CachingFileSystem::known_missing(llvm::StringRef key)
+{
+  llvm::StringRef const parent = llvm::sys::path::parent_path(key);
+  if (parent.empty() || parent == key)
+    return {};
+  std::shared_ptr<Listing const> listing = get_listing(parent);
+  if (listing->error_)
+    return listing->error_;
+  if (listing->complete_ && !listing->entries_.contains(llvm::sys::path::filename(key)))
+    return std::make_error_code(std::errc::no_such_file_or_directory);
+  return {};
+}
+
+llvm::ErrorOr<llvm::vfs::Status> CachingFileSystem::status(llvm::Twine const& path)
+{
+  llvm::SmallString<256> key;
+  if (!make_key(path, key))
+    return ProxyFileSystem::status(path);
+  if (auto status = find_status(key))
+    return with_name(*status, path);
+
+  std::error_code const missing = known_missing(key);
+  llvm::ErrorOr<llvm::vfs::Status> status = missing ? llvm::ErrorOr<llvm::vfs::Status>(missing) : getUnderlyingFS().status(key);
+  store_status(key, status);
+  return with_name(status, path);
+}
+
+llvm::ErrorOr<std::unique_ptr<llvm::vfs::File>> CachingFileSystem::openFileForRead(llvm::Twine const& path)
+{
+  llvm::SmallString<256> key;
+  if (!make_key(path, key))
+    return ProxyFileSystem::openFileForRead(path);
+
+  std::optional<llvm::ErrorOr<llvm::vfs::Status>> status = find_status(key);
+  if (status && !*status)
+    return status->getError();
+  if (!status)
+  {
+    if (std::error_code ec = known_missing(key))
+    {
+      store_status(key, ec);
+      return ec;
+    }
+  }
+
+  llvm::ErrorOr<std::unique_ptr<llvm::vfs::File>> file = ProxyFileSystem::openFileForRead(path);
+  if (!status)
+  {
+    if (file)
+    {
+      if (llvm::ErrorOr<llvm::vfs::Status> file_status = (*file)->status())
+        store_status(key, *file_status);
+    }
+    else if (is_missing(file.getError()))
+      store_status(key, file.getError());
+  }
+  return file;
+}
+
+llvm::vfs::directory_iterator CachingFileSystem::dir_begin(llvm::Twine const& dir, std::error_code& ec)
+{
+  llvm::SmallString<256> key;
+  if (!make_key(dir, key))
+    return ProxyFileSystem::dir_begin(dir, ec);
+  std::shared_ptr<Listing const> listing = get_listing(key);
+  if (listing->error_)
+  {
+    ec = listing->error_;
+    return {};
+  }
+  if (!listing->complete_)
+    return ProxyFileSystem::dir_begin(dir, ec);
+  ec.clear();
+  return llvm::vfs::directory_iterator(std::make_shared<ListingIterator>(dir.str(), std::move(listing)));
+}
+
+void CachingFileSystem::forget(llvm::Twine const& path)
+{
+  llvm::SmallString<256> key;
+  if (!make_key(path, key))
+    return;
+  std::lock_guard<std::mutex> lock(mutex_);
+  statuses_.erase(std::string(key));
+}
+
+void CachingFileSystem::clear()
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  statuses_.clear();
+  listings_.clear();
+}
+
+// The snapshot is a text file; after the magic line it contains, per directory, a line
+//
+//   l <mtime_ns> <errno> <path>
+//
+// followed by a line per entry, for complete listings:
+//
+//   e <file type> <name>
+void CachingFileSystem::load()
+{
+  auto buffer_or_err = llvm::MemoryBuffer::getFile(snapshot_path_.native());
+  if (!buffer_or_err)
+    return;     // No snapshot yet.
+
+  llvm::StringRef content = buffer_or_err.get()->getBuffer();
+  llvm::StringRef header;
+  std::tie(header, content) = content.split('\n');
+  if (header != snapshot_magic)
+  {
+    Dout(dc::notice, "Discarding stat snapshot \"" << snapshot_path_.native() << "\": unknown format.");
+    return;
+  }
+
+  std::unordered_map<std::string, std::shared_ptr<Listing const>> listings;
+  std::shared_ptr<Listing> listing;     // The listing that the current lines belong to.
+  std::string dir;                      // Its path.
+  bool valid = false;                   // Set if that directory didn't change.
+  size_t number_of_stale_directories = 0;
+  while (!content.empty())
+  {
+    llvm::StringRef line;
+    std::tie(line, content) = content.split('\n');
+
+    bool error = false;
+    llvm::StringRef kind, field;
+    std::tie(kind, line) = line.split(' ');
+    if (kind == "l")
+    {
+      listing = std::make_shared<Listing>();
+      int error_number;
+      std::tie(field, line) = line.split(' ');
+      error |= field.getAsInteger(10, listing->mtime_ns_);
+      std::tie(field, line) = line.split(' ');
+      error |= field.getAsInteger(10, error_number);
+      // The remainder of the line is the path (which may contain spaces).
+      dir = line.str();
+      if (!error && !dir.empty())
+      {
+        listing->error_ = std::error_code(error_number, std::generic_category());
+        listing->complete_ = !listing->error_;
+        int64_t mtime_ns = -1;
+        if (llvm::ErrorOr<llvm::vfs::Status> dir_status = getUnderlyingFS().status(dir))
+          mtime_ns = to_ns(dir_status->getLastModificationTime());
+        valid = mtime_ns == listing->mtime_ns_;
+        if (valid)
+          listings.emplace(dir, listing);
+        else
+          ++number_of_stale_directories;
+      }
+    }
+    else if (kind == "e" && listing)
+    {
+      unsigned int type;
+      std::tie(field, line) = line.split(' ');
+      error |= field.getAsInteger(10, type);
+      if (!error && valid)
+        listing->entries_.try_emplace(line, static_cast<llvm::sys::fs::file_type>(type));
+    }
+    else
+      error = true;
+    if (error || line.empty())
+    {
+      Dout(dc::warning, "Discarding corrupt stat snapshot \"" << snapshot_path_.native() << "\".");
+      return;
+    }
+  }
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  listings_ = std::move(listings);
+  Dout(dc::notice, "Loaded " << listings_.size() << " directories from stat snapshot \"" <<
+      snapshot_path_.native() << "\"; " << number_of_stale_directories << " directories changed.");
+}
+
+void CachingFileSystem::save() const
+{
+  if (snapshot_path_.empty())
+    return;
+
+  std::filesystem::create_directories(snapshot_path_.parent_path());
+
+  // Write to a temporary file first, so that a concurrent run never sees a partial snapshot.
+  std::filesystem::path temp_path = snapshot_path_;
+  temp_path += std::format(".tmp-{}", ::getpid());
+  {
+    std::ofstream ofile(temp_path, std::ios::binary | std::ios::trunc);
+    if (!ofile.is_open())
+      THROW_LALERTE("Failed to create '[FILENAME]'", AIArgs("[FILENAME]", temp_path.native()));
+    ofile << snapshot_magic << '\n';
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (auto const& [dir, listing] : listings_)
+    {
+      // Paths containing a newline can't be stored; listings that are incomplete for other reasons than the directory missing are not useful.
+      if (listing->racy_ || dir.find('\n') != std::string::npos || !(listing->complete_ || listing->error_))
+        continue;
+      ofile << "l " << listing->mtime_ns_ << ' ' << listing->error_.value() << ' ' << dir << '\n';
+      for (auto const& entry : listing->entries_)
+      {
+        llvm::StringRef const name = entry.getKey();
+        if (name.contains('\n'))
+          continue;
+        ofile << "e " << static_cast<unsigned int>(entry.getValue()) << ' ' << name.str() << '\n';
+      }
+    }
+    ofile.close();
+    if (!ofile.good())
+    {
+      std::error_code ignored_ec;
+      std::filesystem::remove(temp_path, ignored_ec);
+      THROW_LALERT("Failed writing '[FILENAME]'", AIArgs("[FILENAME]", temp_path.native()));
+    }
+  }
+  std::filesystem::rename(temp_path, snapshot_path_);
+}
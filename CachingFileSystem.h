@@ -0,0 +1,90 @@
+#pragma once
+
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/Support/ErrorOr.h"
+#include "llvm/Support/VirtualFileSystem.h"
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <system_error>
+#include <unordered_map>
+
+// A file system that caches stat results (including failures) and directory
+// listings for the duration of a run; shared by all ClangFrontend's.
+//
+// Header search tries every -I directory in turn, for every #include, in every
+// TU, and most of those lookups fail. The FileManager of a ClangFrontend caches
+// what it looked up itself, but every frontend (one per worker thread, and a new
+// one after --max-rss recycled it) starts from scratch; on a network file system
+// that is where the time goes.
+//
+// Looking up a path that isn't cached yet first reads its parent directory (once
+// per directory): if the name isn't listed there then the lookup fails without
+// asking the file system. Only files that exist are stat-ed individually.
+//
+// Everything is assumed to stay the same during the run, except for the files
+// that are being formatted (see forget); a server that finds that something
+// changed starts over (see clear). Optionally, the listings of directories are
+// stored in a snapshot for later runs, so that those know which files don't exist
+// without looking them up: in particular, every candidate path that resolving an
+// #include tries before it finds the header. A listing of the snapshot is only used
+// if the modification time of its directory is still the same (adding, removing or
+// renaming an entry changes it); a listing that was read too soon after its
+// directory was modified is not stored, because the directory might have changed
+// again without its modification time changing. The status of files is not stored:
+// modifying a file in place doesn't change its directory, so files that exist are
+// still stat-ed, once per run.
+//
+// Thread-safe.
+class CachingFileSystem : public llvm::vfs::ProxyFileSystem
+{
+ private:
+  struct Listing
+  {
+    int64_t mtime_ns_ = -1;                             // The modification time of the directory when it was read; -1 if that failed.
+    std::error_code error_;                             // Set if the directory doesn't exist (or isn't a directory).
+    bool complete_ = false;                             // Set if entries_ lists all entries of the directory.
+    bool racy_ = false;                                 // Set if the directory was modified just before it was read.
+    llvm::StringMap<llvm::sys::fs::file_type> entries_;
+  };
+
+  class ListingIterator;
+
+  std::filesystem::path snapshot_path_;
+
+  mutable std::mutex mutex_;                            // Protects the members below.
+  std::unordered_map<std::string, llvm::ErrorOr<llvm::vfs::Status>> statuses_;  // Indexed by absolute path.
+  std::unordered_map<std::string, std::shared_ptr<Listing const>> listings_;     // Indexed by absolute path.
+
+ public:
+  // Load the snapshot at `snapshot_path`, if not empty, and it exists.
+  CachingFileSystem(llvm::IntrusiveRefCntPtr<llvm::vfs::FileSystem> underlying_file_system, std::filesystem::path const& snapshot_path = {});
+
+  llvm::ErrorOr<llvm::vfs::Status> status(llvm::Twine const& path) override;
+  llvm::ErrorOr<std::unique_ptr<llvm::vfs::File>> openFileForRead(llvm::Twine const& path) override;
+  llvm::vfs::directory_iterator dir_begin(llvm::Twine const& dir, std::error_code& ec) override;
+
+  // Forget the cached status of `path`, because it is (about to be) changed.
+  void forget(llvm::Twine const& path);
+
+  // Forget everything, because files or directories might have changed since they were cached (see FormatServer).
+  void clear();
+
+  // Write the snapshot (if a snapshot path was given).
+  void save() const;
+
+  // Returns true if `ec` means that a path doesn't exist.
+  static bool is_missing(std::error_code ec);
+
+ private:
+  bool make_key(llvm::Twine const& path, llvm::SmallVectorImpl<char>& key) const;
+  std::optional<llvm::ErrorOr<llvm::vfs::Status>> find_status(llvm::StringRef key) const;
+  void store_status(llvm::StringRef key, llvm::ErrorOr<llvm::vfs::Status> const& status);
+  std::shared_ptr<Listing const> get_listing(llvm::StringRef dir);
+  std::error_code known_missing(llvm::StringRef key);
+  void load();
+};
@@ -4,27 +4,140 @@
 #include "PreprocessorEventsHandler.h"
 #include "TranslationUnit.h"
 #include "TranslationUnitRef.h"
+#include "GuardedHeaderDiskCache.h"
+#include "GuardedHeaderReplayer.h"
+#include "macro_definitions.h"
 #include "utils/AIAlert.h"
 #include "clang/Lex/Preprocessor.h"
 #include "clang/Lex/HeaderSearch.h"
+#include "clang/Lex/MacroInfo.h"
+#include "clang/Lex/PPCallbacks.h"
 #include "clang/Serialization/PCHContainerOperations.h"
 #include "clang/Frontend/Utils.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/raw_ostream.h"
 #ifdef CWDEBUG
 #include "libcwd/buf2str.h"
 #include "debug_ostream_operators.h"
 #endif
 
 ClangFrontend::ClangFrontend(configure_header_search_options_type configure_header_search_options,
-      configure_commandline_macro_definitions_type configure_commandline_macro_definitions) :
-    OptionsBase(std::move(configure_header_search_options), std::move(configure_commandline_macro_definitions)),
+      configure_commandline_macro_definitions_type configure_commandline_macro_definitions,
+      configure_language_options_type configure_language_options, FrontendSettings const& settings) :
+    OptionsBase(std::move(configure_header_search_options), std::move(configure_commandline_macro_definitions),
+        std::move(configure_language_options)),
     diagnostic_consumer_(llvm::errs(), diagnostic_options_.get()), diagnostic_ids_(new clang::DiagnosticIDs),
     diagnostics_engine_(diagnostic_ids_, diagnostic_options_, &diagnostic_consumer_, /*ShouldOwnClient=*/false),
-    target_info_(ClangFrontend::create_target_info(diagnostics_engine_, target_options_)), file_manager_(file_system_options_),
+    target_info_(ClangFrontend::create_target_info(diagnostics_engine_, target_options_)), file_manager_(file_system_options_, settings.file_system_),
     source_manager_(diagnostics_engine_, file_manager_),
-    header_search_(header_search_options_, source_manager_, diagnostics_engine_, lang_options_, target_info_.get())
+    header_search_(header_search_options_, source_manager_, diagnostics_engine_, lang_options_, target_info_.get()),
+    settings_(settings), header_directives_cache_(source_manager_), configuration_hash_(0)
 {
   target_info_->adjust(diagnostics_engine_, lang_options_);
   clang::ApplyHeaderSearchOptions(header_search_, header_search_options_, lang_options_, target_info_->getTriple());
+  // Let the Preprocessor only lex the directives of included files.
+  if (settings_.directives_only_headers_)
+    preprocessor_options_->DependencyDirectivesForFile =
+      [this](clang::FileEntryRef file){ return header_directives_cache_.get(file); };
+  if (!settings_.prefix_header_.empty())
+    preprocess_prefix_header(settings_.prefix_header_);
+  // Start with the guarded headers that were recorded by earlier runs.
+  if (settings_.replay_guarded_headers_ && settings_.guarded_header_disk_cache_)
+  {
+    configuration_hash_ = GuardedHeaderDiskCache::configuration_hash(header_search_, *target_info_);
+    settings_.guarded_header_disk_cache_->load_into(guarded_header_cache_, file_manager_, configuration_hash_);
+  }
+}
+
+namespace {
+
+// Records every file that is entered.
+class EnteredFilesRecorder : public clang::PPCallbacks
+{
+ private:
+  clang::SourceManager const& source_manager_;
+  std::vector<clang::FileEntryRef>& entered_files_;
+
+ public:
+  EnteredFilesRecorder(clang::SourceManager const& source_manager, std::vector<clang::FileEntryRef>& entered_files) :
+    source_manager_(source_manager), entered_files_(entered_files) { }
+
+  void LexedFileChanged(clang::FileID FID, LexedFileChangeReason Reason, clang::SrcMgr::CharacteristicKind FileType,
+      clang::FileID PrevFID, clang::SourceLocation Loc) override
+  {
+    if (Reason == LexedFileChangeReason::EnterFile)
+      if (clang::OptionalFileEntryRef file = source_manager_.getFileEntryRefForID(FID))
+        entered_files_.push_back(*file);
+  }
+};
+
+} // namespace
+
+// Preprocess the prefix header once and remember the resulting macro state (as text, appended to predefines_)
+// and which of the files that it included can be skipped when included again (because they are guarded).
+//
+// This is what a precompiled header would give us, without needing an AST: every TU starts with the
+// macros defined by the prefix header, and its own #include's of those headers cost next to nothing.
+void ClangFrontend::preprocess_prefix_header(std::filesystem::path const& prefix_header)
+{
+  DoutEntering(dc::notice, "ClangFrontend::preprocess_prefix_header(" << prefix_header << ")");
+
+  // Include the prefix header from an otherwise empty main file, so that it is processed exactly like when a TU includes it.
+  std::string const main_file_text = "#include \"" + prefix_header.native() + "\"\n";
+  clang::FileID file_id = source_manager_.createFileID(llvm::MemoryBuffer::getMemBufferCopy(main_file_text, "<pch>"));
+  source_manager_.setMainFileID(file_id);
+
+  std::string macro_definitions;
+  {
+    clang::Preprocessor pp(preprocessor_options_, diagnostics_engine_, lang_options_,
+        source_manager_, header_search_, module_loader_, /*IILookup=*/nullptr, /*OwnsHeaderSearch=*/false, clang::TU_Complete);
+    std::vector<clang::FileEntryRef> entered_files;
+    pp.addPPCallbacks(std::make_unique<EnteredFilesRecorder>(source_manager_, entered_files));
+    pp.Initialize(*target_info_);
+    clang::InitializePreprocessor(pp, *preprocessor_options_, *pch_container_reader_ptr_, frontend_options_, code_gen_options_);
+    predefines_ = pp.getPredefines();
+
+    diagnostic_consumer_.BeginSourceFile(lang_options_, &pp);
+    unsigned int const errors_before = diagnostic_consumer_.getNumErrors();
+    pp.EnterMainSourceFile();
+    clang::Token tok;
+    do
+      pp.Lex(tok);
+    while (tok.isNot(clang::tok::eof));
+    diagnostic_consumer_.EndSourceFile();
+    if (diagnostic_consumer_.getNumErrors() != errors_before)
+      THROW_LALERT("Failed to preprocess prefix header '[HEADER]'", AIArgs("[HEADER]", prefix_header.native()));
+
+    // The resulting macro state, minus what is already in the predefines.
+    llvm::raw_string_ostream os(macro_definitions);
+    for (auto const& [identifier, state] : pp.macros(false))
+    {
+      clang::MacroInfo const* macro_info = pp.getMacroInfo(identifier);
+      if (!macro_info)
+        os << "#undef " << identifier->getName() << '\n';
+      else if (!macro_info->isBuiltinMacro() && source_manager_.getFileID(macro_info->getDefinitionLoc()) != pp.getPredefinesFileID())
+        print_macro_definition(os, pp, *identifier, *macro_info);
+    }
+
+    // The files that can be skipped when the TU includes them again.
+    for (clang::FileEntryRef file : entered_files)
+    {
+      clang::HeaderFileInfo& header_file_info = header_search_.getFileInfo(file);
+      if (header_file_info.isPragmaOnce)
+        prefix_header_files_.emplace_back(file, std::string{});
+      else if (clang::IdentifierInfo const* controlling_macro = header_file_info.getControllingMacro(nullptr))
+        prefix_header_files_.emplace_back(file, controlling_macro->getName().str());
+    }
+  }
+  Dout(dc::notice, "The prefix header defines " << macro_definitions.size() << " bytes of macros and " <<
+      prefix_header_files_.size() << " guarded files.");
+  *predefines_ += macro_definitions;
+
+  // Release everything that is specific to this preprocessor run, like end_source_file does.
+  source_manager_.clearIDTables();
+  header_search_.ClearFileInfo();
 }
 
 void ClangFrontend::begin_source_file(SourceFile const& source_file, TranslationUnit& translation_unit)
@@ -49,6 +162,25 @@ void ClangFrontend::begin_source_file(SourceFile const& source_file, Translation
   auto preprocessor = std::make_unique<clang::Preprocessor>(preprocessor_options_, diagnostics_engine_, lang_options_,
       source_manager_, header_search_, module_loader_, /*IILookup=*/nullptr, /*OwnsHeaderSearch=*/false, clang::TU_Complete);
 
+  // Skip guarded headers that were entered by an earlier TU, if their context didn't change.
+  if (settings_.replay_guarded_headers_)
+  {
+    auto guarded_header_replayer =
+      std::make_unique<GuardedHeaderReplayer>(*preprocessor, header_search_, guarded_header_cache_,
+          settings_.guarded_header_disk_cache_.get(), configuration_hash_, translation_unit.statistics());
+    header_search_.SetExternalLookup(guarded_header_replayer.get());
+    preprocessor->addPPCallbacks(std::move(guarded_header_replayer));
+  }
+
+  // The macros of the prefix header are already defined (by the predefines); don't enter its guarded files again.
+  for (PrefixHeaderFile const& prefix_header_file : prefix_header_files_)
+  {
+    if (prefix_header_file.controlling_macro_.empty())
+      header_search_.MarkFileIncludeOnce(prefix_header_file.file_);
+    else
+      header_search_.SetFileControllingMacro(prefix_header_file.file_, preprocessor->getIdentifierInfo(prefix_header_file.controlling_macro_));
+  }
+
   diagnostic_consumer_.BeginSourceFile(lang_options_, preprocessor.get());
 
   translation_unit.init(file_id, std::move(preprocessor));
@@ -57,6 +189,66 @@ void ClangFrontend::begin_source_file(SourceFile const& source_file, Translation
 void ClangFrontend::end_source_file()
 {
   diagnostic_consumer_.EndSourceFile();
+
+  // Release what was specific to this TU, so that memory use doesn't grow with the number of files processed,
+  // while keeping what is shared between TUs (the FileManager stat cache and the contents of headers).
+
+  // The contents of the main file were overridden with the buffer of a SourceFile that is about to be destroyed.
+  // Forget its FileEntry, so that a later TU that includes or processes the same file gets a fresh one (and reads it again).
+  if (clang::OptionalFileEntryRef main_file_entry = source_manager_.getFileEntryRefForID(source_manager_.getMainFileID()))
+  {
+    // That invalidates any FileEntryRef to it that we kept.
+    std::erase_if(prefix_header_files_, [&](PrefixHeaderFile const& prefix_header_file){ return prefix_header_file.file_ == *main_file_entry; });
+    guarded_header_cache_.forget(*main_file_entry);
+    if (settings_.file_system_)
+      settings_.file_system_->forget(main_file_entry->getName());
+    file_manager_.invalidateCache(*main_file_entry);
+  }
+  // All FileIDs (SLocEntry tables) and the line table of this TU.
+  source_manager_.clearIDTables();
+  // Per-file header information (include guards and the like) that refers to identifiers of the Preprocessor of this TU.
+  header_search_.ClearFileInfo();
+  // The GuardedHeaderReplayer was destroyed together with that Preprocessor.
+  header_search_.SetExternalLookup(nullptr);
+}
+
+bool ClangFrontend::files_changed()
+{
+  // Ask the real file system: the file system of the FileManager might be a CachingFileSystem.
+  llvm::SmallVector<clang::OptionalFileEntryRef> files;
+  file_manager_.GetUniqueIDMapping(files);
+  std::vector<std::string> directories;
+  for (clang::OptionalFileEntryRef file : files)
+  {
+    if (!file)
+      continue;
+    llvm::sys::fs::file_status status;
+    if (llvm::sys::fs::status(file->getName(), status) || status.getSize() != static_cast<uint64_t>(file->getSize()) ||
+        llvm::sys::toTimeT(status.getLastModificationTime()) != file->getModificationTime())
+    {
+      Dout(dc::notice, "The file \"" << file->getName().str() << "\" changed.");
+      return true;
+    }
+    directories.push_back(llvm::sys::path::parent_path(file->getName()).str());
+  }
+  for (clang::ConstSearchDirIterator dir = header_search_.search_dir_begin(); dir != header_search_.search_dir_end(); ++dir)
+    directories.push_back(dir->getName().str());
+
+  for (std::string& directory : directories)
+  {
+    // A directory that doesn't exist (anymore) gets the default TimePoint.
+    llvm::sys::fs::file_status status;
+    llvm::sys::TimePoint<> mtime;
+    if (!llvm::sys::fs::status(directory.empty() ? "." : directory, status))
+      mtime = status.getLastModificationTime();
+    auto [directory_mtime, inserted] = directory_mtimes_.try_emplace(std::move(directory), mtime);
+    if (!inserted && directory_mtime->second != mtime)
+    {
+      Dout(dc::notice, "The directory \"" << directory_mtime->first << "\" changed.");
+      return true;
+    }
+  }
+  return false;
 }
 
 //static
@@ -78,7 +270,17 @@ void ClangFrontend::process_input_buffer(TranslationUnit& translation_unit) cons
 
   // Initialize the preprocessor.
   pp.Initialize(*target_info_);
-  clang::InitializePreprocessor(pp, *preprocessor_options_, *pch_container_reader_ptr_, frontend_options_, code_gen_options_);
+  if (!predefines_)
+  {
+    clang::InitializePreprocessor(pp, *preprocessor_options_, *pch_container_reader_ptr_, frontend_options_, code_gen_options_);
+    predefines_ = pp.getPredefines();
+  }
+  else
+  {
+    // Everything that InitializePreprocessor does, given our options, is generating the predefines; that is the same for every TU.
+    // This only saves generating the text: the Preprocessor of this TU still lexes it when the main file is entered.
+    pp.setPredefines(*predefines_);
+  }
   pp.SetSuppressIncludeNotFoundError(false);
 
 #ifdef CWDEBUG
@@ -180,6 +382,7 @@ void ClangFrontend::lex_source_range(TranslationUnit& translation_unit, Translat
 void ClangFrontend::lex_source_range(TranslationUnit& translation_unit, char const* RangeLexStartPtr, size_t range_size, llvm::StringRef FileBuffer)
 {
   DoutEntering(dc::notice, "ClangFrontend::lex_source_range(TranslationUnit:" << translation_unit.name() << ", ⟪" << buf2str(RangeLexStartPtr, range_size) << "⟫, FileBuffer)");
+  Statistics::PhaseTimer timer(translation_unit.statistics(), Statistics::File::lex_source_range);
 
   char const* FileBufStart = FileBuffer.data();
   char const* FileBufEnd = FileBufStart + FileBuffer.size();
@@ -17,10 +17,17 @@
 #include "clang/Lex/Preprocessor.h"
 #include "clang/Lex/Lexer.h"
 #include "llvm/TargetParser/Host.h"
+#include <cstdint>
 #include <iostream>
+#include <map>
 #include <memory>
+#include <optional>
 #include <string>
+#include <vector>
 #include "DiagnosticConsumer.h"
+#include "FrontendSettings.h"
+#include "GuardedHeaderCache.h"
+#include "HeaderDirectivesCache.h"
 #include "SourceFile.h"
 
 // Forward declarations.
@@ -159,6 +166,7 @@ class OptionsBase
  public:
   using configure_header_search_options_type = std::function<void(HeaderSearchOptions&)>;
   using configure_commandline_macro_definitions_type = std::function<void(clang::PreprocessorOptions&)>;
+  using configure_language_options_type = std::function<void(clang::LangOptions&, llvm::Triple const&)>;
 
  protected:
   llvm::IntrusiveRefCntPtr<DiagnosticOptions> diagnostic_options_{new DiagnosticOptions};
@@ -172,10 +180,12 @@ class OptionsBase
   clang::PCHContainerReader* pch_container_reader_ptr_ = nullptr;
   CodeGenOptions code_gen_options_;
 
-  OptionsBase(configure_header_search_options_type configure_header_search_options, configure_commandline_macro_definitions_type configure_commandline_macro_definitions)
+  OptionsBase(configure_header_search_options_type configure_header_search_options, configure_commandline_macro_definitions_type configure_commandline_macro_definitions,
+      configure_language_options_type configure_language_options)
   {
     configure_header_search_options(header_search_options_);
     configure_commandline_macro_definitions(*preprocessor_options_);
+    configure_language_options(lang_options_, llvm::Triple(target_options_->Triple));
   }
 };
 
@@ -202,16 +212,45 @@ class ClangFrontend : public OptionsBase
   clang::HeaderSearch header_search_;
   clang::TrivialModuleLoader module_loader_;
 
+  // Run-wide settings.
+  FrontendSettings settings_;
+  HeaderDirectivesCache header_directives_cache_;       // Only used if settings_.directives_only_headers_ is set.
+  GuardedHeaderCache guarded_header_cache_;             // Only used if settings_.replay_guarded_headers_ is set.
+  uint64_t configuration_hash_;                         // See GuardedHeaderDiskCache::configuration_hash; only used if there is one.
+
+  // The text of the predefines buffer (builtin macros, -D/-U, -imacros and -include), which only depends on the options;
+  // generated for the first TU. If there is a prefix header then this also contains the macro definitions that resulted
+  // from preprocessing it. Only the text is cached: every TU still lexes it, to build the macro table of its own Preprocessor.
+  mutable std::optional<std::string> predefines_;
+
+  // A header that was included (directly or indirectly) by the prefix header, and that can be skipped when included again.
+  struct PrefixHeaderFile
+  {
+    clang::FileEntryRef file_;
+    std::string controlling_macro_;             // The include guard of the file, or empty if it uses #pragma once.
+  };
+  std::vector<PrefixHeaderFile> prefix_header_files_;
+
+  // The modification time of the search directories and of the directories of the files that were read,
+  // when files_changed first saw them. Adding a file to one of them can change what an #include resolves to.
+  std::map<std::string, llvm::sys::TimePoint<>> directory_mtimes_;
+
  public:
-  ClangFrontend(configure_header_search_options_type configure_header_search_options, configure_commandline_macro_definitions_type configure_commandline_macro_definitions);
+  ClangFrontend(configure_header_search_options_type configure_header_search_options, configure_commandline_macro_definitions_type configure_commandline_macro_definitions,
+      configure_language_options_type configure_language_options, FrontendSettings const& settings = {});
 
   // Reads from input_buffer and writes to translation_unit.
   void process_input_buffer(TranslationUnit& translation_unit) const;
 
+  // Returns true if one of the files that were read, or one of the directories that they were looked up in,
+  // changed on disk; then everything that this frontend cached is possibly stale. Used by FormatServer.
+  bool files_changed();
+
   // Accessor.
   clang::SourceManager const& source_manager() const { return source_manager_; }
 
   void begin_source_file(SourceFile const& source_file, TranslationUnit& translation_unit);
+  // Must be called after the Preprocessor of the TU was destroyed.
   void end_source_file();
 
   // Tasks that require lang_options_.
@@ -231,6 +270,8 @@ class ClangFrontend : public OptionsBase
   void lex_source_range(TranslationUnit& translation_unit, char const* RangeLexStartPtr, size_t range_size, llvm::StringRef FileBuffer);
 
  private:
+  void preprocess_prefix_header(std::filesystem::path const& prefix_header);
+
   static clang::TargetInfo* create_target_info(
     clang::DiagnosticsEngine& diagnostics_engine, std::shared_ptr<clang::TargetOptions> const& target_options);
 };
@@ -0,0 +1,144 @@
+#include "sys.h"
+#include "CompilationDatabase.h"
+#include "utils/AIAlert.h"
+#include "clang/Basic/LangStandard.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/JSON.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/StringSaver.h"
+#include <optional>
+#include <string_view>
+#include "debug.h"
+
+CompilationDatabase::CompilationDatabase(std::filesystem::path const& build_directory)
+{
+  std::filesystem::path const filename = build_directory / "compile_commands.json";
+  auto buffer_or_err = llvm::MemoryBuffer::getFile(filename.native());
+  if (!buffer_or_err)
+    THROW_LALERTC(buffer_or_err.getError(), "Failed to open '[FILENAME]'", AIArgs("[FILENAME]", filename.native()));
+
+  llvm::Expected<llvm::json::Value> json = llvm::json::parse((*buffer_or_err)->getBuffer());
+  if (!json)
+    THROW_LALERT("Failed to parse '[FILENAME]': [ERROR]", AIArgs("[FILENAME]", filename.native())("[ERROR]", llvm::toString(json.takeError())));
+
+  llvm::json::Array const* entries = json->getAsArray();
+  if (!entries)
+    THROW_LALERT("'[FILENAME]' does not contain an array", AIArgs("[FILENAME]", filename.native()));
+
+  for (llvm::json::Value const& value : *entries)
+  {
+    llvm::json::Object const* entry = value.getAsObject();
+    if (!entry)
+      THROW_LALERT("'[FILENAME]': every entry must be an object", AIArgs("[FILENAME]", filename.native()));
+    std::optional<llvm::StringRef> directory = entry->getString("directory");
+    std::optional<llvm::StringRef> file = entry->getString("file");
+    if (!directory || !file)
+      THROW_LALERT("'[FILENAME]': every entry must have a \"directory\" and a \"file\"", AIArgs("[FILENAME]", filename.native()));
+
+    // An entry has either "arguments" (already split) or "command" (a shell command line).
+    std::vector<std::string> arguments;
+    if (llvm::json::Array const* argument_array = entry->getArray("arguments"))
+    {
+      for (llvm::json::Value const& argument : *argument_array)
+        if (std::optional<llvm::StringRef> str = argument.getAsString())
+          arguments.push_back(str->str());
+    }
+    else if (std::optional<llvm::StringRef> command = entry->getString("command"))
+    {
+      llvm::BumpPtrAllocator allocator;
+      llvm::StringSaver saver(allocator);
+      llvm::SmallVector<char const*, 64> argv;
+      llvm::cl::TokenizeGNUCommandLine(*command, saver, argv);
+      arguments.assign(argv.begin(), argv.end());
+    }
+    else
+      THROW_LALERT("'[FILENAME]': entry for \"[FILE]\" has no \"arguments\" or \"command\"", AIArgs("[FILENAME]", filename.native())("[FILE]", file->str()));
+
+    std::filesystem::path const dir = directory->str();
+    std::filesystem::path const path = (dir / file->str()).lexically_normal();
+    // If a file occurs more than once, use the first entry (like clang tools do).
+    files_.try_emplace(path.native(), parse_arguments(arguments, dir));
+  }
+
+  Dout(dc::notice, "Read " << files_.size() << " files from \"" << filename.native() << "\".");
+}
+
+//static
+CompilationOptions CompilationDatabase::parse_arguments(std::vector<std::string> const& arguments, std::filesystem::path const& directory)
+{
+  struct Flag
+  {
+    std::string_view name_;
+    clang::frontend::IncludeDirGroup group_;
+    char type_;                                 // 'D' or 'U' for macros, 'i' for -include, 'm' for -imacros,
+                                                // 'p' for an ignored option with a value, or '\0' for an include directory.
+  };
+  static constexpr Flag flags[] = {
+    { "-isystem",     clang::frontend::System,  '\0' },
+    { "-iquote",      clang::frontend::Quoted,  '\0' },
+    { "-idirafter",   clang::frontend::After,   '\0' },
+    { "-include-pch", clang::frontend::Angled,  'p' },   // Must come before -include.
+    { "-include",     clang::frontend::Angled,  'i' },
+    { "-imacros",     clang::frontend::Angled,  'm' },
+    { "-I",           clang::frontend::Angled,  '\0' },
+    { "-D",           clang::frontend::Angled,  'D' },
+    { "-U",           clang::frontend::Angled,  'U' }
+  };
+
+  CompilationOptions result;
+  // Skip the compiler itself.
+  for (size_t i = 1; i < arguments.size(); ++i)
+  {
+    std::string_view const argument = arguments[i];
+    if (argument.starts_with("-std="))
+    {
+      std::string_view const standard = argument.substr(5);
+      if (clang::LangStandard::getLangKind(llvm::StringRef(standard.data(), standard.size())) != clang::LangStandard::lang_unspecified)
+        result.language_standard_ = standard;
+      else
+        Dout(dc::warning, "Ignoring unknown language standard \"" << standard << "\".");
+      continue;
+    }
+    for (Flag const& flag : flags)
+    {
+      if (!argument.starts_with(flag.name_))
+        continue;
+      // The value is either attached (-Ifoo) or the next argument (-I foo).
+      std::string value;
+      if (argument.size() > flag.name_.size())
+        value = argument.substr(flag.name_.size());
+      else if (i + 1 < arguments.size())
+        value = arguments[++i];
+      else
+        break;
+      if (flag.type_ == 'D' || flag.type_ == 'U')
+        result.macro_operations_.emplace_back(flag.type_, std::move(value));
+      else if (flag.type_ == 'i' || flag.type_ == 'm')
+      {
+        // The compiler looks for these in its working directory first, and then in the search path.
+        std::filesystem::path path = value;
+        std::error_code ec;
+        if (path.is_relative() && std::filesystem::is_regular_file(directory / path, ec))
+          path = (directory / path).lexically_normal();
+        (flag.type_ == 'i' ? result.includes_ : result.macro_includes_).push_back(path.native());
+      }
+      else if (flag.type_ == '\0')
+      {
+        // Relative include directories are relative to the directory of the compile command.
+        std::filesystem::path path = value;
+        if (path.is_relative())
+          path = (directory / path).lexically_normal();
+        result.include_directories_.emplace_back(flag.group_, path.native());
+      }
+      break;
+    }
+  }
+  return result;
+}
+
+CompilationOptions const* CompilationDatabase::find(std::filesystem::path const& absolute_path) const
+{
+  auto entry = files_.find(absolute_path.lexically_normal().native());
+  return entry == files_.end() ? nullptr : &entry->second;
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+#include "CompilationOptions.h"
+#include <filesystem>
+#include <string>
+#include <unordered_map>
+
+// The preprocessor options of every file in a compile_commands.json.
+//
+// Only the options that influence preprocessing are extracted from the
+// compile commands: -I, -iquote, -isystem, -idirafter, -D, -U, -include,
+// -imacros and -std=. Everything else (the compiler, warnings, -o, etc) is
+// ignored.
+class CompilationDatabase
+{
+ private:
+  std::unordered_map<std::string, CompilationOptions> files_;   // Keyed by the normalized absolute path of the source file.
+
+ public:
+  // Read `build_directory`/compile_commands.json.
+  CompilationDatabase(std::filesystem::path const& build_directory);
+
+  // Return the options of `absolute_path`, or nullptr if that file isn't in the database.
+  CompilationOptions const* find(std::filesystem::path const& absolute_path) const;
+
+  // Accessor.
+  size_t size() const { return files_.size(); }
+
+ private:
+  static CompilationOptions parse_arguments(std::vector<std::string> const& arguments, std::filesystem::path const& directory);
+};
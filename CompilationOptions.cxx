@@ -0,0 +1,101 @@
+#include "sys.h"
+#include "CompilationOptions.h"
+#include "clang/Basic/LangStandard.h"
+#include "debug.h"
+
+void CompilationOptions::append(CompilationOptions const& other)
+{
+  include_directories_.insert(include_directories_.end(), other.include_directories_.begin(), other.include_directories_.end());
+  macro_operations_.insert(macro_operations_.end(), other.macro_operations_.begin(), other.macro_operations_.end());
+  includes_.insert(includes_.end(), other.includes_.begin(), other.includes_.end());
+  macro_includes_.insert(macro_includes_.end(), other.macro_includes_.begin(), other.macro_includes_.end());
+  // Like on a command line, the last -std= wins.
+  if (!other.language_standard_.empty())
+    language_standard_ = other.language_standard_;
+}
+
+std::string CompilationOptions::key() const
+{
+  // Each field is terminated with a '\0' so that different options can't result in the same string.
+  std::string result;
+  for (auto const& [group, dir] : include_directories_)
+  {
+    result += 'I';
+    result += std::to_string(group);
+    result += ':';
+    result += dir;
+    result += '\0';
+  }
+  for (auto const& [type, macro] : macro_operations_)
+  {
+    result += type;
+    result += macro;
+    result += '\0';
+  }
+  for (std::string const& include : includes_)
+  {
+    result += 'i';
+    result += include;
+    result += '\0';
+  }
+  for (std::string const& macro_include : macro_includes_)
+  {
+    result += 'm';
+    result += macro_include;
+    result += '\0';
+  }
+  result += 's';
+  result += language_standard_;
+  result += '\0';
+  return result;
+}
+
+void CompilationOptions::configure_header_search_options(HeaderSearchOptions& header_search_options) const
+{
+  for (auto const& [group, dir] : include_directories_)
+  {
+    Dout(dc::notice, "Adding include directory \"" << dir << "\".");
+    header_search_options.AddPath(dir, group, false, false);
+  }
+}
+
+void CompilationOptions::configure_commandline_macro_definitions(clang::PreprocessorOptions& preprocessor_options) const
+{
+  for (auto const& [type, macro] : macro_operations_)
+  {
+    if (type == 'D')
+    {
+      Dout(dc::notice, "Adding macro definition \"" << macro << "\"");
+      preprocessor_options.addMacroDef(macro);
+    }
+    else
+    {
+      Dout(dc::notice, "Undefining macro \"" << macro << "\"");
+      preprocessor_options.addMacroUndef(macro);
+    }
+  }
+  // Both are processed as part of the predefines.
+  for (std::string const& macro_include : macro_includes_)
+  {
+    Dout(dc::notice, "Adding the macros of \"" << macro_include << "\"");
+    preprocessor_options.MacroIncludes.push_back(macro_include);
+  }
+  for (std::string const& include : includes_)
+  {
+    Dout(dc::notice, "Including \"" << include << "\"");
+    preprocessor_options.Includes.push_back(include);
+  }
+}
+
+void CompilationOptions::configure_language_options(clang::LangOptions& lang_options, llvm::Triple const& triple) const
+{
+  if (language_standard_.empty())
+    return;
+  // Only valid standards are stored (see CompilationDatabase::parse_arguments).
+  clang::LangStandard::Kind const kind = clang::LangStandard::getLangKind(language_standard_);
+  ASSERT(kind != clang::LangStandard::lang_unspecified);
+  Dout(dc::notice, "Using language standard \"" << language_standard_ << "\".");
+  // Only used for CUDA and OpenCL.
+  std::vector<std::string> includes;
+  clang::LangOptions::setLangDefaults(lang_options, clang::LangStandard::getLangStandardForKind(kind).getLanguage(), triple, includes, kind);
+}
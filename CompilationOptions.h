@@ -0,0 +1,40 @@
+#pragma once
+
+#include "ClangFrontend.h"
+#include <compare>
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+// The options that influence preprocessing of a translation unit:
+// the include directories, the macro definitions, the files that are
+// included implicitly (-include and -imacros) and the language standard.
+//
+// Files with equal CompilationOptions can be processed by the same
+// ClangFrontend, because those options are applied only once, when
+// the ClangFrontend is constructed.
+struct CompilationOptions
+{
+  using include_directory_type = std::pair<clang::frontend::IncludeDirGroup, std::string>;
+  using macro_operation_type = std::pair<char, std::string>;    // The first is 'D' (define) or 'U' (undefine).
+
+  std::vector<include_directory_type> include_directories_;     // In the order in which they must be searched.
+  std::vector<macro_operation_type> macro_operations_;          // In the order in which they must be applied.
+  std::vector<std::string> includes_;                           // The -include files, in the order in which they are included.
+  std::vector<std::string> macro_includes_;                     // The -imacros files, whose macros are defined before includes_ is processed.
+  std::string language_standard_;                               // The value of -std=, or empty for the default (C++20).
+
+  auto operator<=>(CompilationOptions const& other) const = default;
+
+  // Append the options of `other`.
+  void append(CompilationOptions const& other);
+
+  // Return a string that uniquely represents these options.
+  std::string key() const;
+
+  // Apply these options. Suitable to be passed to the ClangFrontend constructor (with std::bind_front).
+  void configure_header_search_options(HeaderSearchOptions& header_search_options) const;
+  void configure_commandline_macro_definitions(clang::PreprocessorOptions& preprocessor_options) const;
+  void configure_language_options(clang::LangOptions& lang_options, llvm::Triple const& triple) const;
+};
@@ -0,0 +1,76 @@
+#include "sys.h"
+#include "FileListReader.h"
+#include "utils/AIAlert.h"
+#include "llvm/ADT/StringRef.h"
+#include <algorithm>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include "debug.h"
+
+namespace {
+
+constexpr size_t chunk_size = 64 * 1024;
+
+} // namespace
+
+FileListReader::FileListReader(std::string const& filename, char separator) :
+  name_(filename == "-" ? "<stdin>" : filename), fd_(STDIN_FILENO), close_fd_(false), separator_(separator), chunk_(chunk_size)
+{
+  if (filename != "-")
+  {
+    fd_ = ::open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd_ == -1)
+      THROW_LALERTE("Could not open file list '[FILENAME]'", AIArgs("[FILENAME]", filename));
+    close_fd_ = true;
+  }
+}
+
+FileListReader::~FileListReader()
+{
+  if (close_fd_)
+    ::close(fd_);
+}
+
+void FileListReader::add_entry(std::vector<std::string>& entries, std::string_view entry) const
+{
+  // Only trim newline separated entries; NUL separated entries are taken literally.
+  if (separator_ == '\n')
+    entry = llvm::StringRef(entry.data(), entry.size()).trim();
+  if (!entry.empty())
+    entries.emplace_back(entry);
+}
+
+bool FileListReader::read(std::vector<std::string>& entries)
+{
+  ssize_t len;
+  do
+    len = ::read(fd_, chunk_.data(), chunk_.size());
+  while (len == -1 && errno == EINTR);
+  if (len == -1)
+    THROW_LALERTE("Failed to read from file list '[FILENAME]'", AIArgs("[FILENAME]", name_));
+
+  if (len == 0)
+  {
+    // The last entry doesn't need to be terminated.
+    add_entry(entries, partial_entry_);
+    partial_entry_.clear();
+    return false;
+  }
+
+  char const* const end = chunk_.data() + len;
+  char const* begin = chunk_.data();
+  for (char const* separator; (separator = std::find(begin, end, separator_)) != end; begin = separator + 1)
+  {
+    if (partial_entry_.empty())
+      add_entry(entries, std::string_view(begin, separator));
+    else
+    {
+      partial_entry_.append(begin, separator);
+      add_entry(entries, partial_entry_);
+      partial_entry_.clear();
+    }
+  }
+  partial_entry_.append(begin, end);
+  return true;
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Read a list of file names, from a file or from stdin, while it is being written.
+//
+// The list is read with read(2) in chunks; every call to `read` returns the
+// entries that were completed by the next chunk. Therefore, when the list
+// comes from a pipe (e.g. `find -print0 | cwformat --files0-from=-`), the
+// first entries are available as soon as the producer wrote them, long
+// before the whole list is known.
+//
+// Entries are separated by either a newline or a NUL character. In the
+// former case leading and trailing white space is removed from each entry.
+// Empty entries are skipped.
+class FileListReader
+{
+ private:
+  std::string name_;                    // The name of the list, for error messages.
+  int fd_;
+  bool close_fd_;                       // Set if fd_ was opened by us.
+  char separator_;                      // Either '\n' or '\0'.
+  std::string partial_entry_;           // The start of an entry whose separator wasn't read yet.
+  std::vector<char> chunk_;
+
+ public:
+  // Read the list from the file `filename`, or from stdin if `filename` is "-".
+  FileListReader(std::string const& filename, char separator);
+  ~FileListReader();
+
+  FileListReader(FileListReader const&) = delete;
+  FileListReader& operator=(FileListReader const&) = delete;
+
+  // Append the entries completed by the next chunk of input to `entries`.
+  // Blocks until at least one byte could be read. Returns false when the end of the list was reached.
+  bool read(std::vector<std::string>& entries);
+
+ private:
+  void add_entry(std::vector<std::string>& entries, std::string_view entry) const;
+};
@@ -0,0 +1,92 @@
+#include "sys.h"
+#include "FormatProtocol.h"
+#include "utils/AIAlert.h"
+#include <cerrno>
+#include <cstring>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include "debug.h"
+
+namespace format_protocol {
+
+bool read_exactly(int fd, void* buf, size_t size)
+{
+  char* ptr = static_cast<char*>(buf);
+  size_t done = 0;
+  while (done < size)
+  {
+    ssize_t len = ::read(fd, ptr + done, size - done);
+    if (len == -1)
+    {
+      if (errno == EINTR)
+        continue;
+      THROW_LALERTE("Failed to read from socket");
+    }
+    if (len == 0)
+    {
+      if (done == 0)
+        return false;
+      THROW_LALERT("Connection closed in the middle of a message");
+    }
+    done += len;
+  }
+  return true;
+}
+
+void write_exactly(int fd, void const* buf, size_t size)
+{
+  char const* ptr = static_cast<char const*>(buf);
+  size_t done = 0;
+  while (done < size)
+  {
+    // Use send with MSG_NOSIGNAL so that a peer that went away results in EPIPE instead of SIGPIPE.
+    ssize_t len = ::send(fd, ptr + done, size - done, MSG_NOSIGNAL);
+    if (len == -1)
+    {
+      if (errno == EINTR)
+        continue;
+      THROW_LALERTE("Failed to write to socket");
+    }
+    done += len;
+  }
+}
+
+int connect(std::filesystem::path const& socket_path)
+{
+  sockaddr_un addr{};
+  addr.sun_family = AF_UNIX;
+  if (socket_path.native().size() >= sizeof(addr.sun_path))
+    THROW_LALERT("Socket path '[PATH]' is too long", AIArgs("[PATH]", socket_path.native()));
+  std::memcpy(addr.sun_path, socket_path.c_str(), socket_path.native().size() + 1);
+
+  int fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd == -1)
+    THROW_LALERTE("Failed to create socket");
+  if (::connect(fd, reinterpret_cast<sockaddr const*>(&addr), sizeof(addr)) == -1)
+  {
+    int saved_errno = errno;
+    ::close(fd);
+    errno = saved_errno;
+    THROW_LALERTE("Failed to connect to '[PATH]'", AIArgs("[PATH]", socket_path.native()));
+  }
+  return fd;
+}
+
+bool format_remote(int fd, std::string const& filename, llvm::StringRef content, std::string& result)
+{
+  RequestHeader request_header{filename.size(), content.size()};
+  write_exactly(fd, &request_header, sizeof(request_header));
+  write_exactly(fd, filename.data(), filename.size());
+  write_exactly(fd, content.data(), content.size());
+
+  ResponseHeader response_header;
+  if (!read_exactly(fd, &response_header, sizeof(response_header)))
+    THROW_LALERT("Server closed the connection");
+  result.resize(response_header.length);
+  if (response_header.length > 0 && !read_exactly(fd, result.data(), result.size()))
+    THROW_LALERT("Server closed the connection");
+  return response_header.status == success;
+}
+
+} // namespace format_protocol
@@ -0,0 +1,57 @@
+#pragma once
+
+#include "llvm/ADT/StringRef.h"
+#include <cstdint>
+#include <filesystem>
+#include <string>
+
+// The protocol spoken between `cwformat --connect=<socket>` and `cwformat --server=<socket>`
+// over a local (AF_UNIX) stream socket.
+//
+// A client may send any number of requests over one connection; each request is answered
+// with exactly one response, in order. The connection is closed by the client.
+//
+// Request:  RequestHeader, followed by filename_length bytes of filename and content_length bytes of content.
+//           The filename is the absolute path of the file (used to resolve #include "...") or empty for stdin.
+// Response: ResponseHeader, followed by length bytes: the formatted output if status is success, or an error message.
+//
+namespace format_protocol {
+
+struct RequestHeader
+{
+  uint64_t filename_length;
+  uint64_t content_length;
+};
+
+enum Status : uint64_t
+{
+  success,
+  failure
+};
+
+struct ResponseHeader
+{
+  uint64_t status;
+  uint64_t length;
+};
+
+// Sanity limits on what a server accepts.
+static constexpr uint64_t max_filename_length = 0x10000;
+static constexpr uint64_t max_content_length = 0x7fffffff;      // TranslationUnit::offset_type is 32 bit.
+
+// Read exactly `size` bytes from `fd` into `buf`.
+// Returns false if the peer closed the connection before the first byte was read; throws on errors or truncation.
+bool read_exactly(int fd, void* buf, size_t size);
+
+// Write exactly `size` bytes from `buf` to `fd`. Throws on errors.
+void write_exactly(int fd, void const* buf, size_t size);
+
+// Connect to a server listening on `socket_path`. Returns the connected socket; throws on failure.
+int connect(std::filesystem::path const& socket_path);
+
+// Send one request over the connected socket `fd` and wait for the response.
+// Returns true if the server formatted the content successfully, in which case `result` contains the output;
+// otherwise `result` contains the error message of the server.
+bool format_remote(int fd, std::string const& filename, llvm::StringRef content, std::string& result);
+
+} // namespace format_protocol
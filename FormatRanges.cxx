@@ -0,0 +1,66 @@
+#include "sys.h"
+#include "FormatRanges.h"
+#include "SourceFile.h"
+#include <algorithm>
+#include "debug.h"
+
+FormatRanges::FormatRanges(SourceFile const& source_file, std::vector<LineRange> const& line_ranges, std::vector<ByteRange> const& byte_ranges)
+{
+  std::string_view const text = source_file.span(source_file.begin(), source_file.size());
+  offset_type const size = text.size();
+
+  // Find the offset of the start of every line.
+  std::vector<offset_type> line_starts{0};
+  for (offset_type offset = 0; offset < size; ++offset)
+    if (text[offset] == '\n' && offset + 1 < size)
+      line_starts.push_back(offset + 1);
+  auto line_end = [&](unsigned int line) -> offset_type {       // line is zero-based.
+    return line + 1 < line_starts.size() ? line_starts[line + 1] : size;
+  };
+
+  for (LineRange const& line_range : line_ranges)
+  {
+    unsigned int const first = line_range.first_ - 1;
+    if (first >= line_starts.size())
+      continue;
+    unsigned int const last = std::min<unsigned int>(line_range.last_ - 1, line_starts.size() - 1);
+    ranges_.push_back({line_starts[first], line_end(last)});
+  }
+
+  for (ByteRange const& byte_range : byte_ranges)
+  {
+    if (byte_range.begin_ > size)
+      continue;
+    // Extend the range to whole lines.
+    auto first = std::upper_bound(line_starts.begin(), line_starts.end(), byte_range.begin_) - 1;
+    offset_type const end = std::clamp(byte_range.end_, byte_range.begin_, size);
+    auto last = end == byte_range.begin_ ? first : std::upper_bound(line_starts.begin(), line_starts.end(), end - 1) - 1;
+    ranges_.push_back({*first, line_end(last - line_starts.begin())});
+  }
+
+  // Sort and merge.
+  std::ranges::sort(ranges_, {}, &ByteRange::begin_);
+  std::vector<ByteRange> merged;
+  for (ByteRange const& range : ranges_)
+  {
+    if (!merged.empty() && range.begin_ <= merged.back().end_)
+      merged.back().end_ = std::max(merged.back().end_, range.end_);
+    else
+      merged.push_back(range);
+  }
+  ranges_ = std::move(merged);
+
+#ifdef CWDEBUG
+  for (ByteRange const& range : ranges_)
+    Dout(dc::notice, "Formatting range [" << range.begin_ << ", " << range.end_ << ").");
+#endif
+}
+
+bool FormatRanges::intersects(offset_type begin, offset_type end) const
+{
+  // Find the first range that ends after begin.
+  auto range = std::ranges::upper_bound(ranges_, begin, {}, &ByteRange::end_);
+  if (range == ranges_.end())
+    return false;
+  return begin == end ? range->begin_ <= begin : range->begin_ < end;
+}
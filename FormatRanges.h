@@ -0,0 +1,40 @@
+#pragma once
+
+#include <vector>
+
+// Forward declaration.
+class SourceFile;
+
+// The parts of a SourceFile that must be formatted, if not the whole file.
+//
+// The ranges are extended to whole lines, sorted and merged. Everything
+// outside of them is copied to the output verbatim.
+class FormatRanges
+{
+ public:
+  using offset_type = unsigned int;                     // Must be the same as TranslationUnit::offset_type.
+
+  struct LineRange
+  {
+    unsigned int first_;                                // One-based.
+    unsigned int last_;                                 // One-based, inclusive.
+  };
+
+  struct ByteRange
+  {
+    offset_type begin_;
+    offset_type end_;                                   // One past the end.
+  };
+
+ private:
+  std::vector<ByteRange> ranges_;
+
+ public:
+  FormatRanges(SourceFile const& source_file, std::vector<LineRange> const& line_ranges, std::vector<ByteRange> const& byte_ranges);
+
+  // Return true if [begin, end) overlaps with any of the ranges (or, if empty, lies inside one).
+  bool intersects(offset_type begin, offset_type end) const;
+
+  // Accessor.
+  std::vector<ByteRange> const& ranges() const { return ranges_; }
+};
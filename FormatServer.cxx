@@ -0,0 +1,286 @@
+#include "sys.h"
+#include "FormatServer.h"
+#include "FormatProtocol.h"
+#include "utils/AIAlert.h"
+#include <algorithm>
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <sstream>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include "debug.h"
+
+namespace {
+
+// Set by a stop signal.
+volatile std::sig_atomic_t stop_requested = 0;
+
+void request_stop(int)
+{
+  stop_requested = 1;
+}
+
+} // namespace
+
+FormatServer::FormatServer(std::filesystem::path const& socket_path, unsigned int number_of_workers,
+    configure_header_search_options_type configure_header_search_options,
+    configure_commandline_macro_definitions_type configure_commandline_macro_definitions,
+    configure_language_options_type configure_language_options,
+    FrontendSettings const& frontend_settings, format_type format) :
+  socket_path_(socket_path), number_of_workers_(number_of_workers),
+  configure_header_search_options_(std::move(configure_header_search_options)),
+  configure_commandline_macro_definitions_(std::move(configure_commandline_macro_definitions)),
+  configure_language_options_(std::move(configure_language_options)),
+  frontend_settings_(frontend_settings), format_(std::move(format)), listen_fd_(-1), bound_(false), stopping_(false)
+{
+  if (number_of_workers_ == 0)
+    number_of_workers_ = std::max(1U, std::thread::hardware_concurrency());
+}
+
+FormatServer::~FormatServer()
+{
+  // run() joins the workers before it returns or throws; this is only a safety net.
+  if (!workers_.empty())
+    stop();
+  if (listen_fd_ != -1)
+    ::close(listen_fd_);
+  if (bound_)
+  {
+    std::error_code ignored_ec;
+    std::filesystem::remove(socket_path_, ignored_ec);
+  }
+}
+
+void FormatServer::listen()
+{
+  sockaddr_un addr{};
+  addr.sun_family = AF_UNIX;
+  if (socket_path_.native().size() >= sizeof(addr.sun_path))
+    THROW_LALERT("Socket path '[PATH]' is too long", AIArgs("[PATH]", socket_path_.native()));
+  std::memcpy(addr.sun_path, socket_path_.c_str(), socket_path_.native().size() + 1);
+
+  // Non-blocking, so that a connection that is aborted between poll and accept doesn't block the server.
+  listen_fd_ = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+  if (listen_fd_ == -1)
+    THROW_LALERTE("Failed to create socket");
+
+  if (::bind(listen_fd_, reinterpret_cast<sockaddr const*>(&addr), sizeof(addr)) == -1)
+  {
+    if (errno != EADDRINUSE)
+      THROW_LALERTE("Failed to bind socket to '[PATH]'", AIArgs("[PATH]", socket_path_.native()));
+    // The socket file already exists. If nobody is listening on it, it was left behind by a server that was killed.
+    int probe_fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (probe_fd == -1)
+      THROW_LALERTE("Failed to create socket");
+    bool in_use = ::connect(probe_fd, reinterpret_cast<sockaddr const*>(&addr), sizeof(addr)) == 0;
+    int connect_errno = errno;
+    ::close(probe_fd);
+    if (in_use)
+      THROW_LALERT("Another server is already listening on '[PATH]'", AIArgs("[PATH]", socket_path_.native()));
+    if (connect_errno != ECONNREFUSED)
+    {
+      errno = connect_errno;
+      THROW_LALERTE("Failed to bind socket to '[PATH]'", AIArgs("[PATH]", socket_path_.native()));
+    }
+    Dout(dc::notice, "Removing stale socket \"" << socket_path_.native() << "\".");
+    std::filesystem::remove(socket_path_);
+    if (::bind(listen_fd_, reinterpret_cast<sockaddr const*>(&addr), sizeof(addr)) == -1)
+      THROW_LALERTE("Failed to bind socket to '[PATH]'", AIArgs("[PATH]", socket_path_.native()));
+  }
+  bound_ = true;
+
+  if (::listen(listen_fd_, SOMAXCONN) == -1)
+    THROW_LALERTE("Failed to listen on '[PATH]'", AIArgs("[PATH]", socket_path_.native()));
+}
+
+void FormatServer::run()
+{
+  listen();
+
+  // Create the frontends here, so that a failure (for example of --pch) is reported before serving anything.
+  clang_frontends_.resize(number_of_workers_);
+  for (std::unique_ptr<ClangFrontend>& clang_frontend : clang_frontends_)
+    create_frontend(clang_frontend);
+
+  // Block the stop signals in all threads (the workers inherit this mask); they are only delivered while waiting for a connection.
+  sigset_t stop_signals;
+  sigemptyset(&stop_signals);
+  for (int signum : {SIGINT, SIGTERM, SIGHUP})
+    sigaddset(&stop_signals, signum);
+  sigset_t original_mask;
+  pthread_sigmask(SIG_BLOCK, &stop_signals, &original_mask);
+  sigset_t wait_mask = original_mask;
+  struct sigaction action{};
+  action.sa_handler = request_stop;
+  sigemptyset(&action.sa_mask);
+  for (int signum : {SIGINT, SIGTERM, SIGHUP})
+  {
+    sigdelset(&wait_mask, signum);
+    ::sigaction(signum, &action, nullptr);
+  }
+
+  Dout(dc::notice, "Listening on \"" << socket_path_.native() << "\" with " << number_of_workers_ << " workers.");
+
+  try
+  {
+    workers_.reserve(number_of_workers_);
+    for (unsigned int worker_index = 0; worker_index < number_of_workers_; ++worker_index)
+      workers_.emplace_back(&FormatServer::worker, this, worker_index);
+
+    while (!stop_requested)
+    {
+      pollfd listen_pollfd{listen_fd_, POLLIN, 0};
+      if (::ppoll(&listen_pollfd, 1, nullptr, &wait_mask) == -1)
+      {
+        if (errno == EINTR)
+          continue;
+        THROW_LALERTE("Failed to wait for connections on '[PATH]'", AIArgs("[PATH]", socket_path_.native()));
+      }
+      int fd = ::accept4(listen_fd_, nullptr, nullptr, SOCK_CLOEXEC);
+      if (fd == -1)
+      {
+        if (errno == EINTR || errno == ECONNABORTED || errno == EAGAIN || errno == EWOULDBLOCK)
+          continue;
+        THROW_LALERTE("Failed to accept connection on '[PATH]'", AIArgs("[PATH]", socket_path_.native()));
+      }
+      {
+        std::lock_guard<std::mutex> lock(connections_mutex_);
+        connections_.push_back(fd);
+      }
+      connections_cv_.notify_one();
+    }
+    Dout(dc::notice, "Received a stop signal.");
+  }
+  catch (...)
+  {
+    stop();
+    pthread_sigmask(SIG_SETMASK, &original_mask, nullptr);
+    throw;
+  }
+  stop();
+  pthread_sigmask(SIG_SETMASK, &original_mask, nullptr);
+}
+
+void FormatServer::stop()
+{
+  {
+    std::lock_guard<std::mutex> lock(connections_mutex_);
+    stopping_ = true;
+    for (int fd : connections_)
+      ::close(fd);
+    connections_.clear();
+    // Let workers that are waiting for (or sending to) their client fail with that connection.
+    for (int fd : active_connections_)
+      ::shutdown(fd, SHUT_RDWR);
+  }
+  connections_cv_.notify_all();
+  for (std::thread& worker : workers_)
+    worker.join();
+  workers_.clear();
+}
+
+void FormatServer::worker(unsigned int worker_index)
+{
+  Debug(NAMESPACE_DEBUG::init_thread("server" + std::to_string(worker_index)));
+
+  // This ClangFrontend is kept alive, and therefore warm, until a file that it read changes (see serve).
+  std::unique_ptr<ClangFrontend>& clang_frontend = clang_frontends_[worker_index];
+
+  for (;;)
+  {
+    int fd;
+    {
+      std::unique_lock<std::mutex> lock(connections_mutex_);
+      connections_cv_.wait(lock, [this]{ return stopping_ || !connections_.empty(); });
+      if (stopping_)
+        return;
+      fd = connections_.front();
+      connections_.pop_front();
+      active_connections_.insert(fd);
+    }
+    // A problem with the connection; drop it and continue with the next one.
+    try
+    {
+      serve(clang_frontend, fd);
+    }
+    catch (AIAlert::Error const& error)
+    {
+      Dout(dc::warning, "Dropping connection: " << error);
+    }
+    catch (std::exception const& error)
+    {
+      Dout(dc::warning, "Dropping connection: " << error.what());
+    }
+    {
+      // Remove fd before closing it, so that stop() never shuts down a reused file descriptor.
+      std::lock_guard<std::mutex> lock(connections_mutex_);
+      active_connections_.erase(fd);
+    }
+    ::close(fd);
+  }
+}
+
+void FormatServer::serve(std::unique_ptr<ClangFrontend>& clang_frontend, int fd)
+{
+  using namespace format_protocol;
+
+  RequestHeader request_header;
+  while (read_exactly(fd, &request_header, sizeof(request_header)))
+  {
+    if (request_header.filename_length > max_filename_length || request_header.content_length > max_content_length)
+      THROW_LALERT("Invalid request header");
+
+    std::string filename(request_header.filename_length, '\0');
+    if (!read_exactly(fd, filename.data(), filename.size()))
+      THROW_LALERT("Connection closed in the middle of a message");
+
+    // Read the content directly into a (null-terminated) MemoryBuffer that can be handed to the SourceFile.
+    std::unique_ptr<llvm::WritableMemoryBuffer> input_buffer =
+      llvm::WritableMemoryBuffer::getNewUninitMemBuffer(request_header.content_length, filename.empty() ? "<stdin>" : filename);
+    if (!input_buffer)
+      THROW_LALERT("Failed to allocate a buffer of [SIZE] bytes", AIArgs("[SIZE]", request_header.content_length));
+    if (request_header.content_length > 0 && !read_exactly(fd, input_buffer->getBufferStart(), request_header.content_length))
+      THROW_LALERT("Connection closed in the middle of a message");
+
+    // Everything that the frontend cached (the contents of headers, what #include's resolve to, the guarded headers
+    // that can be skipped) is stale once a file that it read, or a directory that it looked in, changed: start over.
+    if (clang_frontend && clang_frontend->files_changed())
+      discard_frontend(clang_frontend);
+    if (!clang_frontend)
+      create_frontend(clang_frontend);
+
+    std::ostringstream output;
+    std::string error_message;
+    bool success = format_(*clang_frontend, filename, std::move(input_buffer), output, error_message);
+
+    std::string const& payload = success ? std::move(output).str() : error_message;
+    ResponseHeader response_header{success ? Status::success : Status::failure, payload.size()};
+    write_exactly(fd, &response_header, sizeof(response_header));
+    write_exactly(fd, payload.data(), payload.size());
+
+    // Let the frontend remember the directories of the files that it read for this request, while they are still the same.
+    if (clang_frontend->files_changed())
+      discard_frontend(clang_frontend);
+  }
+}
+
+void FormatServer::create_frontend(std::unique_ptr<ClangFrontend>& clang_frontend)
+{
+  clang_frontend = std::make_unique<ClangFrontend>(configure_header_search_options_,
+      configure_commandline_macro_definitions_, configure_language_options_, frontend_settings_);
+  // Remember the search directories (and the files of the prefix header).
+  clang_frontend->files_changed();
+}
+
+void FormatServer::discard_frontend(std::unique_ptr<ClangFrontend>& clang_frontend)
+{
+  Dout(dc::notice, "Discarding the ClangFrontend: files changed.");
+  clang_frontend.reset();
+  // The shared file system caches the status of files and the listings of directories too.
+  if (frontend_settings_.file_system_)
+    frontend_settings_.file_system_->clear();
+}
@@ -0,0 +1,85 @@
+#pragma once
+
+#include "ClangFrontend.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include <condition_variable>
+#include <deque>
+#include <filesystem>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+// A persistent formatting server, listening on a local (AF_UNIX) socket.
+//
+// Every worker thread owns a ClangFrontend that is created when the server
+// starts, and then reused for every request that the worker serves. Hence the
+// TargetInfo, the header search setup and everything that the FileManager and
+// SourceManager cache (including the contents of headers) stay warm between
+// requests. Before each request the worker checks whether any of the files
+// that its frontend read, or the directories that those (and the search
+// directories) are in, changed on disk; if so, the frontend is replaced by a
+// new one (see ClangFrontend::files_changed), and the shared file system (if
+// any) forgets what it cached.
+//
+// Accepted connections are queued and served, one connection at a time per
+// worker, until the client closes it. See FormatProtocol.h for the protocol.
+//
+// The server stops when it receives SIGINT, SIGTERM or SIGHUP, or when an
+// error occurs that isn't specific to one connection; it then closes all
+// connections, joins the worker threads and removes the socket.
+class FormatServer
+{
+ public:
+  using configure_header_search_options_type = OptionsBase::configure_header_search_options_type;
+  using configure_commandline_macro_definitions_type = OptionsBase::configure_commandline_macro_definitions_type;
+  using configure_language_options_type = OptionsBase::configure_language_options_type;
+  // Format input_buffer, using filename to resolve quoted includes (empty for stdin), and write the result to output.
+  // Must return false if formatting failed, after setting error_message.
+  using format_type = std::function<bool(ClangFrontend&, std::filesystem::path const& filename,
+      std::unique_ptr<llvm::MemoryBuffer>&& input_buffer, std::ostream& output, std::string& error_message)>;
+
+ private:
+  std::filesystem::path socket_path_;
+  unsigned int number_of_workers_;
+  configure_header_search_options_type configure_header_search_options_;
+  configure_commandline_macro_definitions_type configure_commandline_macro_definitions_;
+  configure_language_options_type configure_language_options_;
+  FrontendSettings frontend_settings_;
+  format_type format_;
+  int listen_fd_;
+  bool bound_;                                  // Set when the socket file was created by us.
+
+  std::vector<std::unique_ptr<ClangFrontend>> clang_frontends_;        // The frontend of each worker; null after it was discarded.
+  std::vector<std::thread> workers_;
+
+  std::mutex connections_mutex_;                // Protects the following three members.
+  std::condition_variable connections_cv_;      // Notified when a connection was added to connections_, or stopping_ was set.
+  std::deque<int> connections_;                 // Accepted connections that are not being served yet.
+  std::set<int> active_connections_;            // Connections that are being served.
+  bool stopping_;                               // Set when the workers must stop.
+
+ public:
+  // Use `number_of_workers` threads; if zero, use one thread per hardware thread.
+  FormatServer(std::filesystem::path const& socket_path, unsigned int number_of_workers,
+      configure_header_search_options_type configure_header_search_options,
+      configure_commandline_macro_definitions_type configure_commandline_macro_definitions,
+      configure_language_options_type configure_language_options,
+      FrontendSettings const& frontend_settings, format_type format);
+  ~FormatServer();
+
+  // Create the socket and serve requests. Returns when a stop signal was received; throws on error.
+  void run();
+
+ private:
+  void listen();
+  void stop();
+  void worker(unsigned int worker_index);
+  void serve(std::unique_ptr<ClangFrontend>& clang_frontend, int fd);
+  void create_frontend(std::unique_ptr<ClangFrontend>& clang_frontend);
+  void discard_frontend(std::unique_ptr<ClangFrontend>& clang_frontend);
+};
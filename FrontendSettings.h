@@ -0,0 +1,22 @@
+#pragma once
+
+#include "CachingFileSystem.h"
+#include "llvm/ADT/IntrusiveRefCntPtr.h"
+#include <cstddef>
+#include <filesystem>
+#include <memory>
+
+class GuardedHeaderDiskCache;
+
+// Run-wide settings of a ClangFrontend that do not influence the result,
+// only how it is obtained (as opposed to CompilationOptions); except for
+// prefix_header_, which is included in the options hash of the run cache.
+struct FrontendSettings
+{
+  bool directives_only_headers_ = false;        // Only lex the preprocessor directives of included files (see HeaderDirectivesCache).
+  std::filesystem::path prefix_header_;         // If not empty, every file is processed as if it started with #include "prefix_header_" (see --pch).
+  bool replay_guarded_headers_ = false;         // Replay guarded headers that were entered by an earlier TU, if possible (see GuardedHeaderCache).
+  std::shared_ptr<GuardedHeaderDiskCache> guarded_header_disk_cache_;  // If set, also replay those entered by an earlier run (requires replay_guarded_headers_).
+  llvm::IntrusiveRefCntPtr<CachingFileSystem> file_system_;     // If set, the file system that is shared by the FileManager's of all frontends.
+  size_t max_rss_ = 0;                          // If not zero, WorkerPool recycles its frontends when the resident memory exceeds this many bytes.
+};
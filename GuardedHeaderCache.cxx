@@ -0,0 +1,25 @@
+#include "sys.h"
+#include "GuardedHeaderCache.h"
+#include <algorithm>
+#include "debug.h"
+
+GuardedHeaderCache::Record const* GuardedHeaderCache::insert(Record&& record)
+{
+  unsigned int const uid = record.file_.getUID();
+  auto [iter, inserted] = records_.try_emplace(uid, std::move(record));
+  if (!inserted)
+    return nullptr;
+  Dout(dc::notice, "Recorded guarded header \"" << iter->second.file_.getName().str() << "\" with " <<
+      iter->second.context_.size() << " macros of context and " << iter->second.entered_.size() << " entered files.");
+  return &iter->second;
+}
+
+void GuardedHeaderCache::forget(clang::FileEntryRef file)
+{
+  std::erase_if(records_, [file](auto const& uid_record){
+    Record const& record = uid_record.second;
+    return record.file_ == file ||
+      std::ranges::find(record.entered_, file) != record.entered_.end() ||
+      std::ranges::find(record.skipped_, file) != record.skipped_.end();
+  });
+}
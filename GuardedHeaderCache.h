@@ -0,0 +1,60 @@
+#pragma once
+
+#include "clang/Basic/FileEntry.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// The effect of guarded headers (by an include guard or #pragma once), recorded
+// while a TU entered them, so that later TUs can skip them.
+//
+// The only thing that a header contributes to a TU is its effect on the state
+// of the Preprocessor: the macros that it (and everything it includes) defines
+// and undefines, and which files were included. That effect is fully determined
+// by the macros that were looked up while processing the header (in #if, #ifdef,
+// defined(), macro expansions and include guards of skipped files), for as far as
+// they weren't defined by the header itself: its context.
+//
+// Hence, when a later TU includes the same header while its context is the same,
+// the Preprocessor is given the recorded #define and #undef directives instead
+// (see GuardedHeaderReplayer); that is one small buffer instead of all the files
+// that were entered, none of which is opened or lexed again.
+//
+// One GuardedHeaderCache per ClangFrontend; the records refer to FileEntry's of
+// its FileManager. Not thread-safe. See GuardedHeaderDiskCache for keeping the
+// records for later runs.
+class GuardedHeaderCache
+{
+ public:
+  struct Record
+  {
+    clang::FileEntryRef file_;                          // The guarded header.
+    std::string guard_;                                 // The include guard macro of file_, or empty if it uses #pragma once.
+    // The macros that were looked up but not defined by the header, with their definition
+    // when the header was entered, or an empty string if they weren't defined.
+    std::vector<std::pair<std::string, std::string>> context_;
+    std::vector<clang::FileEntryRef> entered_;          // The files that were entered while processing the header.
+    std::vector<clang::FileEntryRef> skipped_;          // The #pragma once files that were skipped because they were included before the header.
+    std::vector<clang::FileEntryRef> pragma_once_;      // The files, of file_ and entered_, that use #pragma once.
+    std::vector<std::string> searched_directories_;     // The directories that #include's and __has_include's of the header looked in.
+    std::unique_ptr<llvm::MemoryBuffer> replay_buffer_; // The #define and #undef directives that were executed, in order.
+  };
+
+ private:
+  std::unordered_map<unsigned int, Record> records_;    // Indexed by FileEntry UID (nodes are stable, so are the replay buffers).
+
+ public:
+  // Store `record`, unless there already is one for the same file (whose replay buffer might still be in use).
+  // Returns the stored record, or nullptr if there already was one.
+  Record const* insert(Record&& record);
+
+  // Forget every record that refers to `file`. Must be called before the FileEntry of `file` is invalidated.
+  void forget(clang::FileEntryRef file);
+
+  // Accessors.
+  std::unordered_map<unsigned int, Record> const& records() const { return records_; }
+  size_t size() const { return records_.size(); }
+};
@@ -0,0 +1,439 @@
+#include "sys.h"
+#include "GuardedHeaderDiskCache.h"
+#include "utils/AIAlert.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/xxhash.h"
+#include <algorithm>
+#include <chrono>
+#include <format>
+#include <fstream>
+#include <optional>
+#include <tuple>
+#include <unordered_map>
+#include <unistd.h>
+#include "debug.h"
+
+namespace {
+
+// The first line of an index file.
+constexpr char const* index_magic = "cwformat-guarded-headers 2";
+
+// A modification time in nanoseconds, as the time_t that a FileEntry has.
+time_t to_time_t(int64_t mtime_ns)
+{
+  return std::chrono::floor<std::chrono::seconds>(std::chrono::nanoseconds(mtime_ns)).count();
+}
+
+} // namespace
+
+GuardedHeaderDiskCache::GuardedHeaderDiskCache(std::filesystem::path const& index_path) : index_path_(index_path)
+{
+  load();
+}
+
+//static
+uint64_t GuardedHeaderDiskCache::configuration_hash(clang::HeaderSearch const& header_search, clang::TargetInfo const& target_info)
+{
+  std::string configuration = target_info.getTriple().str();
+  for (clang::ConstSearchDirIterator dir = header_search.search_dir_begin(); dir != header_search.search_dir_end(); ++dir)
+  {
+    if (dir == header_search.angled_dir_begin())
+      configuration += "<>";
+    if (dir == header_search.system_dir_begin())
+      configuration += "[]";
+    configuration += '\0';
+    configuration += dir->getName();
+  }
+  return llvm::xxh3_64bits(llvm::StringRef(configuration));
+}
+
+//static
+bool GuardedHeaderDiskCache::get_file_status(llvm::StringRef path, FileStatus& file_status)
+{
+  // Always ask the real file system: this is what validates the records.
+  llvm::sys::fs::file_status status;
+  if (llvm::sys::fs::status(path, status) || status.type() != llvm::sys::fs::file_type::regular_file)
+    return false;
+  file_status.size_ = status.getSize();
+  file_status.mtime_ns_ =
+    std::chrono::duration_cast<std::chrono::nanoseconds>(status.getLastModificationTime().time_since_epoch()).count();
+  return true;
+}
+
+//static
+int64_t GuardedHeaderDiskCache::get_directory_mtime(llvm::StringRef directory)
+{
+  llvm::sys::fs::file_status status;
+  if (llvm::sys::fs::status(directory, status))
+    return -1;
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(status.getLastModificationTime().time_since_epoch()).count();
+}
+
+void GuardedHeaderDiskCache::load_into(GuardedHeaderCache& cache, clang::FileManager& file_manager, uint64_t configuration_hash) const
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+
+  // Look up the file at `path`, which must still be the file that was validated when the index was loaded
+  // (this can be much later, in server mode); each path is only checked once.
+  std::unordered_map<std::string, clang::OptionalFileEntryRef> checked_files;
+  auto get_file = [&](std::string const& path) -> clang::OptionalFileEntryRef {
+    auto [checked_file, inserted] = checked_files.try_emplace(path);
+    if (!inserted)
+      return checked_file->second;
+    auto file_status = file_statuses_.find(path);
+    FileStatus current_status;
+    if (file_status == file_statuses_.end() || !get_file_status(path, current_status) || current_status != file_status->second)
+      return std::nullopt;
+    // The FileManager, whose modification times are in seconds, could have cached an older version.
+    clang::OptionalFileEntryRef file = file_manager.getOptionalFileRef(path);
+    if (!file || static_cast<uint64_t>(file->getSize()) != current_status.size_ || file->getModificationTime() != to_time_t(current_status.mtime_ns_))
+      return std::nullopt;
+    return checked_file->second = file;
+  };
+  // Likewise, the directories that were looked in must still have the same modification time.
+  std::unordered_map<std::string, bool> checked_directories;
+  auto directory_unchanged = [&](std::string const& directory) {
+    auto [checked_directory, inserted] = checked_directories.try_emplace(directory, false);
+    if (inserted)
+    {
+      auto directory_mtime = directory_mtimes_.find(directory);
+      checked_directory->second = directory_mtime != directory_mtimes_.end() && get_directory_mtime(directory) == directory_mtime->second;
+    }
+    return checked_directory->second;
+  };
+  auto get_files = [&](std::vector<std::string> const& paths, std::vector<clang::FileEntryRef>& files) {
+    for (std::string const& path : paths)
+    {
+      clang::OptionalFileEntryRef file = get_file(path);
+      if (!file)
+        return false;
+      files.push_back(*file);
+    }
+    return true;
+  };
+
+  size_t number_of_records = 0;
+  for (auto const& [key, record] : records_)
+  {
+    if (key.first != configuration_hash)
+      continue;
+    clang::OptionalFileEntryRef file = get_file(key.second);
+    if (!file)
+      continue;
+    GuardedHeaderCache::Record cache_record{*file, record.guard_, record.context_};
+    if (!get_files(record.entered_, cache_record.entered_) || !get_files(record.skipped_, cache_record.skipped_) ||
+        !get_files(record.pragma_once_, cache_record.pragma_once_) || !std::ranges::all_of(record.searched_directories_, directory_unchanged))
+      continue;
+    cache_record.searched_directories_ = record.searched_directories_;
+    cache_record.replay_buffer_ = llvm::MemoryBuffer::getMemBufferCopy(record.replay_text_, "<replay " + key.second + ">");
+    cache.insert(std::move(cache_record));
+    ++number_of_records;
+  }
+  Dout(dc::notice, "Loaded " << number_of_records << " guarded header records from the disk cache.");
+}
+
+void GuardedHeaderDiskCache::entered(clang::FileEntryRef file, clang::FileManager& file_manager)
+{
+  std::string path = file_manager.getCanonicalName(file).str();
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (file_statuses_.contains(path))
+      return;
+  }
+  FileStatus file_status;
+  if (!get_file_status(path, file_status))
+    return;
+  std::lock_guard<std::mutex> lock(mutex_);
+  file_statuses_.try_emplace(std::move(path), file_status);
+}
+
+void GuardedHeaderDiskCache::record(GuardedHeaderCache::Record const& record, clang::FileManager& file_manager, uint64_t configuration_hash)
+{
+  // The files must still be the ones that were processed, or the record can't be trusted by a later run.
+  // The status of a file when it was entered (or loaded) is compared with the current status below; the FileEntry
+  // only has the modification time in seconds, which is compared in case a file was never seen by entered.
+  std::vector<std::pair<std::string, FileStatus>> files;
+  auto get_path = [&](clang::FileEntryRef file) -> std::optional<std::string> {
+    std::string path = file_manager.getCanonicalName(file).str();
+    FileStatus file_status;
+    // Paths containing a newline can't be stored.
+    if (path.empty() || path.find('\n') != std::string::npos || !get_file_status(path, file_status) ||
+        file_status.size_ != static_cast<uint64_t>(file.getSize()) || to_time_t(file_status.mtime_ns_) != file.getModificationTime())
+      return std::nullopt;
+    files.emplace_back(path, file_status);
+    return path;
+  };
+  auto get_paths = [&](std::vector<clang::FileEntryRef> const& file_entries, std::vector<std::string>& paths) {
+    for (clang::FileEntryRef file : file_entries)
+    {
+      std::optional<std::string> path = get_path(file);
+      if (!path)
+        return false;
+      paths.push_back(std::move(*path));
+    }
+    return true;
+  };
+
+  std::optional<std::string> path = get_path(record.file_);
+  Record disk_record{record.guard_, record.context_};
+  if (!path || !get_paths(record.entered_, disk_record.entered_) || !get_paths(record.skipped_, disk_record.skipped_) ||
+      !get_paths(record.pragma_once_, disk_record.pragma_once_))
+    return;
+  disk_record.replay_text_ = record.replay_buffer_->getBuffer().str();
+  for (std::string const& directory : record.searched_directories_)
+    if (directory.find('\n') != std::string::npos)
+      return;
+  disk_record.searched_directories_ = record.searched_directories_;
+
+  // Find the directories whose modification time isn't known yet.
+  std::vector<std::string> directories;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (std::string const& directory : disk_record.searched_directories_)
+      if (!directory_mtimes_.contains(directory))
+        directories.push_back(directory);
+  }
+  std::vector<int64_t> mtimes;
+  for (std::string const& directory : directories)
+    mtimes.push_back(get_directory_mtime(directory));
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  for (size_t index = 0; index < directories.size(); ++index)
+    directory_mtimes_.try_emplace(std::move(directories[index]), mtimes[index]);
+  // If one of the files changed during this run, keep what was recorded first.
+  for (auto const& [file_path, file_status] : files)
+    if (auto known = file_statuses_.find(file_path); known != file_statuses_.end() && known->second != file_status)
+      return;
+  for (auto& [file_path, file_status] : files)
+    file_statuses_.try_emplace(std::move(file_path), file_status);
+  records_.insert_or_assign(key_type{configuration_hash, std::move(*path)}, std::move(disk_record));
+}
+
+// The index is a text file; after the magic line it contains the files and directories that the records refer to,
+//
+//   f <size> <mtime_ns> <canonical path>
+//   t <mtime_ns> <directory>
+//
+// where the modification time of a directory is -1 if it doesn't exist, followed by the records; each a line
+// with the key and the guard (which is empty for #pragma once), followed by its context (a macro name and its
+// definition without the trailing newline, if it was defined), the files that were entered, skipped and that
+// use #pragma once (as an index into the files), the directories that were looked in (as an index into the
+// directories) and the lines of the replay text:
+//
+//   h <configuration hash> <file index> <guard>
+//   c <name> <definition>
+//   e <file index>
+//   s <file index>
+//   p <file index>
+//   l <directory index>
+//   d <directive>
+void GuardedHeaderDiskCache::load()
+{
+  auto buffer_or_err = llvm::MemoryBuffer::getFile(index_path_.native());
+  if (!buffer_or_err)
+    return;     // No index yet.
+
+  llvm::StringRef content = buffer_or_err.get()->getBuffer();
+  llvm::StringRef header;
+  std::tie(header, content) = content.split('\n');
+  if (header != index_magic)
+  {
+    Dout(dc::notice, "Discarding guarded header cache \"" << index_path_.native() << "\": unknown format.");
+    return;
+  }
+
+  struct File
+  {
+    std::string path_;
+    FileStatus status_;
+    bool valid_;                        // Set if the size and modification time are still the same.
+  };
+  std::vector<File> files;
+  struct Directory
+  {
+    std::string path_;
+    int64_t mtime_ns_;
+    bool valid_;                        // Set if the modification time is still the same.
+  };
+  std::vector<Directory> directories;
+  std::map<key_type, Record> records;
+  std::optional<key_type> key;          // The key of the record that is being read.
+  Record record;
+  bool valid = false;                   // Set if all files of record are still valid.
+
+  auto finish_record = [&]{
+    if (key && valid)
+      records.insert_or_assign(std::move(*key), std::move(record));
+    key.reset();
+    record = {};
+  };
+
+  while (!content.empty())
+  {
+    llvm::StringRef line;
+    std::tie(line, content) = content.split('\n');
+
+    bool error = false;
+    llvm::StringRef kind, field;
+    std::tie(kind, line) = line.split(' ');
+    // Return the path of the file whose index is in `index_field`.
+    auto file_path = [&](llvm::StringRef index_field) -> std::string {
+      size_t index;
+      error |= index_field.getAsInteger(10, index) || index >= files.size();
+      if (error)
+        return {};
+      valid &= files[index].valid_;
+      return files[index].path_;
+    };
+    if (kind == "f")
+    {
+      File file;
+      std::tie(field, line) = line.split(' ');
+      error |= field.getAsInteger(10, file.status_.size_);
+      std::tie(field, line) = line.split(' ');
+      error |= field.getAsInteger(10, file.status_.mtime_ns_) || line.empty();
+      if (!error)
+      {
+        FileStatus current_status;
+        file.path_ = line.str();
+        file.valid_ = get_file_status(line, current_status) && current_status == file.status_;
+        files.push_back(std::move(file));
+      }
+    }
+    else if (kind == "t")
+    {
+      int64_t mtime_ns;
+      std::tie(field, line) = line.split(' ');
+      error |= field.getAsInteger(10, mtime_ns) || line.empty();
+      if (!error)
+        directories.emplace_back(line.str(), mtime_ns, get_directory_mtime(line) == mtime_ns);
+    }
+    else if (kind == "h")
+    {
+      finish_record();
+      uint64_t configuration_hash;
+      std::tie(field, line) = line.split(' ');
+      error |= field.getAsInteger(16, configuration_hash);
+      std::tie(field, line) = line.split(' ');
+      valid = true;
+      std::string path = file_path(field);
+      key.emplace(configuration_hash, std::move(path));
+      record.guard_ = line.str();
+    }
+    else if (kind == "c" && key)
+    {
+      std::tie(field, line) = line.split(' ');
+      error |= field.empty();
+      record.context_.emplace_back(field.str(), line.empty() ? std::string{} : line.str() + '\n');
+    }
+    else if (kind == "e" && key)
+      record.entered_.push_back(file_path(line));
+    else if (kind == "s" && key)
+      record.skipped_.push_back(file_path(line));
+    else if (kind == "p" && key)
+      record.pragma_once_.push_back(file_path(line));
+    else if (kind == "l" && key)
+    {
+      size_t index;
+      error |= line.getAsInteger(10, index) || index >= directories.size();
+      if (!error)
+      {
+        valid &= directories[index].valid_;
+        record.searched_directories_.push_back(directories[index].path_);
+      }
+    }
+    else if (kind == "d" && key)
+    {
+      record.replay_text_ += line.str();
+      record.replay_text_ += '\n';
+    }
+    else
+      error = true;
+    if (error)
+    {
+      Dout(dc::warning, "Discarding corrupt guarded header cache \"" << index_path_.native() << "\".");
+      return;
+    }
+  }
+  finish_record();
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  records_ = std::move(records);
+  for (File& file : files)
+    if (file.valid_)
+      file_statuses_.try_emplace(std::move(file.path_), file.status_);
+  for (Directory& directory : directories)
+    if (directory.valid_)
+      directory_mtimes_.try_emplace(std::move(directory.path_), directory.mtime_ns_);
+  Dout(dc::notice, "Loaded " << records_.size() << " guarded header records from \"" << index_path_.native() << "\".");
+}
+
+void GuardedHeaderDiskCache::save() const
+{
+  std::filesystem::create_directories(index_path_.parent_path());
+
+  // Write to a temporary file first, so that a concurrent run never sees a partial index.
+  std::filesystem::path temp_path = index_path_;
+  temp_path += std::format(".tmp-{}", ::getpid());
+  {
+    std::ofstream ofile(temp_path, std::ios::binary | std::ios::trunc);
+    if (!ofile.is_open())
+      THROW_LALERTE("Failed to create '[FILENAME]'", AIArgs("[FILENAME]", temp_path.native()));
+    ofile << index_magic << '\n';
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    // Only write the files and directories that the records refer to.
+    std::unordered_map<std::string, size_t> file_indices;
+    std::unordered_map<std::string, size_t> directory_indices;
+    auto write_file = [&](std::string const& path) {
+      if (file_indices.try_emplace(path, file_indices.size()).second)
+      {
+        FileStatus const& file_status = file_statuses_.at(path);
+        ofile << "f " << file_status.size_ << ' ' << file_status.mtime_ns_ << ' ' << path << '\n';
+      }
+    };
+    for (auto const& [key, record] : records_)
+    {
+      write_file(key.second);
+      for (auto const* paths : { &record.entered_, &record.skipped_, &record.pragma_once_ })
+        for (std::string const& path : *paths)
+          write_file(path);
+      for (std::string const& directory : record.searched_directories_)
+        if (directory_indices.try_emplace(directory, directory_indices.size()).second)
+          ofile << "t " << directory_mtimes_.at(directory) << ' ' << directory << '\n';
+    }
+
+    for (auto const& [key, record] : records_)
+    {
+      auto const& [configuration_hash, path] = key;
+      ofile << std::format("h {:016x} {} ", configuration_hash, file_indices.at(path)) << record.guard_ << '\n';
+      for (auto const& [name, definition] : record.context_)
+        ofile << "c " << name << ' ' << llvm::StringRef(definition).rtrim('\n').str() << '\n';
+      for (std::string const& entered : record.entered_)
+        ofile << "e " << file_indices.at(entered) << '\n';
+      for (std::string const& skipped : record.skipped_)
+        ofile << "s " << file_indices.at(skipped) << '\n';
+      for (std::string const& pragma_once : record.pragma_once_)
+        ofile << "p " << file_indices.at(pragma_once) << '\n';
+      for (std::string const& directory : record.searched_directories_)
+        ofile << "l " << directory_indices.at(directory) << '\n';
+      llvm::StringRef replay_text = record.replay_text_;
+      while (!replay_text.empty())
+      {
+        llvm::StringRef directive;
+        std::tie(directive, replay_text) = replay_text.split('\n');
+        ofile << "d " << directive.str() << '\n';
+      }
+    }
+    ofile.close();
+    if (!ofile.good())
+    {
+      std::error_code ignored_ec;
+      std::filesystem::remove(temp_path, ignored_ec);
+      THROW_LALERT("Failed writing '[FILENAME]'", AIArgs("[FILENAME]", temp_path.native()));
+    }
+  }
+  std::filesystem::rename(temp_path, index_path_);
+}
@@ -0,0 +1,88 @@
+#pragma once
+
+#include "GuardedHeaderCache.h"
+#include "clang/Basic/FileManager.h"
+#include "clang/Basic/TargetInfo.h"
+#include "clang/Lex/HeaderSearch.h"
+#include <cstdint>
+#include <filesystem>
+#include <map>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// The records of a GuardedHeaderCache, stored on disk for later runs; shared by all ClangFrontend's of a run.
+//
+// A record is context-keyed already (see GuardedHeaderCache): it can only be replayed when
+// the macros that it depends on have the same definition as when it was recorded. What it
+// doesn't capture is the files themselves; therefore the files are stored by their canonical
+// path, and a record is only loaded if the size and modification time (in nanoseconds) of the
+// header, and of every file that was entered or skipped while processing it, are still the same
+// as when they were first entered. Likewise the files that an #include (or __has_include)
+// resolves to depend on the search path, so records are keyed by the configuration of the
+// frontend that recorded them (see configuration_hash), and on what is in the directories that
+// were looked in: a record is also only loaded if the modification time of each of those
+// directories is still the same (creating, removing or renaming a file changes it).
+//
+// Loaded records are inserted into the GuardedHeaderCache of every new frontend (see load_into),
+// so that even the first TU of a run can replay a header without reading any of its files.
+//
+// Thread-safe.
+class GuardedHeaderDiskCache
+{
+ private:
+  using key_type = std::pair<uint64_t, std::string>;   // Configuration hash, canonical path of the header.
+
+  struct FileStatus
+  {
+    uint64_t size_;
+    int64_t mtime_ns_;
+
+    friend bool operator==(FileStatus const&, FileStatus const&) = default;
+  };
+
+  // A GuardedHeaderCache::Record with the files replaced by their canonical path.
+  struct Record
+  {
+    std::string guard_;
+    std::vector<std::pair<std::string, std::string>> context_;
+    std::vector<std::string> entered_;
+    std::vector<std::string> skipped_;
+    std::vector<std::string> pragma_once_;
+    std::vector<std::string> searched_directories_;
+    std::string replay_text_;
+  };
+
+  std::filesystem::path index_path_;
+
+  mutable std::mutex mutex_;                            // Protects the members below.
+  std::map<key_type, Record> records_;
+  std::unordered_map<std::string, FileStatus> file_statuses_;   // The status of files when first seen (by load or entered).
+  std::unordered_map<std::string, int64_t> directory_mtimes_;   // The modification time of directories when first seen (-1 if they don't exist).
+
+ public:
+  // Load the records from `index_path`, if it exists, that are still valid.
+  GuardedHeaderDiskCache(std::filesystem::path const& index_path);
+
+  // Return the hash of everything, other than the macro context, that determines what a header does.
+  static uint64_t configuration_hash(clang::HeaderSearch const& header_search, clang::TargetInfo const& target_info);
+
+  // Insert the records that were stored with `configuration_hash` into `cache`, whose files are looked up with `file_manager`.
+  void load_into(GuardedHeaderCache& cache, clang::FileManager& file_manager, uint64_t configuration_hash) const;
+
+  // Remember the status of `file`, that is being entered by a frontend whose FileManager is `file_manager`.
+  void entered(clang::FileEntryRef file, clang::FileManager& file_manager);
+
+  // Store `record`, that was recorded by a frontend with `configuration_hash` and whose files belong to `file_manager`.
+  void record(GuardedHeaderCache::Record const& record, clang::FileManager& file_manager, uint64_t configuration_hash);
+
+  // Write the records back to disk.
+  void save() const;
+
+ private:
+  static bool get_file_status(llvm::StringRef path, FileStatus& file_status);
+  static int64_t get_directory_mtime(llvm::StringRef directory);
+  void load();
+};
@@ -0,0 +1,427 @@
+#include "sys.h"
+#include "GuardedHeaderReplayer.h"
+#include "macro_definitions.h"
+#include "clang/Lex/Lexer.h"
+#include "clang/Lex/MacroArgs.h"
+#include "clang/Lex/MacroInfo.h"
+#include "llvm/ADT/SmallString.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/raw_ostream.h"
+#include <algorithm>
+#include <cstring>
+#include <format>
+#include "debug.h"
+
+GuardedHeaderReplayer::GuardedHeaderReplayer(clang::Preprocessor& pp, clang::HeaderSearch& header_search,
+    GuardedHeaderCache& cache, GuardedHeaderDiskCache* disk_cache, uint64_t configuration_hash, Statistics::File* statistics) :
+  pp_(pp), source_manager_(pp.getSourceManager()), header_search_(header_search), cache_(cache), disk_cache_(disk_cache),
+  configuration_hash_(configuration_hash), statistics_(statistics), angled_begin_(0)
+{
+  for (clang::ConstSearchDirIterator dir = header_search_.search_dir_begin(); dir != header_search_.search_dir_end(); ++dir)
+  {
+    if (dir == header_search_.angled_dir_begin())
+      angled_begin_ = search_directories_.size();
+    search_directories_.push_back(dir->isNormalDir() ? dir->getName().str() : std::string{});
+  }
+  for (auto const& [uid, record] : cache_.records())
+  {
+    clang::IdentifierInfo* synthetic_guard = pp_.getIdentifierInfo(std::format("__cwformat_guard_{}", uid));
+    // Causes the HeaderSearch to call updateOutOfDateIdentifier when the header is included for the first time.
+    synthetic_guard->setOutOfDate(true);
+    header_search_.SetFileControllingMacro(record.file_, synthetic_guard);
+    synthetic_guards_.emplace(synthetic_guard, &record);
+  }
+}
+
+void GuardedHeaderReplayer::LexedFileChanged(clang::FileID FID, LexedFileChangeReason Reason,
+    clang::SrcMgr::CharacteristicKind FileType, clang::FileID PrevFID, clang::SourceLocation Loc)
+{
+  if (Reason == LexedFileChangeReason::EnterFile)
+  {
+    // Buffers without a file (the predefines and replay buffers) are part of the header that entered them, if any.
+    clang::OptionalFileEntryRef file = source_manager_.getFileEntryRefForID(FID);
+    if (!file || FID == source_manager_.getMainFileID())
+      return;
+    if (disk_cache_)
+      disk_cache_->entered(*file, source_manager_.getFileManager());
+    for (Frame& frame : frames_)
+      frame.entered_.push_back(*file);
+    frames_.push_back(Frame{FID, *file});
+  }
+  else if (Reason == LexedFileChangeReason::ExitFile && !frames_.empty() && frames_.back().file_id_ == PrevFID)
+  {
+    Frame frame = std::move(frames_.back());
+    frames_.pop_back();
+    store(std::move(frame));
+  }
+}
+
+void GuardedHeaderReplayer::FileSkipped(clang::FileEntryRef const& SkippedFile, clang::Token const& FilenameTok,
+    clang::SrcMgr::CharacteristicKind FileType)
+{
+  if (pending_skip_ && pending_skip_->record_->file_ == SkippedFile)
+  {
+    GuardedHeaderCache::Record const& record = *pending_skip_->record_;
+    bool const replay = pending_skip_->replay_;
+    pending_skip_.reset();
+    if (!record.guard_.empty())
+    {
+      // From now on let the real include guard control the header, so it is entered again if that is #undef-ed.
+      header_search_.SetFileControllingMacro(record.file_, pp_.getIdentifierInfo(record.guard_));
+      if (!replay)
+        query(record.guard_);
+    }
+    if (replay)
+    {
+      Dout(dc::notice, "Replaying guarded header \"" << record.file_.getName().str() << "\".");
+      if (statistics_)
+        ++statistics_->headers_replayed_;
+      clang::SourceLocation const include_location = FilenameTok.getLocation();
+      clang::FileID file_id = source_manager_.createFileID(record.replay_buffer_->getMemBufferRef(),
+          clang::SrcMgr::C_System, /*LoadedID=*/0, /*LoadedOffset=*/0, include_location);
+      pp_.EnterSourceFile(file_id, nullptr, include_location);
+    }
+    return;
+  }
+
+  if (frames_.empty())
+    return;
+
+  // Record why the file was skipped.
+  clang::HeaderFileInfo& header_file_info = header_search_.getFileInfo(SkippedFile);
+  if (header_file_info.isPragmaOnce)
+  {
+    // A #pragma once file that was entered by the header itself doesn't depend on the context.
+    for (Frame& frame : frames_)
+      if (std::ranges::find(frame.entered_, SkippedFile) == frame.entered_.end())
+        frame.skipped_.push_back(SkippedFile);
+  }
+  else if (clang::IdentifierInfo const* controlling_macro = header_file_info.getControllingMacro(this);
+      controlling_macro && !synthetic_guards_.contains(controlling_macro))
+    query(controlling_macro->getName());
+  else
+    invalidate();
+}
+
+void GuardedHeaderReplayer::InclusionDirective(clang::SourceLocation HashLoc, clang::Token const& IncludeTok, llvm::StringRef FileName,
+    bool IsAngled, clang::CharSourceRange FilenameRange, clang::OptionalFileEntryRef File, llvm::StringRef SearchPath,
+    llvm::StringRef RelativePath, clang::Module const* SuggestedModule, bool ModuleImported, clang::SrcMgr::CharacteristicKind FileType)
+{
+  searched(HashLoc, FileName, IsAngled, File);
+}
+
+void GuardedHeaderReplayer::HasInclude(clang::SourceLocation Loc, llvm::StringRef FileName, bool IsAngled,
+    clang::OptionalFileEntryRef File, clang::SrcMgr::CharacteristicKind FileType)
+{
+  searched(Loc, FileName, IsAngled, File);
+}
+
+void GuardedHeaderReplayer::MacroDefined(clang::Token const& MacroNameTok, clang::MacroDirective const* MD)
+{
+  if (frames_.empty())
+    return;
+  clang::IdentifierInfo const* identifier = MacroNameTok.getIdentifierInfo();
+  std::string directive;
+  llvm::raw_string_ostream os(directive);
+  print_macro_definition(os, pp_, *identifier, *MD->getMacroInfo());
+  for (Frame& frame : frames_)
+  {
+    frame.replay_text_ += directive;
+    frame.touched_.insert(identifier->getName());
+  }
+}
+
+void GuardedHeaderReplayer::MacroUndefined(clang::Token const& MacroNameTok, clang::MacroDefinition const& MD,
+    clang::MacroDirective const* Undef)
+{
+  if (frames_.empty())
+    return;
+  llvm::StringRef const name = MacroNameTok.getIdentifierInfo()->getName();
+  for (Frame& frame : frames_)
+  {
+    frame.replay_text_ += "#undef ";
+    frame.replay_text_ += name;
+    frame.replay_text_ += '\n';
+    frame.touched_.insert(name);
+  }
+}
+
+void GuardedHeaderReplayer::MacroExpands(clang::Token const& MacroNameTok, clang::MacroDefinition const& MD,
+    clang::SourceRange Range, clang::MacroArgs const* Args)
+{
+  if (frames_.empty())
+    return;
+  clang::IdentifierInfo const* identifier = MacroNameTok.getIdentifierInfo();
+  clang::MacroInfo const* macro_info = MD.getMacroInfo();
+  if (macro_info->isBuiltinMacro())
+  {
+    // These expand to something that depends on where, or how often, the header is included.
+    if (identifier->isStr("__INCLUDE_LEVEL__") || identifier->isStr("__BASE_FILE__") || identifier->isStr("__COUNTER__"))
+      invalidate();
+    return;
+  }
+  // The identifiers in the replacement list are looked up again during rescanning.
+  query(identifier->getName());
+  for (clang::Token const& token : macro_info->tokens())
+    if (clang::IdentifierInfo const* replacement_identifier = token.getIdentifierInfo())
+      query(replacement_identifier->getName());
+  // And so are those in the arguments (think of a computed #include FOO(BAR), where BAR is not defined yet).
+  if (Args)
+    for (unsigned int argument = 0; argument < Args->getNumMacroArguments(); ++argument)
+      for (clang::Token const* token = Args->getUnexpArgument(argument); token->isNot(clang::tok::eof); ++token)
+        if (clang::IdentifierInfo const* argument_identifier = token->getIdentifierInfo())
+          query(argument_identifier->getName());
+}
+
+void GuardedHeaderReplayer::Defined(clang::Token const& MacroNameTok, clang::MacroDefinition const& MD, clang::SourceRange Range)
+{
+  query(MacroNameTok.getIdentifierInfo()->getName());
+}
+
+void GuardedHeaderReplayer::If(clang::SourceLocation Loc, clang::SourceRange ConditionRange, ConditionValueKind ConditionValue)
+{
+  if (ConditionValue != CVK_NotEvaluated)
+    query_identifiers(ConditionRange);
+}
+
+void GuardedHeaderReplayer::Elif(clang::SourceLocation Loc, clang::SourceRange ConditionRange, ConditionValueKind ConditionValue,
+    clang::SourceLocation IfLoc)
+{
+  if (ConditionValue != CVK_NotEvaluated)
+    query_identifiers(ConditionRange);
+}
+
+void GuardedHeaderReplayer::Ifdef(clang::SourceLocation Loc, clang::Token const& MacroNameTok, clang::MacroDefinition const& MD)
+{
+  query(MacroNameTok.getIdentifierInfo()->getName());
+}
+
+void GuardedHeaderReplayer::Ifndef(clang::SourceLocation Loc, clang::Token const& MacroNameTok, clang::MacroDefinition const& MD)
+{
+  query(MacroNameTok.getIdentifierInfo()->getName());
+}
+
+void GuardedHeaderReplayer::Elifdef(clang::SourceLocation Loc, clang::Token const& MacroNameTok, clang::MacroDefinition const& MD)
+{
+  query(MacroNameTok.getIdentifierInfo()->getName());
+}
+
+void GuardedHeaderReplayer::Elifndef(clang::SourceLocation Loc, clang::Token const& MacroNameTok, clang::MacroDefinition const& MD)
+{
+  query(MacroNameTok.getIdentifierInfo()->getName());
+}
+
+void GuardedHeaderReplayer::PragmaDirective(clang::SourceLocation Loc, clang::PragmaIntroducerKind Introducer)
+{
+  if (frames_.empty())
+    return;
+  // A _Pragma can come from a macro expansion; don't bother finding out what it is.
+  if (Introducer != clang::PIK_HashPragma)
+  {
+    invalidate();
+    return;
+  }
+  bool invalid = false;
+  char const* start = source_manager_.getCharacterData(Loc, &invalid);
+  if (invalid)
+  {
+    invalidate();
+    return;
+  }
+  llvm::StringRef line(start, std::strcspn(start, "\n"));
+  // Pragmas that change the macro state (or how identifiers or includes are handled) in a way that isn't replayed.
+  for (char const* name : { "push_macro", "pop_macro", "poison", "include_alias" })
+    if (line.contains(name))
+    {
+      invalidate();
+      return;
+    }
+}
+
+void GuardedHeaderReplayer::updateOutOfDateIdentifier(clang::IdentifierInfo const& II)
+{
+  // Only our synthetic guards are ever marked out of date.
+  const_cast<clang::IdentifierInfo&>(II).setOutOfDate(false);
+  auto synthetic_guard = synthetic_guards_.find(&II);
+  ASSERT(synthetic_guard != synthetic_guards_.end());
+  GuardedHeaderCache::Record const& record = *synthetic_guard->second;
+
+  if (!record.guard_.empty() && pp_.isMacroDefined(record.guard_))
+  {
+    // The header is going to be skipped anyway.
+    define_synthetic_guard(II);
+    pending_skip_ = PendingSkip{&record, false};
+    return;
+  }
+
+  if (!can_replay(record))
+  {
+    Dout(dc::notice, "Entering guarded header \"" << record.file_.getName().str() << "\": its context changed.");
+    return;
+  }
+
+  define_synthetic_guard(II);
+  pending_skip_ = PendingSkip{&record, true};
+
+  // Bring the include state up to date with what entering the header would have done.
+  pp_.markIncluded(record.file_);
+  for (clang::FileEntryRef file : record.entered_)
+    pp_.markIncluded(file);
+  for (clang::FileEntryRef file : record.pragma_once_)
+    header_search_.MarkFileIncludeOnce(file);
+
+  // And what the enclosing headers, if any, would have recorded (the macro directives follow when the replay buffer is lexed).
+  for (Frame& frame : frames_)
+  {
+    for (auto const& [name, definition] : record.context_)
+      if (!frame.touched_.contains(name))
+        frame.context_.try_emplace(name, definition);
+    frame.entered_.push_back(record.file_);
+    frame.entered_.insert(frame.entered_.end(), record.entered_.begin(), record.entered_.end());
+    for (clang::FileEntryRef file : record.skipped_)
+      if (std::ranges::find(frame.entered_, file) == frame.entered_.end())
+        frame.skipped_.push_back(file);
+    for (std::string const& directory : record.searched_directories_)
+      frame.searched_directories_.insert(directory);
+  }
+}
+
+void GuardedHeaderReplayer::query(llvm::StringRef name)
+{
+  std::optional<std::string> definition;
+  for (Frame& frame : frames_)
+  {
+    if (frame.touched_.contains(name) || frame.context_.contains(name))
+      continue;
+    if (!definition)
+      definition = current_macro_definition(pp_, name);
+    frame.context_.try_emplace(name, *definition);
+  }
+}
+
+void GuardedHeaderReplayer::query_identifiers(clang::SourceRange range)
+{
+  if (frames_.empty())
+    return;
+  bool invalid = false;
+  llvm::StringRef text = clang::Lexer::getSourceText(clang::CharSourceRange::getTokenRange(range), source_manager_, pp_.getLangOpts(), &invalid);
+  if (invalid)
+  {
+    invalidate();
+    return;
+  }
+  // The raw lexer needs a null-terminated buffer.
+  std::string const condition = text.str();
+  clang::Lexer lexer(clang::SourceLocation(), pp_.getLangOpts(), condition.data(), condition.data(), condition.data() + condition.size());
+  clang::Token token;
+  bool at_end;
+  do
+  {
+    at_end = lexer.LexFromRawLexer(token);
+    if (token.is(clang::tok::raw_identifier))
+      query(token.getRawIdentifier());
+  }
+  while (!at_end && token.isNot(clang::tok::eof));
+}
+
+void GuardedHeaderReplayer::searched(clang::SourceLocation location, llvm::StringRef file_name, bool is_angled,
+    clang::OptionalFileEntryRef file)
+{
+  // Only needed by the disk cache: within a run the directories are assumed not to change.
+  if (frames_.empty() || !disk_cache_ || file_name.empty())
+    return;
+
+  // The directories of the paths that were tried before the file was found (or all of them, if it wasn't): creating
+  // a file in one of those could change what the lookup resolves to. This doesn't have to be exact (think #include_next)
+  // as long as it is a superset.
+  std::vector<std::string> directories;
+  auto try_directory = [&](llvm::StringRef directory) {
+    llvm::SmallString<256> candidate(directory);
+    llvm::sys::path::append(candidate, file_name);
+    directories.push_back(llvm::sys::path::parent_path(candidate).str());
+    return file && candidate.str() == file->getName();
+  };
+  bool found = false;
+  if (llvm::sys::path::is_absolute(file_name))
+    found = try_directory({});
+  else if (!is_angled)
+  {
+    // A quoted include is first looked up relative to the directory of the includer. Buffers without a file
+    // (like the replay buffers) have none; then only the search path is used.
+    if (clang::OptionalFileEntryRef includer =
+        source_manager_.getFileEntryRefForID(source_manager_.getFileID(source_manager_.getExpansionLoc(location))))
+      found = try_directory(includer->getDir().getName());
+  }
+  if (!llvm::sys::path::is_absolute(file_name))
+    for (size_t index = is_angled ? angled_begin_ : 0; !found && index < search_directories_.size(); ++index)
+      if (!search_directories_[index].empty())
+        found = try_directory(search_directories_[index]);
+
+  for (Frame& frame : frames_)
+    for (std::string const& directory : directories)
+      frame.searched_directories_.insert(directory);
+}
+
+void GuardedHeaderReplayer::invalidate()
+{
+  for (Frame& frame : frames_)
+    frame.valid_ = false;
+}
+
+bool GuardedHeaderReplayer::can_replay(GuardedHeaderCache::Record const& record)
+{
+  for (auto const& [name, definition] : record.context_)
+    if (current_macro_definition(pp_, name) != definition)
+      return false;
+  // Entering the header would have skipped these.
+  for (clang::FileEntryRef file : record.entered_)
+    if (header_search_.getFileInfo(file).isPragmaOnce)
+      return false;
+  // Entering the header would have entered these.
+  for (clang::FileEntryRef file : record.skipped_)
+    if (!header_search_.getFileInfo(file).isPragmaOnce)
+      return false;
+  return true;
+}
+
+void GuardedHeaderReplayer::define_synthetic_guard(clang::IdentifierInfo const& synthetic_guard)
+{
+  pp_.appendDefMacroDirective(const_cast<clang::IdentifierInfo*>(&synthetic_guard), pp_.AllocateMacroInfo(clang::SourceLocation()));
+}
+
+void GuardedHeaderReplayer::store(Frame&& frame)
+{
+  if (!frame.valid_)
+    return;
+  clang::HeaderFileInfo& header_file_info = header_search_.getFileInfo(frame.file_);
+  std::string guard;
+  if (!header_file_info.isPragmaOnce)
+  {
+    clang::IdentifierInfo const* controlling_macro = header_file_info.getControllingMacro(this);
+    if (!controlling_macro || synthetic_guards_.contains(controlling_macro))
+      return;   // Not guarded.
+    guard = controlling_macro->getName().str();
+    // If the guard was already defined then nothing was recorded.
+    if (auto context = frame.context_.find(guard); context != frame.context_.end() && !context->second.empty())
+      return;
+  }
+
+  GuardedHeaderCache::Record record{frame.file_, std::move(guard)};
+  record.context_.reserve(frame.context_.size());
+  for (auto const& entry : frame.context_)
+    record.context_.emplace_back(entry.getKey().str(), entry.getValue());
+  if (header_file_info.isPragmaOnce)
+    record.pragma_once_.push_back(frame.file_);
+  for (clang::FileEntryRef file : frame.entered_)
+    if (header_search_.getFileInfo(file).isPragmaOnce)
+      record.pragma_once_.push_back(file);
+  record.entered_ = std::move(frame.entered_);
+  record.skipped_ = std::move(frame.skipped_);
+  for (auto const& directory : frame.searched_directories_)
+    record.searched_directories_.push_back(directory.getKey().str());
+  std::ranges::sort(record.searched_directories_);
+  record.replay_buffer_ = llvm::MemoryBuffer::getMemBufferCopy(frame.replay_text_, "<replay " + frame.file_.getName().str() + ">");
+  GuardedHeaderCache::Record const* stored_record = cache_.insert(std::move(record));
+  if (stored_record && disk_cache_)
+    disk_cache_->record(*stored_record, source_manager_.getFileManager(), configuration_hash_);
+}
@@ -0,0 +1,116 @@
+#pragma once
+
+#include "GuardedHeaderCache.h"
+#include "GuardedHeaderDiskCache.h"
+#include "Statistics.h"
+#include "clang/Basic/SourceManager.h"
+#include "clang/Lex/ExternalPreprocessorSource.h"
+#include "clang/Lex/HeaderSearch.h"
+#include "clang/Lex/PPCallbacks.h"
+#include "clang/Lex/Preprocessor.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/ADT/StringSet.h"
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Records guarded headers into, and replays them from, a GuardedHeaderCache; one per TU.
+//
+// Every header that has a record gets a synthetic include guard (__cwformat_guard_<uid>)
+// that is marked as out of date. The first time the header is included the HeaderSearch
+// asks us (as its ExternalPreprocessorSource) to bring that identifier up to date. If the
+// context of the record matches, the synthetic guard is defined, so that the header is
+// skipped, and the replay buffer of the record is entered instead (from FileSkipped);
+// otherwise the header is entered and processed normally.
+//
+// Meanwhile every header that is entered is recorded, unless something happens in it
+// that can't be replayed (like #pragma push_macro), for use by later TUs; and, if there
+// is a GuardedHeaderDiskCache, by later runs. For the latter, the directories that the
+// #include's and __has_include's of the header looked in are recorded too.
+class GuardedHeaderReplayer : public clang::PPCallbacks, public clang::ExternalPreprocessorSource
+{
+ private:
+  // A header that is being processed.
+  struct Frame
+  {
+    clang::FileID file_id_;
+    clang::FileEntryRef file_;
+    std::string replay_text_;                           // The #define and #undef directives executed so far.
+    llvm::StringMap<std::string> context_;              // See GuardedHeaderCache::Record::context_.
+    llvm::StringSet<> touched_;                         // The macros that were defined or undefined so far.
+    std::vector<clang::FileEntryRef> entered_;
+    std::vector<clang::FileEntryRef> skipped_;
+    llvm::StringSet<> searched_directories_;            // See GuardedHeaderCache::Record::searched_directories_.
+    bool valid_ = true;                                 // Reset when something happened that can't be replayed.
+  };
+
+  // The header that is about to be skipped because its synthetic guard was defined.
+  struct PendingSkip
+  {
+    GuardedHeaderCache::Record const* record_;
+    bool replay_;                                       // False if the header would be skipped anyway (its include guard is defined).
+  };
+
+  clang::Preprocessor& pp_;
+  clang::SourceManager& source_manager_;
+  clang::HeaderSearch& header_search_;
+  GuardedHeaderCache& cache_;
+  GuardedHeaderDiskCache* disk_cache_;                 // If not null, new records are also stored here.
+  uint64_t configuration_hash_;                         // The configuration hash of new records in disk_cache_.
+  Statistics::File* statistics_;
+  std::vector<std::string> search_directories_;        // The search path; empty strings for framework directories and header maps.
+  size_t angled_begin_;                                 // The index of the first directory that is searched for angled includes.
+  std::unordered_map<clang::IdentifierInfo const*, GuardedHeaderCache::Record const*> synthetic_guards_;
+  std::vector<Frame> frames_;                           // The include stack, not counting the main file.
+  std::optional<PendingSkip> pending_skip_;
+
+ public:
+  // The caller must also make this object the external lookup of `header_search`, for the lifetime of `pp`.
+  GuardedHeaderReplayer(clang::Preprocessor& pp, clang::HeaderSearch& header_search, GuardedHeaderCache& cache,
+      GuardedHeaderDiskCache* disk_cache, uint64_t configuration_hash, Statistics::File* statistics);
+
+ private:
+  // PPCallbacks.
+  void LexedFileChanged(clang::FileID FID, LexedFileChangeReason Reason, clang::SrcMgr::CharacteristicKind FileType,
+      clang::FileID PrevFID, clang::SourceLocation Loc) override;
+  void FileSkipped(clang::FileEntryRef const& SkippedFile, clang::Token const& FilenameTok, clang::SrcMgr::CharacteristicKind FileType) override;
+  void InclusionDirective(clang::SourceLocation HashLoc, clang::Token const& IncludeTok, llvm::StringRef FileName, bool IsAngled,
+      clang::CharSourceRange FilenameRange, clang::OptionalFileEntryRef File, llvm::StringRef SearchPath, llvm::StringRef RelativePath,
+      clang::Module const* SuggestedModule, bool ModuleImported, clang::SrcMgr::CharacteristicKind FileType) override;
+  void HasInclude(clang::SourceLocation Loc, llvm::StringRef FileName, bool IsAngled, clang::OptionalFileEntryRef File,
+      clang::SrcMgr::CharacteristicKind FileType) override;
+  void MacroDefined(clang::Token const& MacroNameTok, clang::MacroDirective const* MD) override;
+  void MacroUndefined(clang::Token const& MacroNameTok, clang::MacroDefinition const& MD, clang::MacroDirective const* Undef) override;
+  void MacroExpands(clang::Token const& MacroNameTok, clang::MacroDefinition const& MD, clang::SourceRange Range, clang::MacroArgs const* Args) override;
+  void Defined(clang::Token const& MacroNameTok, clang::MacroDefinition const& MD, clang::SourceRange Range) override;
+  void If(clang::SourceLocation Loc, clang::SourceRange ConditionRange, ConditionValueKind ConditionValue) override;
+  void Elif(clang::SourceLocation Loc, clang::SourceRange ConditionRange, ConditionValueKind ConditionValue, clang::SourceLocation IfLoc) override;
+  void Ifdef(clang::SourceLocation Loc, clang::Token const& MacroNameTok, clang::MacroDefinition const& MD) override;
+  void Ifndef(clang::SourceLocation Loc, clang::Token const& MacroNameTok, clang::MacroDefinition const& MD) override;
+  using clang::PPCallbacks::Elifdef;
+  void Elifdef(clang::SourceLocation Loc, clang::Token const& MacroNameTok, clang::MacroDefinition const& MD) override;
+  using clang::PPCallbacks::Elifndef;
+  void Elifndef(clang::SourceLocation Loc, clang::Token const& MacroNameTok, clang::MacroDefinition const& MD) override;
+  void PragmaDirective(clang::SourceLocation Loc, clang::PragmaIntroducerKind Introducer) override;
+
+  // ExternalPreprocessorSource.
+  void ReadDefinedMacros() override { }
+  void updateOutOfDateIdentifier(clang::IdentifierInfo const& II) override;
+  clang::IdentifierInfo* GetIdentifier(uint64_t ID) override { return nullptr; }
+  clang::Module* getModule(unsigned int ModuleID) override { return nullptr; }
+
+  // Record in every open frame that the state of macro `name` was looked up.
+  void query(llvm::StringRef name);
+  // Query every identifier in the source text of `range`.
+  void query_identifiers(clang::SourceRange range);
+  // Record in every open frame the directories that looking up `file_name` at `location` looked in.
+  void searched(clang::SourceLocation location, llvm::StringRef file_name, bool is_angled, clang::OptionalFileEntryRef file);
+  // Mark all open frames as invalid, because something happened that can't be replayed.
+  void invalidate();
+
+  bool can_replay(GuardedHeaderCache::Record const& record);
+  void define_synthetic_guard(clang::IdentifierInfo const& synthetic_guard);
+  void store(Frame&& frame);
+};
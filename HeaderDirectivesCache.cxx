@@ -0,0 +1,30 @@
+#include "sys.h"
+#include "HeaderDirectivesCache.h"
+#include "debug.h"
+
+std::optional<HeaderDirectivesCache::directives_type> HeaderDirectivesCache::get(clang::FileEntryRef file)
+{
+  // Never use this for the main file: all of its tokens are needed.
+  clang::FileID main_file_id = source_manager_.getMainFileID();
+  if (main_file_id.isValid() && source_manager_.getFileEntryRefForID(main_file_id) == file)
+    return std::nullopt;
+
+  auto [entry, inserted] = entries_.try_emplace(file.getUID());
+  if (inserted)
+  {
+    // Use the buffer of the SourceManager, so that the offsets of the tokens refer to the buffer that the Lexer will use.
+    std::optional<llvm::MemoryBufferRef> buffer = source_manager_.getMemoryBufferForFileOrNone(file);
+    entry->second.failed_ = !buffer ||
+      clang::scanSourceForDependencyDirectives(buffer->getBuffer(), entry->second.tokens_, entry->second.directives_);
+    if (entry->second.failed_)
+    {
+      // Fall back to lexing the whole file.
+      Dout(dc::warning, "Failed to scan the directives of \"" << file.getName().str() << "\".");
+      entry->second.tokens_.clear();
+      entry->second.directives_.clear();
+    }
+  }
+  if (entry->second.failed_)
+    return std::nullopt;
+  return directives_type{entry->second.directives_};
+}
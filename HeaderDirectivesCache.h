@@ -0,0 +1,49 @@
+#pragma once
+
+#include "clang/Basic/FileEntry.h"
+#include "clang/Basic/SourceManager.h"
+#include "clang/Lex/DependencyDirectivesScanner.h"
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/SmallVector.h"
+#include <optional>
+#include <unordered_map>
+
+// The preprocessor directives of included files.
+//
+// Only the directives of a header can have an effect on the main file
+// (by defining macros); every other token of a header is thrown away.
+// When the Preprocessor is given the result of clang's dependency
+// directives scanner (the machinery behind clang-scan-deps) for a file,
+// it lexes only those directives and skips everything else.
+//
+// A file is scanned the first time it is included and the result is kept
+// for as long as the SourceManager (that provides the buffer that the
+// directives refer to) lives: one HeaderDirectivesCache per ClangFrontend.
+//
+// Not thread-safe; but then neither is the ClangFrontend that owns it.
+class HeaderDirectivesCache
+{
+ public:
+  using directives_type = llvm::ArrayRef<clang::dependency_directives_scan::Directive>;
+
+ private:
+  struct Entry
+  {
+    llvm::SmallVector<clang::dependency_directives_scan::Token, 0> tokens_;
+    llvm::SmallVector<clang::dependency_directives_scan::Directive, 0> directives_;
+    bool failed_ = false;                       // Set if the file could not be read or scanned.
+  };
+
+  clang::SourceManager& source_manager_;
+  std::unordered_map<unsigned int, Entry> entries_;     // Indexed by FileEntry UID (nodes are stable, so are the directives).
+
+ public:
+  HeaderDirectivesCache(clang::SourceManager& source_manager) : source_manager_(source_manager) { }
+
+  // Return the directives of `file`, or nullopt if it must be lexed normally.
+  // Suitable for clang::PreprocessorOptions::DependencyDirectivesForFile.
+  std::optional<directives_type> get(clang::FileEntryRef file);
+
+  // Accessor.
+  size_t size() const { return entries_.size(); }
+};
@@ -0,0 +1,170 @@
+#include "sys.h"
+#include "InPlaceWriter.h"
+#include "utils/AIAlert.h"
+#include <atomic>
+#include <cerrno>
+#include <format>
+#include <map>
+#include <mutex>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "debug.h"
+
+namespace {
+
+// Filesystems that must be synced at the end of the run, each with an open directory descriptor on that filesystem.
+std::mutex pending_syncs_mutex;
+std::map<dev_t, int> pending_syncs;
+
+// Return a name for a temporary file in the same directory as `filename`; not necessarily unique.
+std::string temporary_name(std::string const& filename)
+{
+  static std::atomic<unsigned int> counter;
+  return std::format(".{}.cwformat-{}-{}", filename, ::getpid(), counter++);
+}
+
+} // namespace
+
+void InPlaceWriter::open_temporary_file()
+{
+  // If target is a symbolic link, replace the file that it points to, not the link.
+  std::error_code ec;
+  std::filesystem::path canonical_target = std::filesystem::canonical(target_, ec);
+  if (ec)
+    THROW_LALERTC(ec, "Failed to resolve '[FILENAME]'", AIArgs("[FILENAME]", target_.native()));
+  target_ = std::move(canonical_target);
+
+  std::filesystem::path directory = target_.parent_path();
+  if (directory.empty())
+    directory = ".";
+  dir_fd_ = ::open(directory.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (dir_fd_ == -1)
+    THROW_LALERTE("Failed to open directory '[DIRECTORY]'", AIArgs("[DIRECTORY]", directory.native()));
+
+  // Prefer an anonymous file: it never needs cleaning up, even if we are killed.
+  fd_ = ::openat(dir_fd_, ".", O_TMPFILE | O_WRONLY | O_CLOEXEC, 0600);
+  if (fd_ == -1)
+  {
+    // Not supported by this filesystem; fall back to a named temporary file.
+    std::string temp_path = (directory / (temporary_name(target_.filename().native()) + "-XXXXXX")).native();
+    fd_ = ::mkostemp(temp_path.data(), O_CLOEXEC);
+    if (fd_ == -1)
+    {
+      int saved_errno = errno;
+      ::close(dir_fd_);
+      dir_fd_ = -1;
+      errno = saved_errno;
+      THROW_LALERTE("Failed to create a temporary file in '[DIRECTORY]'", AIArgs("[DIRECTORY]", directory.native()));
+    }
+    temp_name_ = std::filesystem::path(temp_path).filename().native();
+  }
+}
+
+InPlaceWriter::~InPlaceWriter()
+{
+  if (fd_ != -1)
+  {
+    // Not committed: throw away what we wrote.
+    ::close(fd_);
+    if (!temp_name_.empty())
+      ::unlinkat(dir_fd_, temp_name_.c_str(), 0);
+  }
+  if (dir_fd_ != -1)
+    ::close(dir_fd_);
+}
+
+void InPlaceWriter::link_temporary_file()
+{
+  // Give the anonymous file a name. linkat with AT_EMPTY_PATH requires CAP_DAC_READ_SEARCH, but going through /proc doesn't.
+  std::string const proc_path = std::format("/proc/self/fd/{}", fd_);
+  for (;;)
+  {
+    std::string name = temporary_name(target_.filename().native());
+    if (::linkat(AT_FDCWD, proc_path.c_str(), dir_fd_, name.c_str(), AT_SYMLINK_FOLLOW) == 0)
+    {
+      temp_name_ = std::move(name);
+      return;
+    }
+    if (errno != EEXIST)
+      THROW_LALERTE("Failed to link temporary file for '[FILENAME]'", AIArgs("[FILENAME]", target_.native()));
+  }
+}
+
+InPlaceWriter::Result InPlaceWriter::commit(OutputBuilder const& output, SyncPolicy sync_policy)
+{
+  // The output was already compared with the original while it was produced.
+  size_t const difference = output.first_difference();
+  if (difference == std::string_view::npos)
+  {
+    Dout(dc::notice, "Output for \"" << target_.native() << "\" is identical to the original; not touching it.");
+    return unchanged;
+  }
+  Dout(dc::notice, "Output for \"" << target_.native() << "\" differs from the original at offset " << difference << ".");
+
+  open_temporary_file();
+  output.write_to(fd_);
+
+  // Give the new file the same permissions and owner as the original.
+  struct stat target_stat;
+  if (::fstatat(dir_fd_, target_.filename().c_str(), &target_stat, 0) == -1)
+    THROW_LALERTE("Failed to stat '[FILENAME]'", AIArgs("[FILENAME]", target_.native()));
+  if (::fchmod(fd_, target_stat.st_mode & 07777) == -1)
+    THROW_LALERTE("Failed to set the permissions of the temporary file for '[FILENAME]'", AIArgs("[FILENAME]", target_.native()));
+  if (target_stat.st_uid != ::geteuid() || target_stat.st_gid != ::getegid())
+  {
+    // This fails if we don't own the original file, which is fine: it is what editors do too.
+    if (::fchown(fd_, target_stat.st_uid, target_stat.st_gid) == -1)
+      Dout(dc::warning, "Could not preserve the owner of \"" << target_.native() << "\".");
+  }
+
+  if (sync_policy == sync_file && ::fsync(fd_) == -1)
+    THROW_LALERTE("Failed to sync temporary file for '[FILENAME]'", AIArgs("[FILENAME]", target_.native()));
+
+  if (temp_name_.empty())
+    link_temporary_file();
+
+  if (::renameat(dir_fd_, temp_name_.c_str(), dir_fd_, target_.filename().c_str()) == -1)
+    THROW_LALERTE("Failed to rename temporary file '[TEMPNAME]' to '[FILENAME]'", AIArgs("[TEMPNAME]", temp_name_)("[FILENAME]", target_.native()));
+  temp_name_.clear();
+
+  if (sync_policy == sync_file && ::fsync(dir_fd_) == -1)
+    THROW_LALERTE("Failed to sync the directory of '[FILENAME]'", AIArgs("[FILENAME]", target_.native()));
+
+  if (sync_policy == sync_end)
+  {
+    std::lock_guard<std::mutex> lock(pending_syncs_mutex);
+    if (!pending_syncs.contains(target_stat.st_dev))
+    {
+      int fd = ::dup(dir_fd_);
+      if (fd != -1)
+        pending_syncs.emplace(target_stat.st_dev, fd);
+    }
+  }
+
+  int fd = fd_;
+  fd_ = -1;
+  if (::close(fd) == -1)
+    THROW_LALERTE("Failed to close '[FILENAME]'", AIArgs("[FILENAME]", target_.native()));
+  return replaced;
+}
+
+//static
+void InPlaceWriter::sync_filesystems()
+{
+  std::lock_guard<std::mutex> lock(pending_syncs_mutex);
+  int first_errno = 0;
+  for (auto [device, fd] : pending_syncs)
+  {
+    Dout(dc::notice, "Syncing filesystem of device " << device << ".");
+    if (::syncfs(fd) == -1 && first_errno == 0)
+      first_errno = errno;
+    ::close(fd);
+  }
+  pending_syncs.clear();
+  if (first_errno != 0)
+  {
+    errno = first_errno;
+    THROW_LALERTE("syncfs failed");
+  }
+}
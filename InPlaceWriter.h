@@ -0,0 +1,59 @@
+#pragma once
+
+#include "OutputBuilder.h"
+#include <filesystem>
+#include <string>
+#include <string_view>
+
+// Atomically replaces a file with the content of an OutputBuilder.
+//
+// The OutputBuilder compares the output with the original content of the file
+// while it is being produced; if it is identical then the file isn't touched
+// at all (so that its mtime doesn't change).
+//
+// Otherwise the output is written to an anonymous file (O_TMPFILE) in the same
+// directory as the target; or, if the filesystem doesn't support that, to a
+// uniquely named temporary file created with mkstemp. The file then gets the
+// permissions (and, if possible, the owner) of the original, is given a name
+// (with linkat) and is renamed over the target.
+//
+// If anything fails, the original file is left untouched and the temporary
+// file is removed.
+class InPlaceWriter
+{
+ public:
+  enum Result
+  {
+    unchanged,          // The output is identical to the original; the target wasn't touched.
+    replaced            // The target was replaced with the output.
+  };
+
+  enum SyncPolicy
+  {
+    sync_none,          // Never sync; leave it to the kernel.
+    sync_file,          // fsync every file before it is renamed over the original.
+    sync_end            // Call sync_filesystems() once at the end of the run.
+  };
+
+ private:
+  std::filesystem::path target_;
+  int dir_fd_;                          // The directory containing target_; -1 until the output differs from the original.
+  int fd_;                              // The temporary file; -1 until the output differs from the original.
+  std::string temp_name_;               // The name of the temporary file relative to dir_fd_; empty while it is anonymous.
+
+ public:
+  // Prepare to replace `target`.
+  InPlaceWriter(std::filesystem::path const& target) : target_(target), dir_fd_(-1), fd_(-1) { }
+  ~InPlaceWriter();
+
+  // Atomically replace the target with `output`, unless that is identical to the current content of the target,
+  // which must have been passed to the constructor of `output` as original. Throws if anything went wrong.
+  Result commit(OutputBuilder const& output, SyncPolicy sync_policy);
+
+  // Sync all filesystems that files were committed to with sync_end. Called once at the end of the run.
+  static void sync_filesystems();
+
+ private:
+  void open_temporary_file();
+  void link_temporary_file();
+};
@@ -83,4 +83,7 @@ class InputToken
  public:
   InputToken(clang::Token const& token, std::string_view input_sequence) : payload_(token), input_sequence_(input_sequence) { }
   InputToken(PPToken const& preprocessor_token, std::string_view input_sequence) : payload_(preprocessor_token), input_sequence_(input_sequence) { }
+
+  // Accessor.
+  std::string_view input_sequence() const { return input_sequence_; }
 };
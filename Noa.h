@@ -6,6 +6,7 @@
 #include <concepts>
 
 class Noa;
+class OutputBuilder;
 
 template<typename T>
 concept ConceptNoa = std::derived_from<T, Noa>;
@@ -21,7 +22,7 @@ class Noa
   NoaTypes type_;
 
  protected:
-  virtual void print_real(std::ostream& os) const = 0;
+  virtual void print_real(OutputBuilder& output) const = 0;
 
  public:
   Noa(NoaTypes type) : type_(type) { }
@@ -35,9 +36,9 @@ class Noa
   template<ConceptNoa T, typename... Args>
   static std::unique_ptr<T> create(Args&&... args);
 
-  void print(std::ostream& os) const
+  void print(OutputBuilder& output) const
   {
-    print_real(os);
+    print_real(output);
   }
 };
 
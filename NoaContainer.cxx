@@ -1,10 +1,10 @@
 #include "sys.h"
 #include "NoaContainer.h"
-#include <iostream>
+#include "OutputBuilder.h"
 
-void NoaContainer::print_real(std::ostream& os) const
+void NoaContainer::print_real(OutputBuilder& output) const
 {
-  os << "NoaContainer: ";
+  output.insert("NoaContainer: ");
   for (auto const& child : children_)
-    child->print(os);
+    child->print(output);
 }
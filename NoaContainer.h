@@ -16,7 +16,7 @@ class NoaContainer : public Noa
   std::deque<std::unique_ptr<Noa>> children_;
 
  protected:
-  void print_real(std::ostream& os) const final;
+  void print_real(OutputBuilder& output) const final;
 
  public:
   NoaContainer() : Noa(container) { }
@@ -0,0 +1,138 @@
+#include "sys.h"
+#include "OutputBuilder.h"
+#include "utils/AIAlert.h"
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <cstring>
+#include <unistd.h>
+#include "debug.h"
+
+void OutputBuilder::add(char const* data, size_t size)
+{
+  if (size == 0 || finished())
+    return;
+  if (!differs_)
+    compare(data, size);
+  if (mode_ == compare_only)
+    return;
+  size_ += size;
+  // Merge with the previous iovec if this is contiguous with it.
+  if (!iovecs_.empty())
+  {
+    iovec& last = iovecs_.back();
+    if (static_cast<char const*>(last.iov_base) + last.iov_len == data)
+    {
+      last.iov_len += size;
+      return;
+    }
+  }
+  iovecs_.push_back({const_cast<char*>(data), size});
+}
+
+void OutputBuilder::append(std::string_view span)
+{
+  add(span.data(), span.size());
+}
+
+void OutputBuilder::insert(std::string_view str)
+{
+  // Nothing is stored in compare_only mode, so there is no need for a copy.
+  if (mode_ == compare_only)
+  {
+    add(str.data(), str.size());
+    return;
+  }
+  char* dest;
+  if (str.size() > block_size)
+  {
+    // Large strings get a block of their own.
+    blocks_.push_back(std::make_unique<char[]>(str.size()));
+    dest = blocks_.back().get();
+    std::memcpy(dest, str.data(), str.size());
+    add(dest, str.size());
+    return;
+  }
+  if (str.size() > block_size - block_used_)
+  {
+    blocks_.push_back(std::make_unique<char[]>(block_size));
+    block_ = blocks_.back().get();
+    block_used_ = 0;
+  }
+  dest = block_ + block_used_;
+  std::memcpy(dest, str.data(), str.size());
+  block_used_ += str.size();
+  add(dest, str.size());
+}
+
+void OutputBuilder::compare(char const* data, size_t size)
+{
+  size_t const common = std::min(size, original_.size() - matched_);
+  // Spans that were appended from the original at the same offset are trivially equal.
+  if (data != original_.data() + matched_)
+  {
+    size_t const equal = std::mismatch(data, data + common, original_.data() + matched_).first - data;
+    if (equal < common)
+    {
+      matched_ += equal;
+      differs_ = true;
+      return;
+    }
+  }
+  matched_ += common;
+  // Output beyond the end of the original is a difference too.
+  differs_ = common < size;
+}
+
+size_t OutputBuilder::first_difference() const
+{
+  // If everything is equal so far, the output might still be shorter than the original.
+  return differs_ || matched_ < original_.size() ? matched_ : std::string_view::npos;
+}
+
+void OutputBuilder::write_to(int fd) const
+{
+  ASSERT(mode_ == build_output);
+  std::vector<iovec> remaining = iovecs_;
+  iovec* first = remaining.data();
+  iovec* const last = first + remaining.size();
+  while (first != last)
+  {
+    int const count = std::min<ptrdiff_t>(last - first, IOV_MAX);
+    ssize_t len = ::writev(fd, first, count);
+    if (len == -1)
+    {
+      if (errno == EINTR)
+        continue;
+      THROW_LALERTE("writev failed");
+    }
+    // Skip everything that was written; a partial write leaves the first iovec partially written.
+    while (first != last && static_cast<size_t>(len) >= first->iov_len)
+    {
+      len -= first->iov_len;
+      ++first;
+    }
+    if (len > 0)
+    {
+      first->iov_base = static_cast<char*>(first->iov_base) + len;
+      first->iov_len -= len;
+    }
+  }
+}
+
+void OutputBuilder::write_to(std::ostream& os) const
+{
+  ASSERT(mode_ == build_output);
+  for (iovec const& iov : iovecs_)
+    os.write(static_cast<char const*>(iov.iov_base), iov.iov_len);
+}
+
+std::string OutputBuilder::str() const
+{
+  ASSERT(mode_ == build_output);
+  std::string result;
+  result.reserve(size_);
+  for (iovec const& iov : iovecs_)
+    result.append(static_cast<char const*>(iov.iov_base), iov.iov_len);
+  return result;
+}
@@ -0,0 +1,85 @@
+#pragma once
+
+#include <memory>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <sys/uio.h>
+
+// Collects the output of a TranslationUnit as a list of iovec's.
+//
+// Most of the output consists of unchanged spans of the input SourceFile;
+// those are added with `append`, which only stores a pointer into the
+// source buffer. Anything else (whitespace that was inserted, etc) is added
+// with `insert`, which copies it into memory owned by the OutputBuilder.
+//
+// The result can then be written to a file descriptor with writev, without
+// copying anything through iostream buffers. Note that the OutputBuilder
+// refers to the memory of the SourceFile: it must be written (or
+// materialized with `str`) before that is destroyed.
+//
+// If an original is passed to the constructor then the output is compared
+// with it while it is being added, up to the first difference; after that
+// nothing is compared anymore. Spans that are appended from the original at
+// the same offset are equal without comparing a single byte.
+//
+// In compare_only mode (used by --dry-run) the output is not stored at all:
+// it is only compared with the original, and everything that is added after
+// the first difference is ignored.
+class OutputBuilder
+{
+ public:
+  enum Mode
+  {
+    build_output,               // Store the output, so that it can be written.
+    compare_only                // Only find the first difference with the original.
+  };
+
+ private:
+  static constexpr size_t block_size = 4096;
+
+  std::vector<iovec> iovecs_;
+  std::vector<std::unique_ptr<char[]>> blocks_;   // Storage for inserted strings.
+  char* block_;                                   // The block that small strings are currently inserted into.
+  size_t block_used_;                             // Number of bytes used in block_.
+  size_t size_;                                   // The total number of bytes.
+  std::string_view original_;                     // What the output is compared with.
+  size_t matched_;                                // The number of bytes of the output that are equal to original_.
+  bool differs_;                                  // Set when the output was found to differ from original_ at offset matched_.
+  Mode mode_;
+
+ public:
+  // Compare the output with `original` (which must remain valid as long as the OutputBuilder is used) while it is added.
+  explicit OutputBuilder(std::string_view original = {}, Mode mode = build_output) :
+    block_(nullptr), block_used_(block_size), size_(0), original_(original), matched_(0), differs_(false), mode_(mode) { }
+
+  // Add `span`, which must remain valid until the OutputBuilder is written.
+  void append(std::string_view span);
+
+  // Add a copy of `str`.
+  void insert(std::string_view str);
+
+  // The total number of bytes (only in build_output mode).
+  size_t size() const { return size_; }
+
+  // Returns true if adding more output has no effect anymore.
+  bool finished() const { return mode_ == compare_only && differs_; }
+
+  // Return the offset of the first byte where the output differs from the original that was passed to the constructor;
+  // or std::string_view::npos if they are equal.
+  size_t first_difference() const;
+
+  // Write everything to `fd`, using writev. Only in build_output mode.
+  void write_to(int fd) const;
+
+  // Write everything to `os`.
+  void write_to(std::ostream& os) const;
+
+  // Return a copy of the output.
+  std::string str() const;
+
+ private:
+  void add(char const* data, size_t size);
+  void compare(char const* data, size_t size);
+};
@@ -288,6 +288,17 @@ class PreprocessorEventsHandler : public clang::PPCallbacks, public TranslationU
     ASSERT(Reason == LexedFileChangeReason::EnterFile || Reason == LexedFileChangeReason::ExitFile);    // When does this happen?
     // Disable certain functionality if we're not in the current TU.
     enabled_ = FID == translation_unit_.file_id();
+    // Keep track of the header files that are entered; not counting buffers without a file (the predefines, replayed headers).
+    if (!enabled_ && Reason == LexedFileChangeReason::EnterFile)
+      if (Statistics::File* statistics = translation_unit_.statistics())
+      {
+        clang::SourceManager const& source_manager = translation_unit_.clang_frontend().source_manager();
+        if (FID != translation_unit_.get_pp().getPredefinesFileID() && source_manager.getFileEntryRefForID(FID))
+        {
+          ++statistics->headers_entered_;
+          statistics->header_file_bytes_entered_ += source_manager.getFileIDSize(FID);
+        }
+      }
   }
 
   /// Callback invoked whenever a source file is skipped as the result
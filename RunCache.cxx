@@ -0,0 +1,155 @@
+#include "sys.h"
+#include "RunCache.h"
+#include "utils/AIAlert.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include <chrono>
+#include <format>
+#include <fstream>
+#include <system_error>
+#include <unistd.h>
+#include "debug.h"
+
+namespace {
+
+// The first line of an index file.
+constexpr char const* index_magic = "cwformat-run-index 2";
+
+} // namespace
+
+RunCache::RunCache(std::filesystem::path const& index_path) :
+  index_path_(index_path), dirty_(false)
+{
+  load();
+}
+
+//static
+std::filesystem::path RunCache::default_cache_directory()
+{
+  std::error_code ec;
+  std::filesystem::path const cwd = std::filesystem::current_path();
+  for (std::filesystem::path dir = cwd;; dir = dir.parent_path())
+  {
+    if (std::filesystem::exists(dir / ".git", ec))
+      return dir / ".cwformat-cache";
+    if (dir == dir.parent_path())
+      break;
+  }
+  return cwd / ".cwformat-cache";
+}
+
+//static
+bool RunCache::get_file_stat(std::filesystem::path const& path, FileStat& file_stat)
+{
+  llvm::sys::fs::file_status status;
+  if (llvm::sys::fs::status(path.native(), status))
+    return false;
+  file_stat.size_ = status.getSize();
+  file_stat.mtime_ns_ = std::chrono::duration_cast<std::chrono::nanoseconds>(status.getLastModificationTime().time_since_epoch()).count();
+  file_stat.device_ = status.getUniqueID().getDevice();
+  file_stat.inode_ = status.getUniqueID().getFile();
+  return true;
+}
+
+void RunCache::load()
+{
+  auto buffer_or_err = llvm::MemoryBuffer::getFile(index_path_.native());
+  if (!buffer_or_err)
+    return;     // No index yet.
+
+  llvm::StringRef content = buffer_or_err.get()->getBuffer();
+  llvm::StringRef header;
+  std::tie(header, content) = content.split('\n');
+  if (header != index_magic)
+  {
+    Dout(dc::notice, "Discarding run cache \"" << index_path_.native() << "\": unknown format.");
+    return;
+  }
+
+  while (!content.empty())
+  {
+    llvm::StringRef line;
+    std::tie(line, content) = content.split('\n');
+
+    Entry entry;
+    llvm::StringRef field;
+    bool error = false;
+    std::tie(field, line) = line.split(' ');
+    error |= field.getAsInteger(16, entry.options_hash_);
+    std::tie(field, line) = line.split(' ');
+    error |= field.getAsInteger(10, entry.file_stat_.size_);
+    std::tie(field, line) = line.split(' ');
+    error |= field.getAsInteger(10, entry.file_stat_.mtime_ns_);
+    std::tie(field, line) = line.split(' ');
+    error |= field.getAsInteger(10, entry.file_stat_.device_);
+    std::tie(field, line) = line.split(' ');
+    error |= field.getAsInteger(10, entry.file_stat_.inode_);
+    // The remainder of the line is the path (which may contain spaces).
+    if (error || line.empty())
+    {
+      Dout(dc::warning, "Discarding corrupt run cache \"" << index_path_.native() << "\".");
+      entries_.clear();
+      return;
+    }
+    entries_.emplace(line.str(), entry);
+  }
+  Dout(dc::notice, "Loaded " << entries_.size() << " entries from run cache \"" << index_path_.native() << "\".");
+}
+
+bool RunCache::is_up_to_date(std::filesystem::path const& absolute_path, uint64_t options_hash)
+{
+  Entry current{options_hash};
+  if (!get_file_stat(absolute_path, current.file_stat_))
+    return false;
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto entry = entries_.find(absolute_path.native());
+  return entry != entries_.end() && entry->second == current;
+}
+
+void RunCache::mark_formatted(std::filesystem::path const& absolute_path, uint64_t options_hash)
+{
+  // Paths containing a newline can't be stored.
+  if (absolute_path.native().find('\n') != std::string::npos)
+    return;
+  Entry current{options_hash};
+  if (!get_file_stat(absolute_path, current.file_stat_))
+    return;
+  std::lock_guard<std::mutex> lock(mutex_);
+  entries_.insert_or_assign(absolute_path.native(), current);
+  dirty_ = true;
+}
+
+void RunCache::save()
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (!dirty_)
+    return;
+
+  std::filesystem::create_directories(index_path_.parent_path());
+
+  // Write to a temporary file first, so that a concurrent run never sees a partial index.
+  std::filesystem::path temp_path = index_path_;
+  temp_path += std::format(".tmp-{}", ::getpid());
+  {
+    std::ofstream ofile(temp_path, std::ios::binary | std::ios::trunc);
+    if (!ofile.is_open())
+      THROW_LALERTE("Failed to create '[FILENAME]'", AIArgs("[FILENAME]", temp_path.native()));
+    ofile << index_magic << '\n';
+    for (auto const& [path, entry] : entries_)
+    {
+      FileStat const& file_stat = entry.file_stat_;
+      ofile << std::format("{:016x} ", entry.options_hash_) <<
+        file_stat.size_ << ' ' << file_stat.mtime_ns_ << ' ' << file_stat.device_ << ' ' << file_stat.inode_ << ' ' << path << '\n';
+    }
+    ofile.close();
+    if (!ofile.good())
+    {
+      std::error_code ignored_ec;
+      std::filesystem::remove(temp_path, ignored_ec);
+      THROW_LALERT("Failed writing '[FILENAME]'", AIArgs("[FILENAME]", temp_path.native()));
+    }
+  }
+  std::filesystem::rename(temp_path, index_path_);
+  dirty_ = false;
+}
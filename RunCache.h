@@ -0,0 +1,70 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+// An on-disk index of files that are known to be formatted already.
+//
+// Each entry is keyed by the absolute path of a file and records the size,
+// modification time, device and inode of that file at the moment it was
+// known to be formatted, as well as a hash of the effective options that
+// it was formatted with (include directories, macro definitions and the
+// cwformat version).
+//
+// A file is considered up to date if it still has exactly the same stat
+// data and options hash, in which case it can be skipped without even
+// opening it.
+//
+// All member functions are thread-safe.
+class RunCache
+{
+ private:
+  struct FileStat
+  {
+    uint64_t size_;
+    int64_t mtime_ns_;
+    uint64_t device_;
+    uint64_t inode_;
+
+    bool operator==(FileStat const& other) const = default;
+  };
+
+  struct Entry
+  {
+    uint64_t options_hash_;
+    FileStat file_stat_;
+
+    bool operator==(Entry const& other) const = default;
+  };
+
+  std::filesystem::path index_path_;
+
+  std::mutex mutex_;                                    // Protects the members below.
+  std::unordered_map<std::string, Entry> entries_;
+  bool dirty_;                                          // Set when entries_ was changed since it was loaded.
+
+ public:
+  // Load the index from `index_path`, if it exists.
+  RunCache(std::filesystem::path const& index_path);
+
+  // Returns true if `absolute_path` did not change since it was last marked as formatted with `options_hash`.
+  bool is_up_to_date(std::filesystem::path const& absolute_path, uint64_t options_hash);
+
+  // Record the current stat data of `absolute_path` as being formatted with `options_hash`.
+  void mark_formatted(std::filesystem::path const& absolute_path, uint64_t options_hash);
+
+  // Write the index back to disk (if it changed).
+  void save();
+
+  // Return the default location of the cache directory: the directory .cwformat-cache
+  // in the project root, being the first directory, starting at the current working
+  // directory and moving up, that contains a .git; or the current directory if none does.
+  static std::filesystem::path default_cache_directory();
+
+ private:
+  static bool get_file_stat(std::filesystem::path const& path, FileStat& file_stat);
+  void load();
+};
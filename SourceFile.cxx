@@ -1,7 +1,90 @@
 #include "sys.h"
 #include "SourceFile.h"
+#include "utils/AIAlert.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
 #include <iterator>
 #include <sstream>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+
+// A MemoryBuffer that owns a malloc-ed block that was filled by read(2).
+class ReadMemoryBuffer : public llvm::MemoryBuffer
+{
+ private:
+  std::string buffer_name_;
+  char* block_;
+
+ public:
+  ReadMemoryBuffer(std::string const& buffer_name, char* block, size_t size) : buffer_name_(buffer_name), block_(block)
+  {
+    block_[size] = '\0';
+    init(block_, block_ + size, /*RequiresNullTerminator=*/true);
+  }
+  ~ReadMemoryBuffer() override { std::free(block_); }
+
+  llvm::StringRef getBufferIdentifier() const override { return buffer_name_; }
+  BufferKind getBufferKind() const override { return MemoryBuffer_Malloc; }
+};
+
+} // namespace
+
+//static
+std::unique_ptr<llvm::MemoryBuffer> SourceFile::read_stdin(std::string const& buffer_name)
+{
+  constexpr int fd = STDIN_FILENO;
+  struct stat st;
+  if (::fstat(fd, &st) == -1)
+    THROW_LALERTE("Failed to stat stdin");
+
+  // If stdin is a regular file (and nothing was read from it yet), let llvm map it.
+  if (S_ISREG(st.st_mode) && ::lseek(fd, 0, SEEK_CUR) == 0)
+  {
+    auto buffer_or_err = llvm::MemoryBuffer::getOpenFile(fd, buffer_name, st.st_size, /*RequiresNullTerminator=*/true);
+    if (!buffer_or_err)
+      THROW_LALERTC(buffer_or_err.getError(), "Failed to read from stdin");
+    return std::move(*buffer_or_err);
+  }
+
+  // Otherwise (a pipe or terminal) read in large chunks, directly into a block that grows geometrically.
+  // If stdin is a regular file then its size is a good first guess.
+  size_t capacity = std::max<size_t>(S_ISREG(st.st_mode) ? st.st_size : 0, 64 * 1024);
+  size_t size = 0;
+  char* block = static_cast<char*>(std::malloc(capacity + 1));  // One extra for the terminating null.
+  if (!block)
+    THROW_LALERT("Out of memory reading stdin");
+  for (;;)
+  {
+    if (size == capacity)
+    {
+      capacity *= 2;
+      char* new_block = static_cast<char*>(std::realloc(block, capacity + 1));
+      if (!new_block)
+      {
+        std::free(block);
+        THROW_LALERT("Out of memory reading stdin");
+      }
+      block = new_block;
+    }
+    ssize_t len = ::read(fd, block + size, capacity - size);
+    if (len == -1)
+    {
+      if (errno == EINTR)
+        continue;
+      int saved_errno = errno;
+      std::free(block);
+      errno = saved_errno;
+      THROW_LALERTE("Failed to read from stdin");
+    }
+    if (len == 0)
+      break;
+    size += len;
+  }
+  return std::make_unique<ReadMemoryBuffer>(buffer_name, block, size);
+}
 
 std::string_view SourceFile::range(SourceFile::iterator first, SourceFile::iterator last) const
 {
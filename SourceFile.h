@@ -35,6 +35,10 @@ class SourceFile
     return position;
   }
 
+  // Read all of stdin into a null-terminated MemoryBuffer with identifier `buffer_name`.
+  // If stdin is redirected from a regular file then that file is memory mapped where possible.
+  static std::unique_ptr<llvm::MemoryBuffer> read_stdin(std::string const& buffer_name);
+
   std::string_view range(iterator first, iterator last) const;
   std::string_view span(SourceFile::iterator first, size_t size) const;
   std::string_view span(unsigned int offset, size_t size) const;
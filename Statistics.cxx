@@ -0,0 +1,153 @@
+#include "sys.h"
+#include "Statistics.h"
+#include "utils/AIAlert.h"
+#include "llvm/Support/FileSystem.h"
+#include <time.h>
+#include "debug.h"
+
+namespace {
+
+uint64_t clock_ns(clockid_t clock_id)
+{
+  timespec ts;
+  clock_gettime(clock_id, &ts);
+  return static_cast<uint64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+constexpr char const* phase_names[Statistics::File::number_of_phases] = {
+  "begin_source_file",
+  "process_input_buffer",
+  "process_gap",
+  "lex_source_range",
+  "output"
+};
+
+void write_time(llvm::json::OStream& json, Statistics::Time const& time)
+{
+  json.object([&]{
+    json.attribute("wall_ns", time.wall_ns_);
+    json.attribute("cpu_ns", time.cpu_ns_);
+  });
+}
+
+} // namespace
+
+//static
+Statistics::Time Statistics::Time::now()
+{
+  return {clock_ns(CLOCK_MONOTONIC), clock_ns(CLOCK_THREAD_CPUTIME_ID)};
+}
+
+Statistics::File::Phase Statistics::File::switch_phase(Phase phase)
+{
+  Time const now = Time::now();
+  if (current_phase_ != no_phase)
+    phase_times_[current_phase_] += now - phase_start_;
+  phase_start_ = now;
+  Phase previous_phase = current_phase_;
+  current_phase_ = phase;
+  return previous_phase;
+}
+
+void Statistics::File::stop()
+{
+  switch_phase(no_phase);
+  total_time_ = Time::now() - start_;
+}
+
+void Statistics::File::add(File const& other)
+{
+  bytes_ += other.bytes_;
+  headers_entered_ += other.headers_entered_;
+  header_file_bytes_entered_ += other.header_file_bytes_entered_;
+  headers_replayed_ += other.headers_replayed_;
+  macro_invocations_queued_ += other.macro_invocations_queued_;
+  for (size_t kind = 0; kind < number_of_pp_token_kinds; ++kind)
+    pp_token_counts_[kind] += other.pp_token_counts_[kind];
+  for (size_t kind = 0; kind < clang::tok::NUM_TOKENS; ++kind)
+    clang_token_counts_[kind] += other.clang_token_counts_[kind];
+  for (int phase = 0; phase < number_of_phases; ++phase)
+    phase_times_[phase] += other.phase_times_[phase];
+  total_time_ += other.total_time_;
+}
+
+void Statistics::File::write_attributes(llvm::json::OStream& json) const
+{
+  json.attribute("bytes", bytes_);
+  json.attribute("headers_entered", headers_entered_);
+  json.attribute("header_file_bytes_entered", header_file_bytes_entered_);
+  json.attribute("headers_replayed", headers_replayed_);
+  json.attribute("macro_invocations_queued", macro_invocations_queued_);
+  // Only token kinds that occurred are listed.
+  json.attributeObject("pp_tokens", [&]{
+    for (size_t kind = 0; kind < number_of_pp_token_kinds; ++kind)
+      if (pp_token_counts_[kind] > 0)
+        json.attribute(utils::to_string(static_cast<PPToken::Kind>(kind)), pp_token_counts_[kind]);
+  });
+  json.attributeObject("clang_tokens", [&]{
+    for (size_t kind = 0; kind < clang::tok::NUM_TOKENS; ++kind)
+      if (clang_token_counts_[kind] > 0)
+        json.attribute(clang::tok::getTokenName(static_cast<clang::tok::TokenKind>(kind)), clang_token_counts_[kind]);
+  });
+  json.attributeObject("phases", [&]{
+    for (int phase = 0; phase < number_of_phases; ++phase)
+    {
+      json.attributeBegin(phase_names[phase]);
+      write_time(json, phase_times_[phase]);
+      json.attributeEnd();
+    }
+  });
+  json.attributeBegin("total");
+  write_time(json, total_time_);
+  json.attributeEnd();
+}
+
+//static
+std::unique_ptr<llvm::raw_fd_ostream> Statistics::open(std::filesystem::path const& path)
+{
+  std::error_code ec;
+  auto os = std::make_unique<llvm::raw_fd_ostream>(path.native(), ec, llvm::sys::fs::OF_Text);
+  if (ec)
+    THROW_LALERTC(ec, "Failed to open '[FILENAME]'", AIArgs("[FILENAME]", path.native()));
+  return os;
+}
+
+Statistics::Statistics(std::filesystem::path const& path) : os_(open(path)), json_(*os_, 2), number_of_files_(0)
+{
+  json_.objectBegin();
+  json_.attributeBegin("files");
+  json_.arrayBegin();
+}
+
+void Statistics::add(std::string const& name, File const& file)
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  json_.object([&]{
+    json_.attribute("name", name);
+    file.write_attributes(json_);
+  });
+  aggregate_.add(file);
+  ++number_of_files_;
+}
+
+void Statistics::finish()
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  json_.arrayEnd();
+  json_.attributeBegin("aggregate");
+  json_.object([&]{
+    json_.attribute("files", number_of_files_);
+    aggregate_.write_attributes(json_);
+  });
+  json_.attributeEnd();
+  json_.objectEnd();
+  json_.flush();
+  *os_ << '\n';
+  os_->close();
+  if (os_->has_error())
+  {
+    std::error_code ec = os_->error();
+    os_->clear_error();
+    THROW_LALERTC(ec, "Failed writing statistics");
+  }
+}
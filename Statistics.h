@@ -0,0 +1,133 @@
+#pragma once
+
+#include "InputToken.h"
+#include "clang/Basic/TokenKinds.h"
+#include "llvm/Support/JSON.h"
+#include "llvm/Support/raw_ostream.h"
+#include <array>
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <string>
+
+// Statistics about the processing of each file, written as JSON (--stats).
+//
+// Every file that is processed gets a Statistics::File with counters and
+// timers, which is filled in by the TranslationUnit (and its helpers) while
+// the file is processed. When the file is done it is passed to `add`, which
+// immediately writes it to the output and adds it to the aggregate; so
+// memory usage does not grow with the number of files.
+//
+// The time spent on a file is split over a number of phases. The phases
+// nest (for example, process_gap is called from within process_input_buffer)
+// but time is only charged to the innermost phase, so that the times of all
+// phases add up to the total time spent in any of them.
+//
+// `add` is thread-safe.
+class Statistics
+{
+ public:
+  // The number of different PPToken::Kind's.
+  static constexpr size_t number_of_pp_token_kinds = PPToken::pragma + 1;
+
+  struct Time
+  {
+    uint64_t wall_ns_ = 0;
+    uint64_t cpu_ns_ = 0;                               // CPU time of the calling thread.
+
+    static Time now();
+
+    Time& operator+=(Time const& other) { wall_ns_ += other.wall_ns_; cpu_ns_ += other.cpu_ns_; return *this; }
+    Time operator-(Time const& other) const { return {wall_ns_ - other.wall_ns_, cpu_ns_ - other.cpu_ns_}; }
+  };
+
+  class File
+  {
+   public:
+    enum Phase
+    {
+      no_phase = -1,
+      begin_source_file,
+      process_input_buffer,
+      process_gap,
+      lex_source_range,
+      output,
+      number_of_phases
+    };
+
+    uint64_t bytes_ = 0;                                // The size of the file.
+    uint64_t headers_entered_ = 0;                      // The number of header files that were entered (not counting other buffers).
+    uint64_t header_file_bytes_entered_ = 0;            // The total size of those (not all of it is lexed with --directives-only-headers).
+    uint64_t headers_replayed_ = 0;                     // The number of guarded headers that were replayed instead (see GuardedHeaderCache).
+    uint64_t macro_invocations_queued_ = 0;
+    std::array<uint64_t, number_of_pp_token_kinds> pp_token_counts_{};          // The number of InputToken's per PPToken::Kind.
+    std::array<uint64_t, clang::tok::NUM_TOKENS> clang_token_counts_{};         // The number of InputToken's per clang::tok::TokenKind.
+    std::array<Time, number_of_phases> phase_times_{};
+    Time total_time_;
+
+   private:
+    Time start_;                                        // When the file was started.
+    Phase current_phase_ = no_phase;
+    Time phase_start_;                                  // When current_phase_ was entered.
+
+   public:
+    File() : start_(Time::now()) { }
+
+    // Charge the time since the last switch to the current phase, and continue with `phase`. Returns the previous phase.
+    Phase switch_phase(Phase phase);
+
+    // Charge the current phase (if any) and set total_time_ to the time since construction.
+    void stop();
+
+    // Add the counters and times of `other`.
+    void add(File const& other);
+
+    // Write the members of the JSON object that represents this File.
+    void write_attributes(llvm::json::OStream& json) const;
+  };
+
+  // Charge time to a phase of a File for the lifetime of this object.
+  // Does nothing if the File is nullptr (statistics aren't collected).
+  class PhaseTimer
+  {
+   private:
+    File* file_;
+    File::Phase previous_phase_;
+
+   public:
+    PhaseTimer(File* file, File::Phase phase) : file_(file)
+    {
+      if (file_)
+        previous_phase_ = file_->switch_phase(phase);
+    }
+    ~PhaseTimer()
+    {
+      if (file_)
+        file_->switch_phase(previous_phase_);
+    }
+
+    PhaseTimer(PhaseTimer const&) = delete;
+    PhaseTimer& operator=(PhaseTimer const&) = delete;
+  };
+
+ private:
+  std::mutex mutex_;                                    // Protects the members below.
+  std::unique_ptr<llvm::raw_fd_ostream> os_;
+  llvm::json::OStream json_;
+  File aggregate_;
+  uint64_t number_of_files_;
+
+ public:
+  // Start writing statistics to `path`.
+  Statistics(std::filesystem::path const& path);
+
+  // Write the statistics of the file `name`.
+  void add(std::string const& name, File const& file);
+
+  // Write the aggregate and close the file.
+  void finish();
+
+ private:
+  static std::unique_ptr<llvm::raw_fd_ostream> open(std::filesystem::path const& path);
+};
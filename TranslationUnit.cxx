@@ -6,7 +6,9 @@
 #include <clang/Lex/Preprocessor.h>
 #include "ClangFrontend.h"
 #include "InputToken.h"
+#include "OutputBuilder.h"
 #include "SourceFile.h"
+#include <algorithm>
 #include <ranges>
 #ifdef CWDEBUG
 #include "utils/print_pointer.h"
@@ -15,14 +17,19 @@
 #endif
 #include "debug.h"
 
-TranslationUnit::TranslationUnit(ClangFrontend& clang_frontend, SourceFile const& source_file, std::string const& name) :
-    CWDEBUG_ONLY(TranslationUnitRef(*this), ) clang_frontend_(clang_frontend), source_file_(source_file), name_(name)
+TranslationUnit::TranslationUnit(ClangFrontend& clang_frontend, SourceFile const& source_file, std::string const& name,
+    FormatRanges const* format_ranges, Statistics::File* statistics) :
+    CWDEBUG_ONLY(TranslationUnitRef(*this), ) clang_frontend_(clang_frontend), source_file_(source_file), format_ranges_(format_ranges),
+    statistics_(statistics), name_(name)
 {
+  Statistics::PhaseTimer timer(statistics_, Statistics::File::begin_source_file);
   clang_frontend_.begin_source_file(source_file, *this);
 }
 
 TranslationUnit::~TranslationUnit()
 {
+  // Destroy the preprocessor before the ClangFrontend releases the SourceManager state of this TU.
+  preprocessor_.reset();
   clang_frontend_.end_source_file();
 }
 
@@ -34,6 +41,7 @@ void TranslationUnit::init(clang::FileID file_id, std::unique_ptr<clang::Preproc
 
 void TranslationUnit::process()
 {
+  Statistics::PhaseTimer timer(statistics_, Statistics::File::process_input_buffer);
   last_offset_ = 0;
   clang_frontend_.process_input_buffer(*this);
 }
@@ -105,6 +113,8 @@ void TranslationUnit::queue_macro_invocation(offset_type token_offset, size_t to
   auto ibp = macro_invocations_.try_emplace(token_offset, token_length, token);
   // We should only get here for each token_offset once.
   ASSERT(ibp.second);
+  if (statistics_)
+    ++statistics_->macro_invocations_queued_;
 }
 
 // Finds all whitespace, C-comment and C++-comment character sequences (all possibly having backslash-newlines inserted)
@@ -119,10 +129,23 @@ void TranslationUnit::queue_macro_invocation(offset_type token_offset, size_t to
 std::pair<TranslationUnit::offset_type, size_t> TranslationUnit::process_gap(offset_type const current_offset, char const* fixed_string)
 {
   DoutEntering(dc::notice, "TranslationUnit::process_gap(" << current_offset << ", " << debug::print_string(fixed_string) << ")");
+  Statistics::PhaseTimer timer(statistics_, Statistics::File::process_gap);
 
   // Does this ever happen?
   ASSERT(current_offset >= last_offset_);
 
+  // Don't bother scanning gaps that lie entirely outside the part of the file that must be formatted,
+  // unless we are looking for a fixed string (the returned offset is needed).
+  if (format_ranges_ && !fixed_string && !format_ranges_->intersects(last_offset_, current_offset))
+  {
+    Dout(dc::notice, "Skipping gap [" << last_offset_ << ", " << current_offset << ") outside of the format ranges.");
+    // Forget about the macro invocations (and the arguments of a function-like macro) in this gap.
+    macro_invocations_.erase(macro_invocations_.begin(), macro_invocations_.lower_bound(current_offset));
+    last_token_was_function_macro_invocation_name_ = false;
+    last_offset_ = current_offset;
+    return {};
+  }
+
   if (current_offset > last_offset_)
   {
     offset_type gap_start = last_offset_;
@@ -386,8 +409,80 @@ void TranslationUnit::lex_source_range(clang::SourceRange const& token_range)
   clang_frontend_.lex_source_range(*this, token_range);
 }
 
-void TranslationUnit::print(std::ostream& os) const
+void TranslationUnit::print_header(OutputBuilder& output) const
+{
+  output.insert("// TranslationUnit: ");
+  output.insert(name());
+  output.insert("\n");
+}
+
+void TranslationUnit::print_layout(OutputBuilder& output, FormatRanges::ByteRange range) const
+{
+  // The Noa tree describes the layout of the whole TU; part of it is laid out from the materialized tokens inside it
+  // (which include the whitespace and comments between them), in their original order.
+  std::string_view const source = source_file_.span(source_file_.begin(), source_file_.size());
+  auto input_token = std::ranges::lower_bound(input_tokens_, range.begin_, {},
+      [&](InputToken const& token){ return static_cast<offset_type>(token.input_sequence().data() - source.data()); });
+  offset_type position = range.begin_;
+  for (; input_token != input_tokens_.end(); ++input_token)
+  {
+    std::string_view const input_sequence = input_token->input_sequence();
+    offset_type const offset = input_sequence.data() - source.data();
+    if (offset >= range.end_ || output.finished())
+      break;
+    output.append(source.substr(position, offset - position));
+    output.append(input_sequence);
+    position = offset + input_sequence.size();
+  }
+  if (position < range.end_)
+    output.append(source.substr(position, range.end_ - position));
+}
+
+void TranslationUnit::print(OutputBuilder& output) const
 {
-  os << "// TranslationUnit: " << name() << "\n";
-  NoaContainer::print_real(os);
+  if (!format_ranges_)
+  {
+    print_header(output);
+    NoaContainer::print_real(output);
+    return;
+  }
+
+  // Only the tokens that intersect the format ranges were materialized; such a token can start before, or end after,
+  // its range (think of a multi-line comment). Extend each range to the tokens that it contains, and merge the result.
+  std::string_view const source = source_file_.span(source_file_.begin(), source_file_.size());
+  std::vector<FormatRanges::ByteRange> layout_ranges;
+  auto input_token = input_tokens_.begin();
+  for (FormatRanges::ByteRange range : format_ranges_->ranges())
+  {
+    for (; input_token != input_tokens_.end(); ++input_token)
+    {
+      std::string_view const input_sequence = input_token->input_sequence();
+      offset_type const offset = input_sequence.data() - source.data();
+      if (offset >= range.end_)
+        break;
+      range.begin_ = std::min(range.begin_, offset);
+      range.end_ = std::max(range.end_, static_cast<offset_type>(offset + input_sequence.size()));
+    }
+    if (range.begin_ == range.end_)
+      continue;
+    if (!layout_ranges.empty() && range.begin_ <= layout_ranges.back().end_)
+      layout_ranges.back().end_ = std::max(layout_ranges.back().end_, range.end_);
+    else
+      layout_ranges.push_back(range);
+  }
+
+  // Copy everything outside those ranges verbatim; what is inside them is laid out. The header is printed once, at the first range.
+  size_t position = 0;
+  for (FormatRanges::ByteRange const& range : layout_ranges)
+  {
+    // With --dry-run, stop at the first difference.
+    if (output.finished())
+      return;
+    output.append(source.substr(position, range.begin_ - position));
+    if (&range == &layout_ranges.front())
+      print_header(output);
+    print_layout(output, range);
+    position = range.end_;
+  }
+  output.append(source.substr(position));
 }
@@ -1,9 +1,11 @@
 #pragma once
 
 #include "ClangFrontend.h"
+#include "FormatRanges.h"
 #include "TranslationUnitRef.h"
 #include "InputToken.h"
 #include "NoaContainer.h"
+#include "Statistics.h"
 #include "clang/Basic/SourceLocation.h"
 #include <memory>
 #include <map>
@@ -14,6 +16,7 @@
 
 // Forward declarations.
 class SourceFile;
+class OutputBuilder;
 class PreprocessorEventsHandler;
 struct PPToken;
 
@@ -31,6 +34,8 @@ class TranslationUnit : public NoaContainer COMMA_CWDEBUG_ONLY(public Translatio
  private:
   ClangFrontend& clang_frontend_;
   SourceFile const& source_file_;                       // The source file of this translation unit.
+  FormatRanges const* format_ranges_;                   // The parts of the source file that must be formatted, or nullptr for all of it.
+  Statistics::File* statistics_;                        // Where to collect statistics, or nullptr if they aren't collected.
   clang::FileID file_id_;                               // The file ID of this translation unit.
   std::unique_ptr<clang::Preprocessor> preprocessor_;   // A preprocessor instance used for this translation unit.
   offset_type last_offset_;                             // The offset of the last InputToken that was added, or zero if none were added yet.
@@ -41,7 +46,8 @@ class TranslationUnit : public NoaContainer COMMA_CWDEBUG_ONLY(public Translatio
   macro_invocations_type macro_invocations_;
 
  public:
-  TranslationUnit(ClangFrontend& clang_frontend, SourceFile const& source_file, std::string const& name);
+  TranslationUnit(ClangFrontend& clang_frontend, SourceFile const& source_file, std::string const& name,
+      FormatRanges const* format_ranges = nullptr, Statistics::File* statistics = nullptr);
   ~TranslationUnit();
 
   void process();
@@ -98,6 +104,8 @@ class TranslationUnit : public NoaContainer COMMA_CWDEBUG_ONLY(public Translatio
   void lex_source_range(clang::SourceRange const& token_range);
 
   SourceFile const& source_file() const { return source_file_; }
+  Statistics::File* statistics() const { return statistics_; }
+  size_t number_of_input_tokens() const { return input_tokens_.size(); }
   clang::FileID file_id() const { return file_id_; }
   clang::Preprocessor& get_pp() const { return *preprocessor_; }
   ClangFrontend const& clang_frontend() const { return clang_frontend_; }
@@ -111,7 +119,7 @@ class TranslationUnit : public NoaContainer COMMA_CWDEBUG_ONLY(public Translatio
   }
 
   std::string const& name() const { return name_; }
-  void print(std::ostream& os) const;
+  void print(OutputBuilder& output) const;
 
  private:
   friend class ClangFrontend;
@@ -121,6 +129,11 @@ class TranslationUnit : public NoaContainer COMMA_CWDEBUG_ONLY(public Translatio
   friend class PreprocessorEventsHandler;
   // Called from add_input_token and PreprocessorEventsHandler::MacroDefined.
   std::pair<offset_type, size_t> process_gap(offset_type const current_offset, char const* fixed_string = nullptr);
+
+  // Print the line that identifies this TU.
+  void print_header(OutputBuilder& output) const;
+  // Print the layout of the materialized tokens inside `range`; used for each of the format ranges.
+  void print_layout(OutputBuilder& output, FormatRanges::ByteRange range) const;
 };
 
 template<typename TOKEN>
@@ -141,9 +154,19 @@ void TranslationUnit::add_input_token(offset_type token_offset, size_t token_len
     process_gap(token_offset);
   }
 
-  // Create an InputToken.
-  Dout(dc::notice, "Adding " << print_item(token) << " `" << buf2str(token_sv) << "`.");
-  input_tokens_.emplace_back(token, token_sv);
+  // Create an InputToken; unless it lies outside the part of the file that must be formatted.
+  if (!format_ranges_ || format_ranges_->intersects(token_offset, token_offset + token_length))
+  {
+    Dout(dc::notice, "Adding " << print_item(token) << " `" << buf2str(token_sv) << "`.");
+    input_tokens_.emplace_back(token, token_sv);
+    if (statistics_)
+    {
+      if constexpr (std::is_same_v<TOKEN, clang::Token>)
+        ++statistics_->clang_token_counts_[token.getKind()];
+      else
+        ++statistics_->pp_token_counts_[token.kind_];
+    }
+  }
 
   // Update last_offset to the position after the current token.
   last_offset_ = token_offset + token_length;
@@ -0,0 +1,88 @@
+#include "sys.h"
+#include "UnifiedDiff.h"
+#include "utils/AIAlert.h"
+#include "debug.h"
+
+namespace {
+
+// Parse "a[,b]" into start and count (which defaults to one).
+bool parse_hunk_range(llvm::StringRef range, unsigned int& start, unsigned int& count)
+{
+  llvm::StringRef start_str, count_str;
+  std::tie(start_str, count_str) = range.split(',');
+  count = 1;
+  return !start_str.getAsInteger(10, start) && (count_str.empty() || !count_str.getAsInteger(10, count));
+}
+
+} // namespace
+
+UnifiedDiff::UnifiedDiff(llvm::StringRef content, unsigned int strip)
+{
+  File* current_file = nullptr;         // The file that the hunks that follow apply to, if any.
+  unsigned int line_number = 0;
+  unsigned int old_remaining = 0;       // The number of old lines of the current hunk that are still to come.
+  unsigned int new_remaining = 0;       // The number of new lines of the current hunk that are still to come.
+
+  while (!content.empty())
+  {
+    llvm::StringRef line;
+    std::tie(line, content) = content.split('\n');
+    ++line_number;
+    line = line.rtrim('\r');
+
+    if (old_remaining > 0 || new_remaining > 0)
+    {
+      // Inside a hunk every line is content, even if it looks like a file header (e.g. an added line "++ x").
+      char const kind = line.empty() ? ' ' : line.front();     // Some tools strip the space of empty context lines.
+      if (kind == '-' && old_remaining > 0)
+        --old_remaining;
+      else if (kind == '+' && new_remaining > 0)
+        --new_remaining;
+      else if (kind == ' ' && old_remaining > 0 && new_remaining > 0)
+      {
+        --old_remaining;
+        --new_remaining;
+      }
+      else if (kind != '\\')         // "\ No newline at end of file".
+        THROW_LALERT("Unexpected line in hunk on line [LINE] of the diff", AIArgs("[LINE]", line_number));
+      continue;
+    }
+
+    if (line.consume_front("+++ "))
+    {
+      // The file name is terminated by a tab, if followed by a time stamp.
+      llvm::StringRef name = line.split('\t').first;
+      current_file = nullptr;
+      if (name == "/dev/null")
+        continue;       // A deleted file.
+      for (unsigned int i = 0; i < strip; ++i)
+      {
+        size_t slash = name.find('/');
+        if (slash == llvm::StringRef::npos)
+          THROW_LALERT("Can't strip [STRIP] path components from \"[NAME]\" on line [LINE] of the diff",
+              AIArgs("[STRIP]", strip)("[NAME]", line.str())("[LINE]", line_number));
+        name = name.drop_front(slash + 1);
+      }
+      files_.push_back({name.str(), {}});
+      current_file = &files_.back();
+    }
+    else if (line.consume_front("@@ -"))
+    {
+      // "@@ -a[,b] +c[,d] @@".
+      llvm::StringRef old_range, new_range;
+      std::tie(old_range, line) = line.split(" +");
+      new_range = line.split(' ').first;
+      unsigned int old_start, new_start;
+      if (line.empty() || !parse_hunk_range(old_range, old_start, old_remaining) || !parse_hunk_range(new_range, new_start, new_remaining))
+        THROW_LALERT("Malformed hunk header on line [LINE] of the diff", AIArgs("[LINE]", line_number));
+      // Hunks of deleted files, and hunks that only delete lines, are skipped.
+      if (current_file && new_remaining > 0)
+        current_file->line_ranges_.push_back({new_start, new_start + new_remaining - 1});
+    }
+  }
+
+  // Forget about files that only had lines deleted.
+  std::erase_if(files_, [](File const& file){ return file.line_ranges_.empty(); });
+
+  Dout(dc::notice, "Read changes of " << files_.size() << " files from diff.");
+}
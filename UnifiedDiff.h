@@ -0,0 +1,33 @@
+#pragma once
+
+#include "FormatRanges.h"
+#include "llvm/ADT/StringRef.h"
+#include <filesystem>
+#include <vector>
+
+// The changed line ranges per file, as read from a unified diff (e.g. the output of `git diff -U0`).
+//
+// Only the new side of the diff is used: for every hunk "@@ -a,b +c,d @@" the
+// lines c through c+d-1 of the file named by the preceding "+++" line are
+// recorded. Hunks that only delete lines, and deleted files, are ignored.
+// File headers are only recognized outside of hunks: the line counts of
+// each hunk header determine where the hunk ends.
+class UnifiedDiff
+{
+ public:
+  struct File
+  {
+    std::filesystem::path path_;
+    std::vector<FormatRanges::LineRange> line_ranges_;
+  };
+
+ private:
+  std::vector<File> files_;             // In the order in which they appear in the diff.
+
+ public:
+  // Parse `content`, removing `strip` leading path components from file names (like patch -p).
+  UnifiedDiff(llvm::StringRef content, unsigned int strip);
+
+  // Accessor.
+  std::vector<File> const& files() const { return files_; }
+};
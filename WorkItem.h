@@ -0,0 +1,28 @@
+#pragma once
+
+#include "FormatRanges.h"
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+struct CompilationOptions;
+
+// A single input to be processed: either a file, or stdin.
+struct WorkItem
+{
+  std::filesystem::path path_;          // The file to process; empty if is_stdin_ is true.
+  bool is_stdin_;                       // True if the input must be read from stdin.
+  std::uintmax_t size_ = 0;             // The size of the file when the work item was created (zero if unknown or stdin).
+  CompilationOptions const* options_ = nullptr;         // The options to process this item with.
+  uint64_t options_hash_ = 0;           // The hash of the effective options (see RunCache).
+  // If either of these is non-empty then only those parts of the file are formatted.
+  std::vector<FormatRanges::LineRange> line_ranges_;
+  std::vector<FormatRanges::ByteRange> byte_ranges_;
+
+  // Returns true if the whole file must be formatted.
+  bool whole_file() const { return line_ranges_.empty() && byte_ranges_.empty(); }
+
+  // The name to use in error messages.
+  std::string name() const { return is_stdin_ ? "<stdin>" : path_.native(); }
+};
@@ -0,0 +1,99 @@
+#include "sys.h"
+#include "WorkStealingScheduler.h"
+#include <algorithm>
+#include "debug.h"
+
+WorkStealingScheduler::WorkStealingScheduler(unsigned int number_of_workers) :
+  worker_queues_(number_of_workers), next_queue_(0), queued_(0), closed_(false)
+{
+  ASSERT(number_of_workers > 0);
+}
+
+void WorkStealingScheduler::push(std::vector<SizedIndex> batch)
+{
+  // Sort the work items on size, largest first (keeping the original order for equal sizes).
+  std::ranges::stable_sort(batch, std::ranges::greater{}, &SizedIndex::size_);
+
+  {
+    // Publish and count the items under the same lock: a worker that takes one of them decrements queued_ under
+    // state_mutex_, so it can't do that before queued_ was incremented; and a worker that sees queued_ > 0 finds them.
+    std::lock_guard<std::mutex> state_lock(state_mutex_);
+
+    // Deal them out round-robin, so that every deque is also ordered largest first (within this batch).
+    unsigned int const number_of_workers = worker_queues_.size();
+    for (SizedIndex const& item : batch)
+    {
+      WorkerQueue& queue = worker_queues_[next_queue_];
+      next_queue_ = (next_queue_ + 1) % number_of_workers;
+      std::lock_guard<std::mutex> lock(queue.mutex_);
+      queue.work_item_indices_.push_back(item.work_item_index_);
+    }
+    queued_ += batch.size();
+  }
+  if (batch.size() == 1)
+    state_cv_.notify_one();
+  else
+    state_cv_.notify_all();
+}
+
+void WorkStealingScheduler::close()
+{
+  {
+    std::lock_guard<std::mutex> lock(state_mutex_);
+    closed_ = true;
+  }
+  state_cv_.notify_all();
+}
+
+std::optional<size_t> WorkStealingScheduler::next(unsigned int worker_index)
+{
+  for (;;)
+  {
+    std::optional<size_t> work_item_index = take(worker_index);
+    std::unique_lock<std::mutex> lock(state_mutex_);
+    if (work_item_index)
+    {
+      --queued_;
+      return work_item_index;
+    }
+    // Wait until something was queued, or we're done.
+    state_cv_.wait(lock, [this]{ return queued_ > 0 || closed_; });
+    if (queued_ == 0)
+      return std::nullopt;
+  }
+}
+
+std::optional<size_t> WorkStealingScheduler::take(unsigned int worker_index)
+{
+  {
+    WorkerQueue& own_queue = worker_queues_[worker_index];
+    std::lock_guard<std::mutex> lock(own_queue.mutex_);
+    if (!own_queue.work_item_indices_.empty())
+    {
+      size_t work_item_index = own_queue.work_item_indices_.front();
+      own_queue.work_item_indices_.pop_front();
+      return work_item_index;
+    }
+  }
+  return steal(worker_index);
+}
+
+std::optional<size_t> WorkStealingScheduler::steal(unsigned int thief_index)
+{
+  unsigned int const number_of_workers = worker_queues_.size();
+  // Try the other workers in turn, starting with the next one, so that not all thieves go for the same victim.
+  for (unsigned int n = 1; n < number_of_workers; ++n)
+  {
+    WorkerQueue& victim_queue = worker_queues_[(thief_index + n) % number_of_workers];
+    std::lock_guard<std::mutex> lock(victim_queue.mutex_);
+    if (!victim_queue.work_item_indices_.empty())
+    {
+      // Take the smallest item of the victim; it keeps the larger ones that it is about to start on anyway.
+      size_t work_item_index = victim_queue.work_item_indices_.back();
+      victim_queue.work_item_indices_.pop_back();
+      Dout(dc::notice, "Worker " << thief_index << " stole work item " << work_item_index << " from worker " << (thief_index + n) % number_of_workers << ".");
+      return work_item_index;
+    }
+  }
+  return std::nullopt;
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <optional>
+#include <vector>
+
+// Distributes indices of WorkItem's over a number of workers.
+//
+// Each worker has its own deque. Work items are added in batches: every
+// batch is sorted by size, largest first, and dealt round-robin over the
+// workers. A worker takes its next item from the front of its own deque
+// (so that the largest files are started first) and, once its own deque
+// is empty, steals from the tail of the deque of another worker.
+//
+// This makes sure that a handful of huge translation units are started as
+// early as possible, instead of being picked up last by a single thread while
+// the other threads are already idle.
+//
+// Items can be added while the workers are already running (for example,
+// one at a time while a list of files is being read). A worker that runs
+// out of work waits until more is added, or until `close` is called.
+class WorkStealingScheduler
+{
+ public:
+  struct SizedIndex
+  {
+    size_t work_item_index_;
+    std::uintmax_t size_;
+  };
+
+ private:
+  struct alignas(64) WorkerQueue        // Aligned to avoid false sharing between workers.
+  {
+    std::mutex mutex_;
+    std::deque<size_t> work_item_indices_;
+  };
+
+  std::vector<WorkerQueue> worker_queues_;
+  unsigned int next_queue_;             // The queue that the next item will be dealt to. Only accessed by the producer.
+
+  std::mutex state_mutex_;              // Protects the members below.
+  std::condition_variable state_cv_;    // Notified when items were added or the scheduler was closed.
+  size_t queued_;                       // The total number of items in all worker_queues_.
+  bool closed_;                         // Set when no more items will be added.
+
+ public:
+  WorkStealingScheduler(unsigned int number_of_workers);
+
+  // Add a batch of work items (largest first), dealing them out round-robin. Must be called by a single (producer) thread.
+  void push(std::vector<SizedIndex> batch);
+
+  // No more items will be pushed.
+  void close();
+
+  // Return the index of the next work item that worker `worker_index` should process,
+  // blocking until there is one, or std::nullopt when there is no work left and the scheduler is closed.
+  std::optional<size_t> next(unsigned int worker_index);
+
+ private:
+  std::optional<size_t> take(unsigned int worker_index);
+  std::optional<size_t> steal(unsigned int thief_index);
+};
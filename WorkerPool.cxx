@@ -0,0 +1,176 @@
+#include "sys.h"
+#include "WorkerPool.h"
+#include <algorithm>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <sstream>
+#include <malloc.h>
+#include <unistd.h>
+#include "debug.h"
+
+namespace {
+
+unsigned int effective_number_of_workers(unsigned int number_of_workers, std::optional<size_t> number_of_work_items)
+{
+  if (number_of_workers == 0)
+    number_of_workers = std::max(1U, std::thread::hardware_concurrency());
+  // There is no point in having more threads than there are work items.
+  if (number_of_work_items)
+    number_of_workers = std::max(1UL, std::min(static_cast<size_t>(number_of_workers), *number_of_work_items));
+  return number_of_workers;
+}
+
+// Return the resident memory of the process in bytes, or zero if it can't be determined.
+size_t current_rss()
+{
+  std::ifstream statm("/proc/self/statm");
+  size_t size, resident;
+  if (!(statm >> size >> resident))
+    return 0;
+  return resident * ::sysconf(_SC_PAGESIZE);
+}
+
+} // namespace
+
+WorkerPool::WorkerPool(unsigned int number_of_workers, std::optional<size_t> number_of_work_items, FrontendSettings const& frontend_settings,
+    process_type process) :
+  number_of_workers_(effective_number_of_workers(number_of_workers, number_of_work_items)), frontend_settings_(frontend_settings),
+  process_(std::move(process)),
+  failed_(false), scheduler_(number_of_workers_), next_output_(0)
+{
+  DoutEntering(dc::notice, "WorkerPool::WorkerPool(...) [" << number_of_workers_ << " workers]");
+
+  // With a single worker everything is processed in the calling thread.
+  if (number_of_workers_ == 1)
+    return;
+
+  workers_.reserve(number_of_workers_);
+  for (unsigned int worker_index = 0; worker_index < number_of_workers_; ++worker_index)
+    workers_.emplace_back(&WorkerPool::worker, this, worker_index);
+}
+
+WorkerPool::~WorkerPool()
+{
+  // Normally finish() was already called; but not if an exception was thrown.
+  if (!workers_.empty())
+    finish();
+}
+
+void WorkerPool::add(WorkItem&& work_item)
+{
+  std::vector<WorkItem> work_items;
+  work_items.push_back(std::move(work_item));
+  add(std::move(work_items));
+}
+
+void WorkerPool::add(std::vector<WorkItem>&& work_items)
+{
+  if (workers_.empty())
+  {
+    // Process everything in the calling thread, without buffering the output.
+    for (WorkItem const& work_item : work_items)
+      if (!process(serial_frontends_, work_item, std::cout))
+        failed_ = true;
+    return;
+  }
+
+  std::vector<WorkStealingScheduler::SizedIndex> batch;
+  batch.reserve(work_items.size());
+  {
+    std::lock_guard<std::mutex> lock(work_items_mutex_);
+    for (WorkItem& work_item : work_items)
+    {
+      batch.push_back({work_items_.size(), work_item.size_});
+      work_items_.push_back(std::move(work_item));
+    }
+  }
+  scheduler_.push(std::move(batch));
+}
+
+bool WorkerPool::finish()
+{
+  DoutEntering(dc::notice, "WorkerPool::finish() [" << work_items_.size() << " work items]");
+
+  scheduler_.close();
+  for (std::thread& worker : workers_)
+    worker.join();
+  workers_.clear();
+
+  // All output must have been written.
+  ASSERT(pending_output_.empty() && next_output_ == work_items_.size());
+  return !failed_;
+}
+
+void WorkerPool::worker(unsigned int worker_index)
+{
+  Debug(NAMESPACE_DEBUG::init_thread("worker" + std::to_string(worker_index)));
+
+  Frontends frontends;
+
+  while (std::optional<size_t> next_work_item = scheduler_.next(worker_index))
+  {
+    size_t const work_item_index = *next_work_item;
+    WorkItem const* work_item;
+    {
+      std::lock_guard<std::mutex> lock(work_items_mutex_);
+      work_item = &work_items_[work_item_index];
+    }
+    std::ostringstream output;
+    if (!process(frontends, *work_item, output))
+      failed_ = true;
+    // Always write the output, even when empty, or the output of subsequent work items would be held back forever.
+    write_output(work_item_index, std::move(output).str());
+  }
+}
+
+bool WorkerPool::process(Frontends& frontends, WorkItem const& work_item, std::ostream& output)
+{
+  ASSERT(work_item.options_);
+  std::unique_ptr<ClangFrontend>& clang_frontend = frontends.clang_frontends_[work_item.options_];
+  if (!clang_frontend)
+  {
+    CompilationOptions const* options = work_item.options_;
+    Dout(dc::notice, "Creating ClangFrontend for options " << options << ".");
+    clang_frontend = std::make_unique<ClangFrontend>(
+        std::bind_front(&CompilationOptions::configure_header_search_options, options),
+        std::bind_front(&CompilationOptions::configure_commandline_macro_definitions, options),
+        std::bind_front(&CompilationOptions::configure_language_options, options), frontend_settings_);
+  }
+  bool success = process_(*clang_frontend, work_item, output);
+  recycle_if_needed(frontends);
+  return success;
+}
+
+void WorkerPool::recycle_if_needed(Frontends& frontends)
+{
+  size_t const max_rss = frontend_settings_.max_rss_;
+  if (max_rss == 0)
+    return;
+  size_t const rss = current_rss();
+  // Freed memory is not always returned to the operating system; only recycle again if the resident memory
+  // grew significantly since the last time, or every subsequent item would be processed by a cold frontend.
+  if (rss <= max_rss || rss < frontends.rss_after_recycle_ + max_rss / 16)
+    return;
+  Dout(dc::notice, "Resident memory is " << rss << " bytes; discarding " << frontends.clang_frontends_.size() << " ClangFrontend(s).");
+  frontends.clang_frontends_.clear();
+  ::malloc_trim(0);
+  frontends.rss_after_recycle_ = current_rss();
+}
+
+void WorkerPool::write_output(size_t work_item_index, std::string&& output)
+{
+  std::lock_guard<std::mutex> lock(output_mutex_);
+  pending_output_.emplace(work_item_index, std::move(output));
+  // Write everything that is now contiguous with what was already written.
+  bool wrote_something = false;
+  for (auto front = pending_output_.begin(); front != pending_output_.end() && front->first == next_output_; front = pending_output_.begin())
+  {
+    std::cout << front->second;
+    pending_output_.erase(front);
+    ++next_output_;
+    wrote_something = true;
+  }
+  if (wrote_something)
+    std::cout.flush();
+}
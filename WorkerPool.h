@@ -0,0 +1,101 @@
+#pragma once
+
+#include "ClangFrontend.h"
+#include "CompilationOptions.h"
+#include "WorkItem.h"
+#include "WorkStealingScheduler.h"
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Process WorkItem's using a number of worker threads.
+//
+// Each worker thread owns its own ClangFrontend (and therefore its own
+// FileManager, SourceManager, HeaderSearch and per-TU Preprocessor);
+// none of clang's state is shared between threads. The work items are
+// distributed over the workers by a WorkStealingScheduler.
+//
+// Work items are added with `add`, which may be called while the workers
+// are already processing earlier items; `finish` must be called after
+// the last item was added.
+//
+// Every WorkItem refers to the CompilationOptions that it must be processed
+// with (see WorkItem::options_), which must stay valid until `finish` returns.
+// A worker creates a ClangFrontend for a set of options when it processes the
+// first item that uses it, and then keeps it for all subsequent items with the
+// same options.
+//
+// Output that is written to the std::ostream passed to `process` is
+// buffered per WorkItem and written to std::cout in the order in which
+// the items were added, so that the result is identical to a serial run.
+//
+// If there is only one worker then every item is processed in the
+// calling thread, by `add`, and output is written directly to std::cout.
+//
+// A ClangFrontend releases the state of each TranslationUnit when it is done
+// with it, but some of it (like the content caches of the SourceManager) can
+// not be released. If FrontendSettings::max_rss_ is set then a worker discards
+// its frontends (and starts with new ones) when, after processing an item, the
+// resident memory of the process exceeds that limit.
+class WorkerPool
+{
+ public:
+  // Process one WorkItem. Must return false if processing failed (after reporting the error).
+  using process_type = std::function<bool(ClangFrontend&, WorkItem const&, std::ostream&)>;
+
+ private:
+  // The frontends of one worker (or of the calling thread, if there is only one worker).
+  struct Frontends
+  {
+    std::map<CompilationOptions const*, std::unique_ptr<ClangFrontend>> clang_frontends_;
+    size_t rss_after_recycle_ = 0;              // The resident memory right after these frontends were last discarded.
+  };
+
+  unsigned int number_of_workers_;
+  FrontendSettings frontend_settings_;          // The settings of every ClangFrontend that is created.
+  process_type process_;
+
+  std::atomic<bool> failed_;                    // Set when processing of any WorkItem failed.
+
+  std::mutex work_items_mutex_;                 // Protects work_items_ (but not the elements, which are never changed once added).
+  std::deque<WorkItem> work_items_;             // All items that were added (a deque, so that references stay valid).
+
+  WorkStealingScheduler scheduler_;
+  std::vector<std::thread> workers_;
+  Frontends serial_frontends_;                  // The frontends used when there is only one worker.
+
+  std::mutex output_mutex_;                     // Protects the following two members.
+  std::map<size_t, std::string> pending_output_;        // Output of finished WorkItem's that can't be written yet.
+  size_t next_output_;                          // Index of the WorkItem whose output must be written next.
+
+ public:
+  // Use `number_of_workers` threads; if zero, use one thread per hardware thread.
+  // If `number_of_work_items` is known in advance, no more threads than that are started.
+  WorkerPool(unsigned int number_of_workers, std::optional<size_t> number_of_work_items, FrontendSettings const& frontend_settings,
+      process_type process);
+  ~WorkerPool();
+
+  // Add a single work item, or a batch of them (which are then started largest first).
+  void add(WorkItem&& work_item);
+  void add(std::vector<WorkItem>&& work_items);
+
+  // Wait until all work items were processed. Returns true if all items were processed successfully.
+  bool finish();
+
+  // Accessor.
+  unsigned int number_of_workers() const { return number_of_workers_; }
+
+ private:
+  void worker(unsigned int worker_index);
+  bool process(Frontends& frontends, WorkItem const& work_item, std::ostream& output);
+  void recycle_if_needed(Frontends& frontends);
+  void write_output(size_t work_item_index, std::string&& output);
+};
@@ -0,0 +1,137 @@
+#include "sys.h"
+#include "CompilationDatabase.h"
+#include "clang/Lex/PreprocessorOptions.h"
+#include "llvm/TargetParser/Host.h"
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "debug.h"
+
+// Tests of CompilationDatabase: a compile_commands.json is written to a temporary directory and
+// the options that are extracted from it are checked, and applied to the clang options.
+
+namespace {
+
+int failures = 0;
+
+void check(bool condition, std::string_view what)
+{
+  if (!condition)
+  {
+    std::cout << "Failure: " << what << ".\n";
+    ++failures;
+  }
+  ASSERT(condition);
+}
+
+void write_file(std::filesystem::path const& path, std::string_view content)
+{
+  std::ofstream ofile(path, std::ios::binary | std::ios::trunc);
+  ofile.write(content.data(), content.size());
+}
+
+} // namespace
+
+int main()
+{
+  Debug(NAMESPACE_DEBUG::init());
+
+  std::string directory_template = (std::filesystem::temp_directory_path() / "compdbtest-XXXXXX").native();
+  if (!::mkdtemp(directory_template.data()))
+  {
+    std::cout << "Failure: could not create a temporary directory.\n";
+    return 1;
+  }
+  std::filesystem::path const directory = directory_template;
+  std::string const dir = directory.native();
+  // Relative -include and -imacros files are made absolute when they exist in the directory of the compile command.
+  write_file(directory / "config.h", "#define CONFIG 1\n");
+  write_file(directory / "macros.h", "#define MACRO 1\n");
+
+  write_file(directory / "compile_commands.json",
+      "[\n"
+      "  { \"directory\": \"" + dir + "\", \"file\": \"a.cxx\",\n"
+      "    \"arguments\": [ \"c++\", \"-std=c++17\", \"-include\", \"config.h\", \"-imacros\", \"macros.h\", \"-include-pch\", \"pch.h.pch\", \"-c\", \"a.cxx\" ] },\n"
+      "  { \"directory\": \"" + dir + "\", \"file\": \"b.cxx\",\n"
+      "    \"command\": \"c++ -std=gnu++20 -includeconfig.h -include /usr/include/stdio.h -imacrosmacros.h -stdlib=libc++ -c b.cxx\" },\n"
+      "  { \"directory\": \"" + dir + "\", \"file\": \"c.c\",\n"
+      "    \"command\": \"cc -std=c11 -std=nonsense -include missing.h -c c.c\" }\n"
+      "]\n");
+
+  CompilationDatabase compilation_database(directory);
+  check(compilation_database.size() == 3, "all entries are read");
+  std::string const config_h = (directory / "config.h").native();
+  std::string const macros_h = (directory / "macros.h").native();
+
+  std::cout << "Test Case 0: Separate arguments" << std::endl;
+  {
+    CompilationOptions const* options = compilation_database.find(directory / "a.cxx");
+    check(options, "a.cxx is found");
+    if (options)
+    {
+      check(options->includes_ == std::vector<std::string>{config_h}, "-include is made absolute");
+      check(options->macro_includes_ == std::vector<std::string>{macros_h}, "-imacros is made absolute");
+      check(options->language_standard_ == "c++17", "-std=c++17 is used");
+      check(options->include_directories_.empty(), "-include-pch is not an include directory");
+
+      clang::PreprocessorOptions preprocessor_options;
+      options->configure_commandline_macro_definitions(preprocessor_options);
+      check(preprocessor_options.Includes == std::vector<std::string>{config_h}, "-include ends up in PreprocessorOptions::Includes");
+      check(preprocessor_options.MacroIncludes == std::vector<std::string>{macros_h}, "-imacros ends up in PreprocessorOptions::MacroIncludes");
+
+      LangOptions lang_options;
+      options->configure_language_options(lang_options, llvm::Triple(llvm::sys::getDefaultTargetTriple()));
+      check(lang_options.CPlusPlus && lang_options.CPlusPlus17 && !lang_options.CPlusPlus20, "-std=c++17 selects C++17");
+      check(!lang_options.GNUMode, "-std=c++17 is not a GNU mode");
+    }
+  }
+
+  std::cout << "Test Case 1: Attached arguments in a command" << std::endl;
+  {
+    CompilationOptions const* options = compilation_database.find(directory / "b.cxx");
+    check(options, "b.cxx is found");
+    if (options)
+    {
+      check(options->includes_ == std::vector<std::string>{config_h, "/usr/include/stdio.h"}, "-include files are kept in order");
+      check(options->macro_includes_ == std::vector<std::string>{macros_h}, "attached -imacros is recognized");
+      // -stdlib= is not -std=.
+      check(options->language_standard_ == "gnu++20", "-std=gnu++20 is used");
+
+      LangOptions lang_options;
+      options->configure_language_options(lang_options, llvm::Triple(llvm::sys::getDefaultTargetTriple()));
+      check(lang_options.CPlusPlus20 && lang_options.GNUMode, "-std=gnu++20 selects GNU C++20");
+    }
+  }
+
+  std::cout << "Test Case 2: C, an unknown standard and a missing -include file" << std::endl;
+  {
+    CompilationOptions const* options = compilation_database.find(directory / "c.c");
+    check(options, "c.c is found");
+    if (options)
+    {
+      // An unknown standard is ignored (with a warning), so the previous one remains.
+      check(options->language_standard_ == "c11", "an unknown -std= is ignored");
+      // A file that doesn't exist in the directory of the compile command is looked up in the search path.
+      check(options->includes_ == std::vector<std::string>{"missing.h"}, "a missing -include file is kept as given");
+
+      LangOptions lang_options;
+      options->configure_language_options(lang_options, llvm::Triple(llvm::sys::getDefaultTargetTriple()));
+      check(!lang_options.CPlusPlus && lang_options.C11, "-std=c11 selects C11");
+    }
+  }
+
+  std::cout << "Test Case 3: No options keeps the defaults" << std::endl;
+  {
+    CompilationOptions const options;
+    LangOptions lang_options;
+    options.configure_language_options(lang_options, llvm::Triple(llvm::sys::getDefaultTargetTriple()));
+    check(lang_options.CPlusPlus && lang_options.CPlusPlus20, "the default is C++20");
+  }
+
+  std::filesystem::remove_all(directory);
+  return failures == 0 ? 0 : 1;
+}
@@ -1,15 +1,35 @@
 #include "sys.h"
 
+#include "CompilationDatabase.h"
+#include "CompilationOptions.h"
+#include "FileListReader.h"
+#include "FormatProtocol.h"
+#include "FormatServer.h"
+#include "FrontendSettings.h"
+#include "GuardedHeaderDiskCache.h"
+#include "InPlaceWriter.h"
+#include "OutputBuilder.h"
+#include "RunCache.h"
 #include "SourceFile.h"
+#include "Statistics.h"
 #include "TranslationUnit.h"
+#include "UnifiedDiff.h"
+#include "WorkItem.h"
+#include "WorkerPool.h"
 #include "utils/AIAlert.h"
 
+#include <algorithm>
 #include <cerrno>
 #include <filesystem>
+#include <functional>
 #include <iostream>
-#include <chrono>
-#include <random>
+#include <limits>
+#include <map>
+#include <mutex>
+#include <optional>
 #include <system_error>
+#include <unordered_set>
+#include <unistd.h>
 
 #include "debug.h"
 
@@ -23,7 +43,7 @@
 #include "llvm/Support/MemoryBuffer.h"
 #include "llvm/ADT/StringRef.h"
 #include "llvm/Support/raw_ostream.h"
-#include <fstream>
+#include "llvm/Support/xxhash.h"
 #include <memory>
 #include <string>
 #include <vector>
@@ -44,11 +64,133 @@ cl::list<std::string> input_files(cl::Positional, cl::desc("<file> [<file> ...]"
 cl::opt<std::string> assume_filename("assume-filename", cl::desc("Set filename used to determine the language and to find .clang-format file"),
   cl::value_desc("string"), cl::cat(cwformat_category));
 
-cl::opt<std::string> files_list_file(
-  "files", cl::desc("A file containing a list of files to process, one per line"), cl::value_desc("filename"), cl::cat(cwformat_category));
+cl::opt<std::string> files_list_file("files",
+    cl::desc("A file containing a list of files to process, one per line; '-' means stdin. "
+             "Processing starts while the list is still being read, and files that are listed more than once are processed once."),
+    cl::value_desc("filename"), cl::cat(cwformat_category));
+
+cl::opt<std::string> files0_list_file("files0-from",
+    cl::desc("Like --files, but the file names are terminated by NUL characters (as written by find -print0)."),
+    cl::value_desc("filename"), cl::cat(cwformat_category));
+
+cl::list<std::string> lines("lines",
+    cl::desc("Only format the lines <start>:<end> (one-based, inclusive). Can be given more than once. "
+             "Everything else is copied verbatim. Requires a single input."),
+    cl::value_desc("start:end"), cl::cat(cwformat_category));
+
+cl::list<unsigned int> offsets("offset",
+    cl::desc("Only format the lines that contain the range starting at byte <offset> (zero-based). Can be given more than once. "
+             "Requires a single input."),
+    cl::value_desc("offset"), cl::cat(cwformat_category));
+
+cl::list<unsigned int> lengths("length",
+    cl::desc("The length of the range of the corresponding --offset; the default is until the end of the file."),
+    cl::value_desc("length"), cl::cat(cwformat_category));
+
+cl::opt<std::string> diff_file("diff",
+    cl::desc("Only format the lines that were added or changed according to the unified diff <patch> (for example the output of git diff -U0); "
+             "if <patch> is omitted or '-', read it from stdin. The files are those of the diff."),
+    cl::value_desc("patch"), cl::ValueOptional, cl::cat(cwformat_category));
+
+cl::opt<unsigned int> diff_strip("diff-strip",
+    cl::desc("Strip <N> leading components from the file names in the --diff (like patch -p<N>); the default is 1."),
+    cl::value_desc("N"), cl::init(1), cl::cat(cwformat_category));
 
 cl::opt<bool> in_place("i", cl::desc("Inplace edit <file>s, if specified"), cl::cat(cwformat_category));
 
+cl::opt<bool> dry_run("dry-run",
+    cl::desc("Don't write any output; instead report the first place where each file is not formatted correctly, as a warning."),
+    cl::cat(cwformat_category));
+cl::alias dry_run_short("n", cl::desc("Alias for --dry-run"), cl::aliasopt(dry_run), cl::NotHidden, cl::cat(cwformat_category));
+
+cl::opt<bool> warnings_as_errors("Werror",
+    cl::desc("With --dry-run, report files that are not formatted correctly as errors and exit with a non-zero exit code."),
+    cl::cat(cwformat_category));
+
+cl::opt<InPlaceWriter::SyncPolicy> sync_policy("sync",
+    cl::desc("When to flush files that were edited in-place (-i) to disk:"),
+    cl::values(
+      clEnumValN(InPlaceWriter::sync_none, "none", "Leave it to the operating system (default)."),
+      clEnumValN(InPlaceWriter::sync_file, "file", "Sync every file before it replaces the original."),
+      clEnumValN(InPlaceWriter::sync_end, "end", "Sync every affected filesystem once, at the end of the run.")),
+    cl::init(InPlaceWriter::sync_none), cl::cat(cwformat_category));
+
+cl::opt<bool> incremental("incremental",
+    cl::desc("Skip files that were formatted, or found to be formatted, by a previous run with the same options and that did not change since "
+             "(only with -i or --dry-run)."),
+    cl::cat(cwformat_category));
+
+cl::opt<std::string> cache_directory("cache-dir",
+    cl::desc("The directory to store caches in. The default is .cwformat-cache in the root of the project (the nearest directory containing .git)."),
+    cl::value_desc("dir"), cl::cat(cwformat_category));
+
+cl::opt<std::string> stats_file("stats",
+    cl::desc("Write statistics as JSON to <path>: per file and in aggregate, the number of bytes, the number of tokens per kind, "
+             "the bytes lexed from headers, the number of queued macro invocations and the wall and CPU time spent per phase."),
+    cl::value_desc("path"), cl::cat(cwformat_category));
+
+cl::opt<bool> directives_only_headers("directives-only-headers",
+    cl::desc("Only lex the preprocessor directives of included files (using clang's dependency directives scanner); "
+             "the other tokens of headers are never used anyway."),
+    cl::cat(cwformat_category));
+
+cl::opt<bool> replay_guarded_headers("replay-guarded-headers",
+    cl::desc("Remember the macros that guarded headers define, and in later files replay those instead of "
+             "entering the header again when the macros that it depends on didn't change."),
+    cl::cat(cwformat_category));
+
+cl::opt<bool> header_cache("header-cache",
+    cl::desc("Store what --replay-guarded-headers remembers in the cache directory, so that later runs can replay those headers "
+             "without reading them, for as long as none of the files involved changed (by size or modification time); "
+             "implies --replay-guarded-headers."),
+    cl::cat(cwformat_category));
+
+cl::opt<bool> stat_cache("stat-cache",
+    cl::desc("Cache the results of looking up files and reading directories (including lookups that fail) for the duration of the run, "
+             "shared by all worker threads. Only the files that are being formatted are assumed to change meanwhile."),
+    cl::cat(cwformat_category));
+
+cl::opt<bool> stat_snapshot("stat-snapshot",
+    cl::desc("Store the listings of the directories that were read (like the include directories that #include's looked in) in the "
+             "cache directory, so that later runs know which files don't exist without looking them up, for as long as the "
+             "modification time of the directory doesn't change; implies --stat-cache."),
+    cl::cat(cwformat_category));
+
+cl::opt<std::string> prefix_header("pch",
+    cl::desc("Process every file as if it started with #include \"<header>\". The header is preprocessed only once per clang frontend; "
+             "the text of the resulting macro definitions is added to the predefines (which every file still lexes), and the "
+             "guarded headers that it includes are skipped when a file includes them itself. Use this for a block of includes "
+             "that (nearly) every file starts with."),
+    cl::value_desc("header"), cl::cat(cwformat_category));
+
+cl::opt<unsigned int> max_rss("max-rss",
+    cl::desc("When the resident memory exceeds <MiB> megabytes after processing a file, let the worker that processed it start over "
+             "with new clang frontends (discarding the cached headers); 0 means no limit (the default). Can't be used with --server."),
+    cl::value_desc("MiB"), cl::init(0), cl::cat(cwformat_category));
+
+cl::opt<unsigned int> jobs("j",
+    cl::desc("Process up to <N> files in parallel, each worker thread using its own clang frontend; 0 means one per hardware thread."),
+    cl::value_desc("N"),
+    cl::init(1),
+    cl::Prefix,                 // Allow the value to be attached to the option (e.g., -j8).
+    cl::cat(cwformat_category));
+
+cl::opt<std::string> server_socket("server",
+    cl::desc("Run as a persistent server, listening on the local socket <socket>, that keeps -j clang frontends warm between requests. "
+             "Files and headers are read when first needed and then cached; a worker starts over with a new clang frontend "
+             "when a file that it read, or a directory that it searched, changed."),
+    cl::value_desc("socket"), cl::cat(cwformat_category));
+
+cl::opt<std::string> connect_socket("connect",
+    cl::desc("Send the <file>s to the server listening on <socket> instead of formatting them in this process. "
+             "The -I, -D and -U options of the server are used."),
+    cl::value_desc("socket"), cl::cat(cwformat_category));
+
+cl::opt<std::string> build_path("p",
+    cl::desc("Read <build-path>/compile_commands.json and use the include directories and macro definitions of each file listed there. "
+             "The -I, -D and -U options given on the command line are added to those. Files with the same options share a clang frontend."),
+    cl::value_desc("build-path"), cl::cat(cwformat_category));
+
 cl::list<std::string> include_directories("I",
     cl::desc("Add the directory <dir> to the list of directories to be searched for header files during preprocessing."),
     cl::value_desc("dir"), cl::cat(cwformat_category));
@@ -67,36 +209,53 @@ cl::list<std::string> commandline_macros_undef("U",
     cl::Prefix,                 // Allow the value to be attached to the option (e.g., -UFOO).
     cl::cat(cwformat_category));
 
+static constexpr char const* cwformat_version = "0.1.0";
+
 // Override the default --version behavior.
 static void print_version(llvm::raw_ostream& ros)
 {
-  ros << program_name << " version 0.1.0, written in 2025 by Carlo Wood.\n";
+  ros << program_name << " version " << cwformat_version << ", written in 2025 by Carlo Wood.\n";
 }
 
-// Helper function to read files from a list file.
-llvm::Expected<std::vector<std::filesystem::path>> read_files_from_list(std::filesystem::path const& filename)
+// Return the -I, -D and -U options that were given on the command line.
+static CompilationOptions commandline_compilation_options()
 {
-  auto file_buffer_or_err = llvm::MemoryBuffer::getFile(filename.native());
-  if (!file_buffer_or_err)
-    return llvm::createStringError(file_buffer_or_err.getError(), "Could not open file list: " + filename.native());
-
-  std::vector<std::filesystem::path> files;
-  llvm::StringRef content = file_buffer_or_err.get()->getBuffer();
+  CompilationOptions result;
+  for (std::string const& dir : include_directories)
+    result.include_directories_.emplace_back(clang::frontend::Angled, dir);
+  // Apply -D and -U in the order in which they were given on the command line.
+  using position_to_type_map_type = std::map<unsigned, CompilationOptions::macro_operation_type>;
+  position_to_type_map_type position_to_type_map;
+  for (unsigned i = 0; i < commandline_macros_define.getNumOccurrences(); ++i)
+    position_to_type_map.emplace(commandline_macros_define.getPosition(i), position_to_type_map_type::mapped_type{'D', commandline_macros_define[i]});
+  for (unsigned i = 0; i < commandline_macros_undef.getNumOccurrences(); ++i)
+    position_to_type_map.emplace(commandline_macros_undef.getPosition(i), position_to_type_map_type::mapped_type{'U', commandline_macros_undef[i]});
+  for (auto&& p : position_to_type_map)
+    result.macro_operations_.push_back(std::move(p.second));
+  return result;
+}
 
-  while (!content.empty())
+// Return a hash of everything that influences the output, other than the input file itself.
+static uint64_t effective_options_hash(CompilationOptions const& options, FrontendSettings const& frontend_settings)
+{
+  std::string key = cwformat_version;
+  key += '\0';
+  key += options.key();
+  if (!frontend_settings.prefix_header_.empty())
   {
-    llvm::StringRef line;
-    std::tie(line, content) = content.split('\n');
-    line = line.trim();
-
-    if (!line.empty())
-      files.emplace_back(line.str());
-
-    if (content.empty())
-      break;
+    // Only the prefix header itself is taken into account, not the headers that it includes.
+    key += '\0';
+    key += frontend_settings.prefix_header_.native();
+    llvm::sys::fs::file_status status;
+    if (!llvm::sys::fs::status(frontend_settings.prefix_header_.native(), status))
+    {
+      key += '\0';
+      key += std::to_string(status.getSize());
+      key += '\0';
+      key += std::to_string(status.getLastModificationTime().time_since_epoch().count());
+    }
   }
-
-  return files;
+  return llvm::xxh3_64bits(llvm::StringRef(key));
 }
 
 #ifdef _WIN32
@@ -113,49 +272,25 @@ static std::string get_program_name(char const* argv0)
 }
 
 //=============================================================================
-// Generate unique temporary filename.
-
-class RandomNumber
-{
- private:
-  std::mt19937_64 mersenne_twister_;
+// Main function; process commandline parameters.
 
- public:
-  using result_type = std::mt19937_64::result_type;
+// The index of files that are already formatted; only used with --incremental (and -i or --dry-run).
+static std::unique_ptr<RunCache> run_cache;
 
-  RandomNumber()
-  {
-    std::random_device rd;
-    result_type seed_value = rd() ^
-      ((result_type)std::chrono::duration_cast<std::chrono::seconds>(std::chrono::system_clock::now().time_since_epoch()).count() +
-        (result_type)std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::high_resolution_clock::now().time_since_epoch())
-          .count());
-    mersenne_twister_.seed(seed_value);
-  }
+// Where statistics are written to; only used with --stats.
+static std::unique_ptr<Statistics> statistics;
 
-  int generate(std::uniform_int_distribution<int>& distribution) { return distribution(mersenne_twister_); }
-};
+// Serializes the error messages of different worker threads.
+static std::mutex errs_mutex;
 
-// Get the path to a unique, non-existing file with the prefix `prefix`.
-std::filesystem::path get_temp_filename(RandomNumber& rn, std::filesystem::path const& prefix)
+// Return the directory that caches are stored in (see --cache-dir).
+static std::filesystem::path get_cache_directory()
 {
-  std::filesystem::path temp_filename;
-  std::uniform_int_distribution<int> dist{0, 0xffff};
-  do
-  {
-    temp_filename = prefix;
-    for (int n = 0; n < 4; ++n)
-      temp_filename += std::format("-{:04x}", rn.generate(dist));
-  } while (std::filesystem::exists(temp_filename));
-
-  return temp_filename;
+  return cache_directory.empty() ? RunCache::default_cache_directory() : std::filesystem::path(cache_directory.getValue());
 }
 
-//=============================================================================
-// Main function; process commandline parameters.
-
 // Forward declaration.
-void process_filename(ClangFrontend& clang_frontend, RandomNumber& rn, std::filesystem::path const& filename, bool use_cin);
+bool process_filename(ClangFrontend& clang_frontend, WorkItem const& item, uint64_t options_hash, std::ostream& output_stream);
 
 llvm::raw_ostream& operator<<(llvm::raw_ostream& os, AIAlert::Error const& error)
 {
@@ -185,6 +320,84 @@ llvm::raw_ostream& operator<<(llvm::raw_ostream& os, AIAlert::Error const& error
   return os;
 }
 
+// Return a description of the exception that is currently being handled.
+// Must be called from a catch block.
+static std::string current_exception_message()
+{
+  std::string message;
+  llvm::raw_string_ostream ros(message);
+  try
+  {
+    throw;
+  }
+  catch (AIAlert::Error const& error)
+  {
+    ros << error;
+  }
+  catch (std::exception& e)
+  {
+    ros << e.what();
+  }
+  catch (...)
+  {
+    ros << "Unknown error";
+  }
+  ros.flush();
+  return message;
+}
+
+// Send all work items to the server listening on connect_socket and write the results to stdout.
+static int run_client(std::vector<WorkItem> const& work_items)
+{
+  int fd;
+  try
+  {
+    fd = format_protocol::connect(connect_socket.getValue());
+  }
+  catch (...)
+  {
+    llvm::errs() << program_name << ": " << current_exception_message() << "\n";
+    return 1;
+  }
+
+  int return_code = 0;
+  for (WorkItem const& item : work_items)
+  {
+    try
+    {
+      std::unique_ptr<llvm::MemoryBuffer> input_buffer;
+      if (item.is_stdin_)
+        input_buffer = SourceFile::read_stdin(item.name());
+      else
+      {
+        auto buffer_or_err = llvm::MemoryBuffer::getFile(item.path_.native());
+        if (!buffer_or_err)
+          THROW_LALERTC(buffer_or_err.getError(), "Failed to open '[FILENAME]'", AIArgs("[FILENAME]", item.name()));
+        input_buffer = std::move(*buffer_or_err);
+      }
+      // Send the absolute path, so that the server can find headers included with double quotes.
+      std::string filename = item.is_stdin_ ? std::string{} : std::filesystem::absolute(item.path_).native();
+      std::string result;
+      if (format_protocol::format_remote(fd, filename, input_buffer->getBuffer(), result))
+        std::cout << result;
+      else
+      {
+        llvm::errs() << program_name << ": Error processing '" << item.name() << "': " << result << "\n";
+        return_code = 1;
+      }
+    }
+    catch (...)
+    {
+      llvm::errs() << program_name << ": Error processing '" << item.name() << "': " << current_exception_message() << "\n";
+      return_code = 1;
+    }
+  }
+  std::cout.flush();
+  ::close(fd);
+
+  return return_code;
+}
+
 int main(int argc, char* argv[])
 {
   Debug(NAMESPACE_DEBUG::init());
@@ -201,26 +414,17 @@ int main(int argc, char* argv[])
   // Parse command line options.
   cl::ParseCommandLineOptions(argc, argv);
 
-  // Process files list if provided.
-  std::vector<std::filesystem::path> files_to_process;
-
-  if (!files_list_file.empty())
+  if (!files_list_file.empty() && !files0_list_file.empty())
   {
-    auto maybe_files = read_files_from_list(files_list_file.getValue());
-    if (!maybe_files)
-    {
-      llvm::errs() << program_name << ": Error reading files list '" << files_list_file.getValue()
-                   << "': " << llvm::toString(maybe_files.takeError()) << "\n";
-      return 1;
-    }
-
-    auto const& files = maybe_files.get();
-    files_to_process.insert(files_to_process.end(), files.begin(), files.end());
+    llvm::errs() << program_name << ": --files and --files0-from can't be combined.\n";
+    return 1;
   }
+  bool const has_file_list = !files_list_file.empty() || !files0_list_file.empty();
+  std::string const& file_list_name = files_list_file.empty() ? files0_list_file.getValue() : files_list_file.getValue();
 
   // Add files specified directly on the command line.
   bool process_cin_requested = false;
-  std::vector<std::pair<std::filesystem::path, bool>> work_items; // path, is_stdin
+  std::vector<WorkItem> work_items;
 
   for (std::string const& input_file : input_files)
   {
@@ -235,86 +439,446 @@ int main(int argc, char* argv[])
     }
   }
 
-  // If no positional args and no --files args, default to stdin
-  if (files_to_process.empty() && work_items.empty())
+  // Add the files of a diff, each with the line ranges that were changed.
+  if (diff_file.getNumOccurrences() > 0)
+  {
+    if (!work_items.empty() || has_file_list || !lines.empty() || !offsets.empty())
+    {
+      llvm::errs() << program_name << ": --diff can't be combined with input files, --files, --files0-from, --lines or --offset.\n";
+      return 1;
+    }
+    try
+    {
+      std::unique_ptr<llvm::MemoryBuffer> diff_buffer;
+      if (diff_file.empty() || diff_file == "-")
+        diff_buffer = SourceFile::read_stdin("<stdin>");
+      else
+      {
+        auto buffer_or_err = llvm::MemoryBuffer::getFile(diff_file.getValue());
+        if (!buffer_or_err)
+          THROW_LALERTC(buffer_or_err.getError(), "Failed to open '[FILENAME]'", AIArgs("[FILENAME]", diff_file.getValue()));
+        diff_buffer = std::move(*buffer_or_err);
+      }
+      UnifiedDiff const diff(diff_buffer->getBuffer(), diff_strip);
+      for (UnifiedDiff::File const& file : diff.files())
+      {
+        work_items.push_back({file.path_, false});
+        work_items.back().line_ranges_ = file.line_ranges_;
+      }
+    }
+    catch (...)
+    {
+      llvm::errs() << program_name << ": Error reading diff: " << current_exception_message() << "\n";
+      return 1;
+    }
+    // Nothing changed: nothing to do.
+    if (work_items.empty())
+      return 0;
+  }
+
+  // If no positional args and no file list, default to stdin.
+  if (!has_file_list && work_items.empty())
   {
     work_items.push_back({{}, true});
     process_cin_requested = true;
   }
 
-  // Combine --files list and positional arguments into a single processing list
-  // Insert items from --files at the beginning
-  for (const auto& path_from_list : files_to_process)
+  if (has_file_list && file_list_name == "-" && process_cin_requested)
+  {
+    llvm::errs() << program_name << ": can't read both the file list and a source file from stdin.\n";
+    return 1;
+  }
+
+  // The normalized absolute paths of all files that were added so far.
+  std::unordered_set<std::string> added_paths;
+  // Returns false if item is a file that was already added before.
+  auto is_new = [&added_paths](WorkItem const& item) -> bool {
+    return item.is_stdin_ || added_paths.insert(std::filesystem::absolute(item.path_).lexically_normal().native()).second;
+  };
+  std::erase_if(work_items, [&is_new](WorkItem const& item){ return !is_new(item); });
+
+  // Only format part of the input, if so requested.
+  if (!lines.empty() || !offsets.empty())
   {
-    work_items.insert(work_items.begin(), {path_from_list, false});
+    if (work_items.size() != 1 || has_file_list)
+    {
+      llvm::errs() << program_name << ": --lines and --offset can only be used with a single input.\n";
+      return 1;
+    }
+    WorkItem& item = work_items.front();
+    for (std::string const& line_range : lines)
+    {
+      llvm::StringRef first_str, last_str;
+      std::tie(first_str, last_str) = llvm::StringRef(line_range).split(':');
+      unsigned int first, last;
+      if (first_str.getAsInteger(10, first) || last_str.getAsInteger(10, last) || first == 0 || last < first)
+      {
+        llvm::errs() << program_name << ": invalid --lines=" << line_range << "; expected <start>:<end> with 1 <= start <= end.\n";
+        return 1;
+      }
+      item.line_ranges_.push_back({first, last});
+    }
+    if (lengths.size() > offsets.size())
+    {
+      llvm::errs() << program_name << ": there must be an --offset for every --length.\n";
+      return 1;
+    }
+    for (size_t i = 0; i < offsets.size(); ++i)
+    {
+      constexpr FormatRanges::offset_type max_offset = std::numeric_limits<FormatRanges::offset_type>::max();
+      FormatRanges::offset_type const begin = offsets[i];
+      // Without a length, or if begin + length doesn't fit, the range runs until the end of the file.
+      FormatRanges::offset_type const end = i < lengths.size() && lengths[i] <= max_offset - begin ? begin + lengths[i] : max_offset;
+      item.byte_ranges_.push_back({begin, end});
+    }
+  }
+
+  std::unique_ptr<FileListReader> file_list;
+  if (has_file_list)
+  {
+    try
+    {
+      file_list = std::make_unique<FileListReader>(file_list_name, files_list_file.empty() ? '\0' : '\n');
+    }
+    catch (...)
+    {
+      llvm::errs() << program_name << ": " << current_exception_message() << "\n";
+      return 1;
+    }
+  }
+
+  // Read the next chunk of the file list and append the files in it that weren't seen before to `items`.
+  // Returns false when the end of the list was reached.
+  auto read_file_list = [&file_list, &is_new](std::vector<WorkItem>& items) -> bool {
+    std::vector<std::string> entries;
+    bool const more = file_list->read(entries);
+    for (std::string& entry : entries)
+    {
+      WorkItem item{std::filesystem::path(std::move(entry)), false};
+      if (is_new(item))
+        items.push_back(std::move(item));
+    }
+    return more;
+  };
+
+  if (!connect_socket.empty())
+  {
+    if (in_place)
+      llvm::errs() << program_name << ": warning: -i is not supported in combination with --connect; writing to stdout.\n";
+    if (dry_run)
+      llvm::errs() << program_name << ": warning: --dry-run is not supported in combination with --connect.\n";
+    if (!lines.empty() || !offsets.empty())
+      llvm::errs() << program_name << ": warning: --lines and --offset are not supported in combination with --connect.\n";
+    if (file_list)
+    {
+      try
+      {
+        while (read_file_list(work_items))
+          ;
+      }
+      catch (...)
+      {
+        llvm::errs() << program_name << ": " << current_exception_message() << "\n";
+        return 1;
+      }
+    }
+    return run_client(work_items);
   }
 
   // Output information about the options (optional debug info).
   if (!assume_filename.empty())
     llvm::outs() << "Using assumed filename: " << assume_filename << "\n";
 
+  if (dry_run && in_place)
+  {
+    llvm::errs() << program_name << ": warning: -i ignored in combination with --dry-run.\n";
+    in_place = false;
+  }
+  else if (warnings_as_errors && !dry_run)
+    llvm::errs() << program_name << ": warning: --Werror ignored without --dry-run.\n";
+
   if (in_place && process_cin_requested)
     llvm::errs() << program_name << ": warning: -i ignored when reading from stdin.\n";
   else if (in_place)
     llvm::outs() << "Files will be edited in-place\n";
 
-  auto configure_header_search_options = [](HeaderSearchOptions& header_search_options){
-    for (std::string const& dir : include_directories)
+  // The -I, -D and -U options given on the command line. These are used for stdin and for files
+  // that aren't listed in compile_commands.json, and are appended to the options of those that are.
+  CompilationOptions const commandline_options = commandline_compilation_options();
+
+  // How every ClangFrontend does its work.
+  FrontendSettings frontend_settings;
+  frontend_settings.directives_only_headers_ = directives_only_headers;
+  frontend_settings.replay_guarded_headers_ = replay_guarded_headers || header_cache;
+  if (header_cache)
+    frontend_settings.guarded_header_disk_cache_ = std::make_shared<GuardedHeaderDiskCache>(get_cache_directory() / "guarded-headers");
+  if (stat_cache || stat_snapshot)
+    frontend_settings.file_system_ = llvm::makeIntrusiveRefCnt<CachingFileSystem>(llvm::vfs::getRealFileSystem(),
+        stat_snapshot ? get_cache_directory() / "stat-snapshot" : std::filesystem::path{});
+  frontend_settings.max_rss_ = static_cast<size_t>(max_rss) << 20;
+  if (!prefix_header.empty())
+  {
+    std::error_code ec;
+    frontend_settings.prefix_header_ = std::filesystem::absolute(prefix_header.getValue(), ec).lexically_normal();
+    if (ec || !std::filesystem::is_regular_file(frontend_settings.prefix_header_, ec))
+    {
+      llvm::errs() << program_name << ": --pch: no such file: '" << prefix_header << "'.\n";
+      return 1;
+    }
+    // Every ClangFrontend preprocesses the prefix header when it is created; make sure that works before starting any workers.
+    try
+    {
+      ClangFrontend clang_frontend(std::bind_front(&CompilationOptions::configure_header_search_options, &commandline_options),
+          std::bind_front(&CompilationOptions::configure_commandline_macro_definitions, &commandline_options),
+          std::bind_front(&CompilationOptions::configure_language_options, &commandline_options), frontend_settings);
+    }
+    catch (...)
+    {
+      llvm::errs() << program_name << ": --pch: " << current_exception_message() << "\n";
+      return 1;
+    }
+  }
+
+  if (!server_socket.empty())
+  {
+    // Format one buffer received from a client, using the ClangFrontend of the calling thread.
+    auto format_buffer = [](ClangFrontend& clang_frontend, std::filesystem::path const& filename,
+        std::unique_ptr<llvm::MemoryBuffer>&& input_buffer, std::ostream& output, std::string& error_message) -> bool {
+      try
+      {
+        std::string input_filename_str = filename.empty() ? "<stdin>" : filename.native();
+        // Only use the path if it exists on our side, otherwise treat the content as coming from stdin.
+        std::filesystem::path full_path;
+        if (!filename.empty() && std::filesystem::exists(filename))
+          full_path = filename;
+        SourceFile const source_file(input_filename_str, full_path, std::move(input_buffer));
+        TranslationUnit translation_unit(clang_frontend, source_file, input_filename_str);
+        translation_unit.process();
+        OutputBuilder output_builder;
+        translation_unit.print(output_builder);
+        output_builder.write_to(output);
+        return true;
+      }
+      catch (...)
+      {
+        error_message = current_exception_message();
+      }
+      return false;
+    };
+
+    if (max_rss != 0)
+    {
+      llvm::errs() << program_name << ": --max-rss can't be used with --server.\n";
+      return 1;
+    }
+    if (!input_files.empty() || has_file_list)
+      llvm::errs() << program_name << ": warning: input files are ignored in server mode.\n";
+    if (!build_path.empty())
+      llvm::errs() << program_name << ": warning: -p is ignored in server mode.\n";
+
+    try
+    {
+      FormatServer format_server(server_socket.getValue(), jobs,
+          std::bind_front(&CompilationOptions::configure_header_search_options, &commandline_options),
+          std::bind_front(&CompilationOptions::configure_commandline_macro_definitions, &commandline_options),
+          std::bind_front(&CompilationOptions::configure_language_options, &commandline_options),
+          frontend_settings, format_buffer);
+      format_server.run();
+      return 0;
+    }
+    catch (...)
+    {
+      llvm::errs() << program_name << ": " << current_exception_message() << "\n";
+    }
+    return 1;
+  }
+
+  std::optional<CompilationDatabase> compilation_database;
+  if (!build_path.empty())
+  {
+    try
+    {
+      compilation_database.emplace(build_path.getValue());
+    }
+    catch (...)
     {
-      Dout(dc::notice, "Adding include directory \"" << dir << "\".");
-      header_search_options.AddPath(dir, clang::frontend::Angled, false, false);
+      llvm::errs() << program_name << ": " << current_exception_message() << "\n";
+      return 1;
     }
+  }
+
+  if (incremental && !in_place && !dry_run)
+    llvm::errs() << program_name << ": warning: --incremental ignored without -i or --dry-run.\n";
+  else if (incremental)
+    run_cache = std::make_unique<RunCache>(get_cache_directory() / "run-index");
+
+  if (!stats_file.empty())
+  {
+    try
+    {
+      statistics = std::make_unique<Statistics>(stats_file.getValue());
+    }
+    catch (...)
+    {
+      llvm::errs() << program_name << ": " << current_exception_message() << "\n";
+      return 1;
+    }
+  }
+
+  // Every distinct set of options that files are processed with, mapped to the hash of the effective options (as used by the run cache).
+  // This is a std::map, so that the keys that WorkItem::options_ points to stay where they are while more are added.
+  std::map<CompilationOptions, uint64_t> options_to_hash;
+  auto add_options = [&options_to_hash, &frontend_settings](CompilationOptions&& options) {
+    auto [entry, inserted] = options_to_hash.try_emplace(std::move(options), 0);
+    if (inserted)
+      entry->second = effective_options_hash(entry->first, frontend_settings);
+    return entry;
   };
+  auto const commandline_entry = add_options(CompilationOptions{commandline_options});
 
-  auto configure_commandline_macro_definitions = [](clang::PreprocessorOptions& preprocessor_options){
-    using position_to_type_map_type = std::map<unsigned, std::pair<char, std::string>>;
-    position_to_type_map_type position_to_type_map;
-    for (unsigned i = 0; i < commandline_macros_define.getNumOccurrences(); ++i)
-      position_to_type_map.emplace(commandline_macros_define.getPosition(i), position_to_type_map_type::mapped_type{'D', commandline_macros_define[i]});
-    for (unsigned i = 0; i < commandline_macros_undef.getNumOccurrences(); ++i)
-      position_to_type_map.emplace(commandline_macros_undef.getPosition(i), position_to_type_map_type::mapped_type{'U', commandline_macros_undef[i]});
-    for (auto&& p : position_to_type_map)
+  // Record the size of a new work item and determine the options that it must be processed with.
+  auto prepare_work_item = [&](WorkItem& item) {
+    auto entry = commandline_entry;
+    if (!item.is_stdin_)
     {
-      if (p.second.first == 'D')
+      // Record the size of the file, so that the largest files can be scheduled first.
+      std::error_code ec;
+      std::uintmax_t size = std::filesystem::file_size(item.path_, ec);
+      if (!ec)                          // Errors are reported when the file is processed.
+        item.size_ = size;
+      if (compilation_database)
       {
-        Dout(dc::notice, "Adding macro definition \"" << p.second.second << "\"");
-        preprocessor_options.addMacroDef(p.second.second);
+        CompilationOptions const* database_options = compilation_database->find(std::filesystem::absolute(item.path_));
+        if (!database_options)
+          Dout(dc::notice, "\"" << item.name() << "\" is not in the compilation database; using the command line options.");
+        else
+        {
+          CompilationOptions options = *database_options;
+          options.append(commandline_options);
+          entry = add_options(std::move(options));
+        }
       }
-      else
+    }
+    item.options_ = &entry->first;
+    item.options_hash_ = entry->second;
+  };
+
+  // Process one work item, using the ClangFrontend of the calling thread.
+  // Errors are reported per file; returns false if processing failed.
+  auto process_work_item = [](ClangFrontend& clang_frontend, WorkItem const& item, std::ostream& output_stream) -> bool {
+    try
+    {
+      return process_filename(clang_frontend, item, item.options_hash_, output_stream);
+    }
+    catch (...)
+    {
+      std::string message = current_exception_message();
+      std::lock_guard<std::mutex> lock(errs_mutex);
+      llvm::errs() << program_name << ": Error processing '" << item.name() << "': " << message << "\n";
+    }
+    return false; // Mark failure
+  };
+
+  // Each worker thread creates its own ClangFrontend instance per set of options.
+  // If there is a file list then its length isn't known until it has been read completely.
+  WorkerPool worker_pool(jobs, file_list ? std::nullopt : std::optional<size_t>{work_items.size()}, frontend_settings, process_work_item);
+  int return_code = 0;
+
+  // Process the files given on the command line.
+  for (WorkItem& item : work_items)
+    prepare_work_item(item);
+  worker_pool.add(std::move(work_items));
+
+  // Process the files of the list, while the rest of the list is still being read.
+  if (file_list)
+  {
+    try
+    {
+      bool more;
+      do
       {
-        Dout(dc::notice, "Undefining macro \"" << p.second.second << "\"");
-        preprocessor_options.addMacroUndef(p.second.second);
+        std::vector<WorkItem> batch;
+        more = read_file_list(batch);
+        for (WorkItem& item : batch)
+          prepare_work_item(item);
+        if (!batch.empty())
+          worker_pool.add(std::move(batch));
       }
+      while (more);
     }
-  };
+    catch (...)
+    {
+      std::string message = current_exception_message();
+      std::lock_guard<std::mutex> lock(errs_mutex);
+      llvm::errs() << program_name << ": " << message << "\n";
+      return_code = 1;
+    }
+  }
 
-  // Create a ClangFrontend instance.
-  ClangFrontend clang_frontend(configure_header_search_options, configure_commandline_macro_definitions);
-  // Needed for temporary file name generation.
-  RandomNumber rn;
+  if (!worker_pool.finish())            // Track if any file processing failed
+    return_code = 1;
+  Dout(dc::notice, "Used " << options_to_hash.size() << " different sets of options.");
 
-  // Process the combined list.
-  int return_code = 0; // Track if any file processing failed
-  for (const auto& item : work_items)
+  if (in_place && sync_policy == InPlaceWriter::sync_end)
   {
     try
     {
-      process_filename(clang_frontend, rn, item.first, item.second);
+      InPlaceWriter::sync_filesystems();
     }
-    catch (AIAlert::Error const& error)
+    catch (...)
     {
-      llvm::errs() << program_name << ": Error processing '" << (item.second ? "<stdin>" : item.first.native()) << "': " << error << "\n";
-      return_code = 1; // Mark failure
+      llvm::errs() << program_name << ": " << current_exception_message() << "\n";
+      return_code = 1;
     }
-    catch (std::exception& e)
+  }
+
+  if (statistics)
+  {
+    try
     {
-      llvm::errs() << program_name << ": Error processing '" << (item.second ? "<stdin>" : item.first.native()) << "': " << e.what() << "\n";
-      return_code = 1; // Mark failure
+      statistics->finish();
     }
     catch (...)
     {
-      llvm::errs() << program_name << ": Unknown error processing '" << (item.second ? "<stdin>" : item.first.native()) << "'\n";
-      return_code = 1; // Mark failure
+      llvm::errs() << program_name << ": " << current_exception_message() << "\n";
+      return_code = 1;
+    }
+  }
+
+  // Remember which files are formatted now, even if some other file failed.
+  if (run_cache)
+  {
+    try
+    {
+      run_cache->save();
+    }
+    catch (...)
+    {
+      llvm::errs() << program_name << ": warning: failed to save the run cache: " << current_exception_message() << "\n";
+    }
+  }
+
+  if (stat_snapshot)
+  {
+    try
+    {
+      frontend_settings.file_system_->save();
+    }
+    catch (...)
+    {
+      llvm::errs() << program_name << ": warning: failed to save the stat snapshot: " << current_exception_message() << "\n";
+    }
+  }
+
+  if (header_cache)
+  {
+    try
+    {
+      frontend_settings.guarded_header_disk_cache_->save();
+    }
+    catch (...)
+    {
+      llvm::errs() << program_name << ": warning: failed to save the guarded header cache: " << current_exception_message() << "\n";
     }
   }
 
@@ -331,36 +895,45 @@ int main(int argc, char* argv[])
 //=============================================================================
 // Process one TU.
 
-// Acquire the input as an llvm::MemoryBuffer (from file or stdin) and open
-// the appropriate output stream (stdout or temporary file).
+// Acquire the input as an llvm::MemoryBuffer (from file or stdin), process it
+// and write the result to the appropriate output (output_stream or an InPlaceWriter).
+//
+// If a file was opened (use_cin is false) and `in_place` is true, atomically
+// replace the original (path) upon successful conversion.
 //
-// If a file was opened (use_cin is false) and `in_place` is false, move
-// the temporary file over the original (path) upon successful conversion.
+// In --dry-run mode nothing is written; instead the first difference with the
+// input is reported.
 //
-// Calls process_input_buffer for the actual processing.
-void process_filename(ClangFrontend& clang_frontend, RandomNumber& rn, std::filesystem::path const& filename, bool use_cin)
+// Returns false if the file is not formatted and --Werror was given.
+bool process_filename(ClangFrontend& clang_frontend, WorkItem const& item, uint64_t options_hash, std::ostream& output_stream)
 {
+  std::filesystem::path const& filename = item.path_;
+  bool const use_cin = item.is_stdin_;
   std::string input_filename_str = use_cin ? "<stdin>" : filename.native();
-  std::string stdin_content_holder; // Must outlive input_buffer if getMemBuffer is used.
 
   std::filesystem::path full_path;
   if (!use_cin)
     full_path = std::filesystem::absolute(filename);
 
+  // Skip the file if it didn't change since it was formatted by a previous run.
+  if (run_cache && !use_cin && run_cache->is_up_to_date(full_path, options_hash))
+  {
+    Dout(dc::notice, "Skipping \"" << input_filename_str << "\": already formatted.");
+    return true;
+  }
+
+  // Collect statistics about this file, if so requested.
+  std::optional<Statistics::File> file_statistics;
+  if (statistics)
+    file_statistics.emplace();
+
   // --- 1. Acquire Input Buffer ---
   std::unique_ptr<llvm::MemoryBuffer> input_buffer;
 
   if (use_cin)
   {
-    // Read all of stdin into a string first.
-    stdin_content_holder.assign((std::istreambuf_iterator<char>(std::cin)), (std::istreambuf_iterator<char>()));
-
-    if (std::cin.bad())
-      THROW_LALERT("Error reading from std::cin");
-
-    // Create a MemoryBuffer *referencing* the string's data. No copy.
-    // 'stdin_content_holder' MUST outlive the use of 'input_buffer'.
-    input_buffer = llvm::MemoryBuffer::getMemBuffer(llvm::StringRef(stdin_content_holder), input_filename_str, /*RequiresNullTerminator=*/true);
+    // Read all of stdin in bulk (or map it, if it is a regular file).
+    input_buffer = SourceFile::read_stdin(input_filename_str);
   }
   else
   {
@@ -373,95 +946,89 @@ void process_filename(ClangFrontend& clang_frontend, RandomNumber& rn, std::file
     input_buffer = std::move(*buffer_or_err);
   }
 
-  // --- 2. Setup Output Stream ---
-  std::ostream* output_stream_ptr = &std::cout; // Default to stdout
-  std::ofstream temp_ofile;                     // Store ofstream here if used
-  std::filesystem::path temp_filename;          // Store temp filename path here if used
-  bool writing_to_temp_file = !use_cin && in_place;
-
-  if (writing_to_temp_file)
-  {
-    std::filesystem::path temp_filename_prefix = filename;
-    temp_filename_prefix += ".cwformat-tmp";
-    temp_filename = get_temp_filename(rn, temp_filename_prefix);
-
-    temp_ofile.open(temp_filename, std::ios::binary | std::ios::trunc);
-    if (!temp_ofile.is_open())
-      THROW_LALERTE("Failed to create temporary file '[FILENAME]'", AIArgs("[FILENAME]", temp_filename.native()));
-    output_stream_ptr = &temp_ofile; // Point to the file stream
-  }
-
   // Create a SourceFile object from the input buffer.
   SourceFile const source_file(input_filename_str, full_path, std::move(input_buffer));
-  // Create a TranslationUnit object to hold the result.
-  TranslationUnit translation_unit(clang_frontend, source_file, input_filename_str);
 
-  // --- 3. Process the SourceFile ---
-  // output_stream_ptr is either &std::cout or &temp_ofile.
-  // source_file holds the data.
-  // Use a try-finally like structure for cleanup (RAII with ofstream helps).
+  // Only format part of the file, if so requested.
+  std::optional<FormatRanges> format_ranges;
+  if (!item.whole_file())
+    format_ranges.emplace(source_file, item.line_ranges_, item.byte_ranges_);
 
-  bool success = false;
-  try
-  {
-    // Read the source file into translation_unit.
-    translation_unit.process();
-    // Write the result to the output stream.
-    translation_unit.print(*output_stream_ptr);
+  Statistics::File* const file_statistics_ptr = file_statistics ? &*file_statistics : nullptr;
+  if (file_statistics)
+    file_statistics->bytes_ = source_file.size();
 
-    // Flush the output stream to ensure data is written and check for errors
-    output_stream_ptr->flush();
-    if (!output_stream_ptr->good())
-      THROW_LALERT("Failed writing to output stream for '[FILENAME]'", AIArgs("[FILENAME]", input_filename_str));
-
-    // If we wrote to a temporary file, close it before renaming
-    if (temp_ofile.is_open())
+  // Create a TranslationUnit object to hold the result.
+  TranslationUnit translation_unit(clang_frontend, source_file, input_filename_str, format_ranges ? &*format_ranges : nullptr, file_statistics_ptr);
+
+  // --- 2. Process the SourceFile ---
+  // Read the source file into translation_unit.
+  translation_unit.process();
+
+  Statistics::PhaseTimer output_timer(file_statistics_ptr, Statistics::File::output);
+  // Collect the result; this mostly refers to spans of source_file.
+  // In --dry-run and -i mode it is compared with the input while it is produced, up to the first difference.
+  // With --dry-run nothing else is needed, so the output isn't stored and printing stops at that difference.
+  std::string_view const original = source_file.span(source_file.begin(), source_file.size());
+  bool const compare_with_original = dry_run || (in_place && !use_cin);
+  OutputBuilder output_builder(compare_with_original ? original : std::string_view{},
+      dry_run ? OutputBuilder::compare_only : OutputBuilder::build_output);
+  translation_unit.print(output_builder);
+
+  // --- 3. Write the result ---
+  bool result = true;
+  if (dry_run)
+  {
+    size_t const difference = output_builder.first_difference();
+    if (difference != std::string_view::npos)
     {
-      temp_ofile.close();
-      // Check state *after* closing.
-      if (!temp_ofile.good())
-      {
-        std::error_code ignored_ec;
-        std::filesystem::remove(temp_filename, ignored_ec);
-        THROW_LALERT("Failed closing temporary file '[FILENAME]'", AIArgs("[FILENAME]", temp_filename.native()));
-      }
+      // Report the first difference as file:line:column (one-based, like compilers do).
+      std::string_view const before = original.substr(0, std::min(difference, original.size()));
+      size_t const line = std::ranges::count(before, '\n') + 1;
+      size_t const last_newline = before.rfind('\n');
+      size_t const column = (last_newline == std::string_view::npos ? difference : difference - last_newline - 1) + 1;
+      std::lock_guard<std::mutex> lock(errs_mutex);
+      llvm::errs() << input_filename_str << ':' << line << ':' << column << ": " << (warnings_as_errors ? "error" : "warning") <<
+        ": code should be formatted with " << program_name << " [-Wcwformat-violations]\n";
+      result = !warnings_as_errors;
     }
-    success = true; // Mark success only if all steps complete without exceptions.
-  }
-  catch (...)
-  {
-    // Cleanup on error: If we created a temp file, remove it.
-    if (temp_ofile.is_open())
-      temp_ofile.close(); // Close first (might fail, ignore failure here)
-    if (writing_to_temp_file && !temp_filename.empty() && std::filesystem::exists(temp_filename))
+    else if (run_cache && !use_cin && item.whole_file())
     {
-      std::error_code ignored_ec;
-      std::filesystem::remove(temp_filename, ignored_ec); // Ignore remove errors during cleanup.
+      // The file is already formatted; a next run can skip it until it changes.
+      run_cache->mark_formatted(full_path, options_hash);
     }
-    throw;                                                // Re-throw the original exception.
+  }
+  else if (!use_cin && in_place)
+  {
+    // The InPlaceWriter doesn't touch the file if the output is equal to the original.
+    InPlaceWriter in_place_writer(filename);
+    InPlaceWriter::Result const commit_result = in_place_writer.commit(output_builder, sync_policy);
+    if (commit_result == InPlaceWriter::unchanged)
+      Dout(dc::notice, "\"" << input_filename_str << "\" was already formatted.");
+    // Record the stat data of the (now) formatted file, unless only part of it was formatted.
+    if (run_cache && item.whole_file())
+      run_cache->mark_formatted(full_path, options_hash);
+  }
+  else if (&output_stream == &std::cout)
+  {
+    // Write directly to the file descriptor, bypassing the iostream buffer.
+    std::cout.flush();
+    output_builder.write_to(STDOUT_FILENO);
+  }
+  else
+  {
+    // A worker thread that buffers its output, which must be copied before source_file is destroyed.
+    output_builder.write_to(output_stream);
+    if (!output_stream.good())
+      THROW_LALERT("Failed writing to output stream for '[FILENAME]'", AIArgs("[FILENAME]", input_filename_str));
   }
 
-  // --- 4. Finalize (Rename if necessary) ---
-  if (success && writing_to_temp_file)
+  if (file_statistics)
   {
-#if -0
-    // Rename temporary file to original file
-    std::error_code ec;
-    std::filesystem::rename(temp_filename, filename, ec);
-    if (ec)
-    {
-      std::error_code ignored_ec;
-      std::filesystem::remove(temp_filename, ignored_ec);
-      THROW_LALERTC(ec, "Failed to rename temporary file '[FILENAME]' to '[NEWFILENAME]'", AIArgs("[FILENAME]", temp_filename.native())("[NEWFILENAME]", filename.native()));
-    }
-    // Success! Temporary file has been renamed.
-#else
-    Dout(dc::warning, "Not renaming temporary file '" << temp_filename.native() << "' to '" << filename.native() << "'; writing to disk isn't implemented yet.");
-#endif
+    file_statistics->stop();
+    statistics->add(input_filename_str, *file_statistics);
   }
-  // If success and not writing_to_temp_file, output went to stdout, nothing more to do.
 
-  // input_buffer went out of scope or was moved into process_input_buffer.
-  // temp_ofile goes out of scope, closing file if not already closed.
-  // stdin_content_holder goes out of scope.
+  // input_buffer was moved into source_file.
+  return result;
 }
@@ -0,0 +1,299 @@
+#include "sys.h"
+#include "utils/AIAlert.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/JSON.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/raw_ostream.h"
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstdio>
+#include <filesystem>
+#include <iostream>
+#include <map>
+#include <optional>
+#include <string>
+#include <vector>
+#include "debug.h"
+
+// cwformat_baseline
+//
+// Records performance baselines and compares new results against them.
+//
+// The input are JSON files as written by `cwformat_bench --json` or by
+// `cwformat --stats`. Every input file is one run; every iteration of
+// cwformat_bench and every phase of the aggregate of --stats becomes a
+// sample of a metric (e.g. "bench.warm.seconds" or "stats.process_gap.cpu_ns").
+// All metrics are times: lower is better.
+//
+//   cwformat_baseline record [--commit=<sha>] <result.json>...
+//
+// adds the samples to the baseline of the commit (by default the current
+// HEAD), stored as <dir>/<sha>.json. Run the benchmark several times and
+// record all runs, so that there are enough samples to say anything about
+// the noise.
+//
+//   cwformat_baseline compare --baseline=<sha> <result.json>...
+//
+// compares the samples of the new runs with those of the baseline, per
+// metric, using the median and the median absolute deviation (MAD). A
+// metric is flagged as a regression when its median got worse by more than
+// --threshold percent and the difference is larger than --sigma times the
+// combined (robust) standard deviation. The exit code is 1 if there was a
+// regression.
+
+namespace cl = llvm::cl;
+
+cl::OptionCategory baseline_category("cwformat_baseline options");
+
+cl::SubCommand record_command("record", "Add the samples of one or more runs to the baseline of a commit.");
+cl::SubCommand compare_command("compare", "Compare one or more runs against the baseline of a commit.");
+
+cl::list<std::string> result_files(cl::Positional, cl::OneOrMore, cl::desc("<result.json>..."),
+    cl::sub(record_command), cl::sub(compare_command), cl::cat(baseline_category));
+
+cl::opt<std::string> baseline_directory("dir", cl::desc("The directory that contains the baselines (default .cwformat-baselines)."),
+    cl::value_desc("dir"), cl::init(".cwformat-baselines"), cl::sub(record_command), cl::sub(compare_command), cl::cat(baseline_category));
+
+cl::opt<std::string> commit("commit", cl::desc("The commit to record the baseline for (default: the HEAD of the current git repository)."),
+    cl::value_desc("sha"), cl::sub(record_command), cl::cat(baseline_category));
+
+cl::opt<std::string> baseline_commit("baseline", cl::Required, cl::desc("The commit of the baseline to compare with."),
+    cl::value_desc("sha"), cl::sub(compare_command), cl::cat(baseline_category));
+
+cl::opt<double> threshold("threshold", cl::desc("The minimum relative change, in percent, to be flagged as a regression (default 2)."),
+    cl::value_desc("percent"), cl::init(2.0), cl::sub(compare_command), cl::cat(baseline_category));
+
+cl::opt<double> sigma("sigma", cl::desc("The minimum significance, in robust standard deviations, to be flagged as a regression (default 3)."),
+    cl::value_desc("N"), cl::init(3.0), cl::sub(compare_command), cl::cat(baseline_category));
+
+namespace {
+
+// The samples of each metric.
+using metrics_type = std::map<std::string, std::vector<double>>;
+
+// Samples are only compared if both sides have at least this many.
+constexpr size_t minimum_samples = 3;
+
+// The factor that turns a MAD into an estimate of the standard deviation of a normal distribution.
+constexpr double mad_to_sigma = 1.4826;
+
+llvm::json::Value read_json(std::filesystem::path const& path)
+{
+  auto buffer_or_err = llvm::MemoryBuffer::getFile(path.native());
+  if (!buffer_or_err)
+    THROW_LALERTC(buffer_or_err.getError(), "Failed to open '[FILENAME]'", AIArgs("[FILENAME]", path.native()));
+  llvm::Expected<llvm::json::Value> json = llvm::json::parse((*buffer_or_err)->getBuffer());
+  if (!json)
+    THROW_LALERT("Failed to parse '[FILENAME]': [ERROR]", AIArgs("[FILENAME]", path.native())("[ERROR]", llvm::toString(json.takeError())));
+  return std::move(*json);
+}
+
+void add_time_samples(metrics_type& metrics, std::string const& prefix, llvm::json::Object const* time)
+{
+  if (!time)
+    return;
+  for (char const* clock : { "wall_ns", "cpu_ns" })
+    if (std::optional<double> value = time->getNumber(clock))
+      metrics[prefix + "." + clock].push_back(*value);
+}
+
+// Add the samples of the cwformat_bench or --stats result `path` to `metrics`.
+void extract_samples(std::filesystem::path const& path, metrics_type& metrics)
+{
+  llvm::json::Value const json = read_json(path);
+  llvm::json::Object const* root = json.getAsObject();
+  auto benchmark = root ? root->getString("benchmark") : std::nullopt;
+  if (benchmark && *benchmark == "cwformat_bench")
+  {
+    if (llvm::json::Object const* variants = root->getObject("variants"))
+      for (auto const& [variant, result] : *variants)
+        if (llvm::json::Object const* result_object = result.getAsObject())
+          if (llvm::json::Array const* seconds = result_object->getArray("seconds"))
+            for (llvm::json::Value const& sample : *seconds)
+              if (std::optional<double> value = sample.getAsNumber())
+                metrics["bench." + variant.str() + ".seconds"].push_back(*value);
+    return;
+  }
+  llvm::json::Object const* aggregate = root ? root->getObject("aggregate") : nullptr;
+  if (!aggregate)
+    THROW_LALERT("'[FILENAME]' is neither the output of cwformat_bench --json nor of cwformat --stats", AIArgs("[FILENAME]", path.native()));
+  if (llvm::json::Object const* phases = aggregate->getObject("phases"))
+    for (auto const& [phase, time] : *phases)
+      add_time_samples(metrics, "stats." + phase.str(), time.getAsObject());
+  add_time_samples(metrics, "stats.total", aggregate->getObject("total"));
+}
+
+metrics_type extract_samples()
+{
+  metrics_type metrics;
+  for (std::string const& result_file : result_files)
+    extract_samples(result_file, metrics);
+  return metrics;
+}
+
+std::filesystem::path baseline_path(std::string const& sha)
+{
+  return std::filesystem::path(baseline_directory.getValue()) / (sha + ".json");
+}
+
+metrics_type read_baseline(std::string const& sha)
+{
+  metrics_type metrics;
+  std::filesystem::path const path = baseline_path(sha);
+  llvm::json::Value const json = read_json(path);
+  llvm::json::Object const* root = json.getAsObject();
+  llvm::json::Object const* metrics_object = root ? root->getObject("metrics") : nullptr;
+  if (!metrics_object)
+    THROW_LALERT("'[FILENAME]' is not a baseline", AIArgs("[FILENAME]", path.native()));
+  for (auto const& [name, samples] : *metrics_object)
+    if (llvm::json::Array const* samples_array = samples.getAsArray())
+      for (llvm::json::Value const& sample : *samples_array)
+        if (std::optional<double> value = sample.getAsNumber())
+          metrics[name.str()].push_back(*value);
+  return metrics;
+}
+
+void write_baseline(std::string const& sha, metrics_type const& metrics)
+{
+  std::filesystem::create_directories(baseline_directory.getValue());
+  std::filesystem::path const path = baseline_path(sha);
+  std::error_code ec;
+  llvm::raw_fd_ostream os(path.native(), ec, llvm::sys::fs::OF_Text);
+  if (ec)
+    THROW_LALERTC(ec, "Failed to create '[FILENAME]'", AIArgs("[FILENAME]", path.native()));
+  llvm::json::OStream json(os, 2);
+  json.object([&]{
+    json.attribute("commit", sha);
+    json.attributeObject("metrics", [&]{
+      for (auto const& [name, samples] : metrics)
+        json.attributeArray(name, [&]{
+          for (double sample : samples)
+            json.value(sample);
+        });
+    });
+  });
+  os << '\n';
+}
+
+// Return the commit of HEAD of the git repository that the current directory is in.
+std::string git_head()
+{
+  std::string sha;
+  if (FILE* git = ::popen("git rev-parse HEAD 2>/dev/null", "r"))
+  {
+    char buf[64];
+    while (std::fgets(buf, sizeof(buf), git))
+      sha += buf;
+    if (::pclose(git) != 0)
+      sha.clear();
+  }
+  while (!sha.empty() && std::isspace(static_cast<unsigned char>(sha.back())))
+    sha.pop_back();
+  if (sha.empty())
+    THROW_LALERT("Could not determine the current git commit; use --commit");
+  return sha;
+}
+
+double median(std::vector<double> samples)
+{
+  std::ranges::sort(samples);
+  size_t const n = samples.size();
+  return n % 2 == 1 ? samples[n / 2] : (samples[n / 2 - 1] + samples[n / 2]) / 2;
+}
+
+// The median absolute deviation from the median.
+double mad(std::vector<double> const& samples, double median_value)
+{
+  std::vector<double> deviations;
+  deviations.reserve(samples.size());
+  for (double sample : samples)
+    deviations.push_back(std::abs(sample - median_value));
+  return median(std::move(deviations));
+}
+
+int record()
+{
+  std::string const sha = commit.empty() ? git_head() : commit.getValue();
+  metrics_type metrics;
+  // Add to an existing baseline of the same commit.
+  if (std::filesystem::exists(baseline_path(sha)))
+    metrics = read_baseline(sha);
+  for (auto& [name, samples] : extract_samples())
+    metrics[name].insert(metrics[name].end(), samples.begin(), samples.end());
+  write_baseline(sha, metrics);
+  llvm::outs() << "Recorded " << result_files.size() << " run(s) in " << baseline_path(sha).native() << ".\n";
+  return 0;
+}
+
+int compare()
+{
+  metrics_type const baseline = read_baseline(baseline_commit);
+  metrics_type const current = extract_samples();
+
+  int regressions = 0;
+  llvm::outs() << "metric                                     baseline            new   change   sigma\n";
+  for (auto const& [name, new_samples] : current)
+  {
+    auto baseline_samples = baseline.find(name);
+    if (baseline_samples == baseline.end())
+    {
+      llvm::outs() << llvm::format("%-36s", name.c_str()) << "  (not in baseline)\n";
+      continue;
+    }
+    std::vector<double> const& old_samples = baseline_samples->second;
+    double const old_median = median(old_samples);
+    double const new_median = median(new_samples);
+    double const change = old_median == 0 ? 0 : 100 * (new_median - old_median) / old_median;
+    llvm::outs() << llvm::format("%-36s %14.6g %14.6g %+7.2f%%", name.c_str(), old_median, new_median, change);
+    if (old_samples.size() < minimum_samples || new_samples.size() < minimum_samples)
+    {
+      llvm::outs() << "     n/a  (too few samples)\n";
+      continue;
+    }
+    double const spread = mad_to_sigma * std::hypot(mad(old_samples, old_median), mad(new_samples, new_median));
+    double const significance = spread > 0 ? (new_median - old_median) / spread : (new_median == old_median ? 0 : std::copysign(HUGE_VAL, new_median - old_median));
+    llvm::outs() << llvm::format(" %7.1f", significance);
+    if (change > threshold && significance > sigma)
+    {
+      llvm::outs() << "  REGRESSION";
+      ++regressions;
+    }
+    else if (change < -threshold && significance < -sigma)
+      llvm::outs() << "  improvement";
+    llvm::outs() << '\n';
+  }
+  if (regressions > 0)
+    llvm::outs() << regressions << " regression(s) compared to " << baseline_commit << ".\n";
+  return regressions > 0 ? 1 : 0;
+}
+
+} // namespace
+
+int main(int argc, char* argv[])
+{
+  Debug(NAMESPACE_DEBUG::init());
+
+  cl::HideUnrelatedOptions(baseline_category);
+  cl::ParseCommandLineOptions(argc, argv, "Record and compare performance baselines of cwformat.\n");
+
+  try
+  {
+    if (record_command)
+      return record();
+    if (compare_command)
+      return compare();
+    llvm::errs() << "cwformat_baseline: use either the record or the compare subcommand (see --help).\n";
+  }
+  catch (AIAlert::Error const& error)
+  {
+    std::cerr << "cwformat_baseline: " << error << std::endl;
+  }
+  catch (std::filesystem::filesystem_error const& error)
+  {
+    std::cerr << "cwformat_baseline: " << error.what() << std::endl;
+  }
+  return 2;
+}
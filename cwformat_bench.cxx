@@ -0,0 +1,407 @@
+#include "sys.h"
+#include "ClangFrontend.h"
+#include "CompilationOptions.h"
+#include "FrontendSettings.h"
+#include "OutputBuilder.h"
+#include "SourceFile.h"
+#include "TranslationUnit.h"
+#include "utils/AIAlert.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/JSON.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/raw_ostream.h"
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "debug.h"
+
+// cwformat_bench
+//
+// Measures the throughput of the whole pipeline (ClangFrontend,
+// TranslationUnit::process and TranslationUnit::print) over a fixed
+// corpus, for a fixed number of iterations.
+//
+// The corpus is read into memory before anything is measured, so that
+// only the processing itself is timed. Two variants can be measured:
+//
+// warm: a single ClangFrontend is used for every file, like a worker
+//       thread of cwformat -j or of the server does. The corpus is
+//       processed once, untimed, before the measurement starts.
+// cold: a new ClangFrontend is created for every file (and included in
+//       the time), like running cwformat once per file does.
+//
+// Each variant runs in a child process of its own, so that the reported
+// peak RSS is that of the variant (plus the corpus).
+
+namespace cl = llvm::cl;
+
+cl::OptionCategory bench_category("cwformat_bench options");
+
+cl::list<std::string> corpus(cl::Positional, cl::OneOrMore,
+    cl::desc("<file|directory> [...]; directories are searched recursively for C/C++ source files"), cl::cat(bench_category));
+
+cl::opt<unsigned int> iterations("iterations",
+    cl::desc("The number of times that the whole corpus is processed per variant (default 5)."),
+    cl::value_desc("N"), cl::init(5), cl::cat(bench_category));
+
+enum Variant { warm, cold, both };
+
+cl::opt<Variant> variant("variant",
+    cl::desc("The frontend variant to measure:"),
+    cl::values(
+      clEnumValN(warm, "warm", "Use one ClangFrontend for all files."),
+      clEnumValN(cold, "cold", "Create a new ClangFrontend for every file."),
+      clEnumValN(both, "both", "Measure both (default).")),
+    cl::init(both), cl::cat(bench_category));
+
+cl::opt<bool> json_output("json", cl::desc("Write the results as JSON to stdout."), cl::cat(bench_category));
+
+cl::opt<bool> directives_only_headers("directives-only-headers",
+    cl::desc("Only lex the preprocessor directives of included files (like cwformat --directives-only-headers)."),
+    cl::cat(bench_category));
+
+cl::opt<bool> replay_guarded_headers("replay-guarded-headers",
+    cl::desc("Replay guarded headers that were entered before (like cwformat --replay-guarded-headers)."),
+    cl::cat(bench_category));
+
+cl::opt<bool> stat_cache("stat-cache",
+    cl::desc("Share a cache of file lookups and directory listings between the frontends (like cwformat --stat-cache)."),
+    cl::cat(bench_category));
+
+cl::opt<std::string> prefix_header("pch",
+    cl::desc("Process every file as if it started with #include \"<header>\" (like cwformat --pch)."),
+    cl::value_desc("header"), cl::cat(bench_category));
+
+cl::list<std::string> include_directories("I",
+    cl::desc("Add the directory <dir> to the list of directories to be searched for header files."),
+    cl::value_desc("dir"), cl::Prefix, cl::cat(bench_category));
+
+cl::list<std::string> commandline_macros_define("D",
+    cl::desc("Define a macro using -D<name> or -D<name>=<value>."),
+    cl::value_desc("name[=value]"), cl::ValueRequired, cl::Prefix, cl::cat(bench_category));
+
+namespace {
+
+struct CorpusFile
+{
+  std::filesystem::path path_;                          // Absolute path.
+  std::unique_ptr<llvm::MemoryBuffer> content_;
+};
+
+struct Result
+{
+  char const* variant_;
+  std::vector<double> seconds_;                         // The time of each iteration.
+  size_t tokens_;                                       // The number of InputToken's per iteration.
+  long peak_rss_kb_;                                    // The peak RSS of the (child) process that ran this variant.
+
+  double median() const
+  {
+    std::vector<double> sorted = seconds_;
+    std::ranges::sort(sorted);
+    size_t const n = sorted.size();
+    return n % 2 == 1 ? sorted[n / 2] : (sorted[n / 2 - 1] + sorted[n / 2]) / 2;
+  }
+};
+
+bool is_source_file(std::filesystem::path const& path)
+{
+  static constexpr std::array<char const*, 10> extensions = { ".h", ".hh", ".hpp", ".hxx", ".inl", ".c", ".cc", ".cpp", ".cxx", ".ipp" };
+  std::string const extension = path.extension().native();
+  return std::ranges::find(extensions, extension) != extensions.end();
+}
+
+void add_corpus_file(std::vector<CorpusFile>& files, std::filesystem::path const& path)
+{
+  auto buffer_or_err = llvm::MemoryBuffer::getFile(path.native(), /*IsText=*/false, /*RequiresNullTerminator=*/true);
+  if (!buffer_or_err)
+    THROW_LALERTC(buffer_or_err.getError(), "Failed to open '[FILENAME]'", AIArgs("[FILENAME]", path.native()));
+  files.push_back({std::filesystem::absolute(path), std::move(*buffer_or_err)});
+}
+
+std::vector<CorpusFile> load_corpus()
+{
+  std::vector<CorpusFile> files;
+  for (std::string const& entry : corpus)
+  {
+    if (!std::filesystem::is_directory(entry))
+    {
+      add_corpus_file(files, entry);
+      continue;
+    }
+    // Sort the files found in a directory, so that every run processes them in the same order.
+    std::vector<std::filesystem::path> paths;
+    for (std::filesystem::directory_entry const& directory_entry : std::filesystem::recursive_directory_iterator(entry))
+      if (directory_entry.is_regular_file() && is_source_file(directory_entry.path()))
+        paths.push_back(directory_entry.path());
+    std::ranges::sort(paths);
+    for (std::filesystem::path const& path : paths)
+      add_corpus_file(files, path);
+  }
+  return files;
+}
+
+CompilationOptions commandline_compilation_options()
+{
+  CompilationOptions result;
+  for (std::string const& dir : include_directories)
+    result.include_directories_.emplace_back(clang::frontend::Angled, dir);
+  for (std::string const& macro : commandline_macros_define)
+    result.macro_operations_.emplace_back('D', macro);
+  return result;
+}
+
+// Run the pipeline over one file. Returns the number of InputToken's.
+size_t process(ClangFrontend& clang_frontend, CorpusFile const& file)
+{
+  // Use a non-owning buffer, so that the corpus isn't copied.
+  SourceFile const source_file(file.path_.native(), file.path_,
+      llvm::MemoryBuffer::getMemBuffer(file.content_->getMemBufferRef(), /*RequiresNullTerminator=*/true));
+  TranslationUnit translation_unit(clang_frontend, source_file, file.path_.native());
+  translation_unit.process();
+  OutputBuilder output_builder;
+  translation_unit.print(output_builder);
+  return translation_unit.number_of_input_tokens();
+}
+
+Result run(Variant variant, std::vector<CorpusFile> const& files, CompilationOptions const& options)
+{
+  DoutEntering(dc::notice, "run(" << (variant == warm ? "warm" : "cold") << ", ...)");
+
+  FrontendSettings frontend_settings;
+  frontend_settings.directives_only_headers_ = directives_only_headers;
+  frontend_settings.replay_guarded_headers_ = replay_guarded_headers;
+  if (stat_cache)
+    frontend_settings.file_system_ = llvm::makeIntrusiveRefCnt<CachingFileSystem>(llvm::vfs::getRealFileSystem());
+  if (!prefix_header.empty())
+    frontend_settings.prefix_header_ = std::filesystem::absolute(prefix_header.getValue());
+
+  auto create_frontend = [&options, &frontend_settings]() {
+    return std::make_unique<ClangFrontend>(
+        std::bind_front(&CompilationOptions::configure_header_search_options, &options),
+        std::bind_front(&CompilationOptions::configure_commandline_macro_definitions, &options),
+        std::bind_front(&CompilationOptions::configure_language_options, &options), frontend_settings);
+  };
+
+  Result result{variant == warm ? "warm" : "cold", {}, 0, 0};
+
+  std::unique_ptr<ClangFrontend> warm_frontend;
+  if (variant == warm)
+  {
+    // Warm up: let the frontend see every file (and header) once.
+    warm_frontend = create_frontend();
+    for (CorpusFile const& file : files)
+      process(*warm_frontend, file);
+  }
+
+  for (unsigned int iteration = 0; iteration < iterations; ++iteration)
+  {
+    size_t tokens = 0;
+    auto const start = std::chrono::steady_clock::now();
+    for (CorpusFile const& file : files)
+    {
+      if (variant == cold)
+      {
+        std::unique_ptr<ClangFrontend> cold_frontend = create_frontend();
+        tokens += process(*cold_frontend, file);
+      }
+      else
+        tokens += process(*warm_frontend, file);
+    }
+    auto const stop = std::chrono::steady_clock::now();
+    result.seconds_.push_back(std::chrono::duration<double>(stop - start).count());
+    result.tokens_ = tokens;
+  }
+
+  rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  result.peak_rss_kb_ = usage.ru_maxrss;
+  return result;
+}
+
+// Run `variant` in a child process and return its result.
+Result run_in_child(Variant variant, std::vector<CorpusFile> const& files, CompilationOptions const& options)
+{
+  int fds[2];
+  if (::pipe2(fds, O_CLOEXEC) == -1)
+    THROW_LALERTE("pipe2 failed");
+  pid_t const pid = ::fork();
+  if (pid == -1)
+    THROW_LALERTE("fork failed");
+
+  if (pid == 0)
+  {
+    // The child: run the variant and send the result to the parent as
+    // tokens, peak RSS, number of iterations and the seconds of each iteration.
+    ::close(fds[0]);
+    int exit_code = 0;
+    try
+    {
+      Result const result = run(variant, files, options);
+      size_t const number_of_iterations = result.seconds_.size();
+      std::string message;
+      message.append(reinterpret_cast<char const*>(&result.tokens_), sizeof(result.tokens_));
+      message.append(reinterpret_cast<char const*>(&result.peak_rss_kb_), sizeof(result.peak_rss_kb_));
+      message.append(reinterpret_cast<char const*>(&number_of_iterations), sizeof(number_of_iterations));
+      message.append(reinterpret_cast<char const*>(result.seconds_.data()), number_of_iterations * sizeof(double));
+      for (size_t written = 0; written < message.size();)
+      {
+        ssize_t len = ::write(fds[1], message.data() + written, message.size() - written);
+        if (len == -1 && errno == EINTR)
+          continue;
+        if (len == -1)
+          THROW_LALERTE("Failed to write to the parent");
+        written += len;
+      }
+    }
+    catch (AIAlert::Error const& error)
+    {
+      std::cerr << "cwformat_bench: " << error << std::endl;
+      exit_code = 1;
+    }
+    catch (std::exception const& error)
+    {
+      std::cerr << "cwformat_bench: " << error.what() << std::endl;
+      exit_code = 1;
+    }
+    // Don't run the destructors of the parent's state (or flush its buffers) a second time.
+    ::_exit(exit_code);
+  }
+
+  // The parent.
+  ::close(fds[1]);
+  std::string message;
+  char buf[4096];
+  for (;;)
+  {
+    ssize_t len = ::read(fds[0], buf, sizeof(buf));
+    if (len == -1 && errno == EINTR)
+      continue;
+    if (len <= 0)
+      break;
+    message.append(buf, len);
+  }
+  ::close(fds[0]);
+  int status;
+  while (::waitpid(pid, &status, 0) == -1 && errno == EINTR)
+    ;
+  char const* const variant_name = variant == warm ? "warm" : "cold";
+  if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+    THROW_LALERT("The [VARIANT] variant failed", AIArgs("[VARIANT]", variant_name));
+
+  Result result{variant_name, {}, 0, 0};
+  size_t number_of_iterations = 0;
+  size_t const header_size = sizeof(result.tokens_) + sizeof(result.peak_rss_kb_) + sizeof(number_of_iterations);
+  if (message.size() >= header_size)
+  {
+    char const* ptr = message.data();
+    std::memcpy(&result.tokens_, ptr, sizeof(result.tokens_));
+    ptr += sizeof(result.tokens_);
+    std::memcpy(&result.peak_rss_kb_, ptr, sizeof(result.peak_rss_kb_));
+    ptr += sizeof(result.peak_rss_kb_);
+    std::memcpy(&number_of_iterations, ptr, sizeof(number_of_iterations));
+  }
+  if (message.size() < header_size || message.size() != header_size + number_of_iterations * sizeof(double))
+    THROW_LALERT("Received a malformed result from the [VARIANT] variant", AIArgs("[VARIANT]", variant_name));
+  result.seconds_.resize(number_of_iterations);
+  std::memcpy(result.seconds_.data(), message.data() + header_size, number_of_iterations * sizeof(double));
+  return result;
+}
+
+} // namespace
+
+int main(int argc, char* argv[])
+{
+  Debug(NAMESPACE_DEBUG::init());
+
+  cl::HideUnrelatedOptions(bench_category);
+  cl::ParseCommandLineOptions(argc, argv, "Measure the throughput of cwformat over a corpus.\n");
+
+  if (iterations == 0)
+  {
+    llvm::errs() << "cwformat_bench: --iterations must be at least 1.\n";
+    return 1;
+  }
+
+  std::vector<Result> results;
+  std::vector<CorpusFile> files;
+  size_t bytes = 0;
+  try
+  {
+    files = load_corpus();
+    for (CorpusFile const& file : files)
+      bytes += file.content_->getBufferSize();
+
+    CompilationOptions const options = commandline_compilation_options();
+    if (variant != cold)
+      results.push_back(run_in_child(warm, files, options));
+    if (variant != warm)
+      results.push_back(run_in_child(cold, files, options));
+  }
+  catch (AIAlert::Error const& error)
+  {
+    std::cerr << "cwformat_bench: " << error << std::endl;
+    return 1;
+  }
+  catch (std::filesystem::filesystem_error const& error)
+  {
+    std::cerr << "cwformat_bench: " << error.what() << std::endl;
+    return 1;
+  }
+
+  if (json_output)
+  {
+    llvm::json::OStream json(llvm::outs(), 2);
+    json.object([&]{
+      json.attribute("benchmark", "cwformat_bench");
+      json.attribute("files", files.size());
+      json.attribute("bytes", bytes);
+      json.attribute("iterations", iterations.getValue());
+      json.attributeObject("variants", [&]{
+        for (Result const& result : results)
+        {
+          double const median = result.median();
+          json.attributeObject(result.variant_, [&]{
+            json.attributeArray("seconds", [&]{
+              for (double seconds : result.seconds_)
+                json.value(seconds);
+            });
+            json.attribute("median_seconds", median);
+            json.attribute("tokens", result.tokens_);
+            json.attribute("mb_per_second", bytes / 1e6 / median);
+            json.attribute("tokens_per_second", result.tokens_ / median);
+            json.attribute("files_per_second", files.size() / median);
+            json.attribute("peak_rss_kb", static_cast<int64_t>(result.peak_rss_kb_));
+          });
+        }
+      });
+    });
+    llvm::outs() << '\n';
+    return 0;
+  }
+
+  llvm::outs() << "Corpus: " << files.size() << " files, " << bytes << " bytes.\n";
+  for (Result const& result : results)
+  {
+    double const median = result.median();
+    llvm::outs() << result.variant_ << ": " << result.seconds_.size() << " iterations, median " << llvm::format("%.4f", median) << " s (min " <<
+      llvm::format("%.4f", *std::ranges::min_element(result.seconds_)) << " s): " <<
+      llvm::format("%.2f", bytes / 1e6 / median) << " MB/s, " <<
+      llvm::format("%.0f", result.tokens_ / median) << " tokens/s, " <<
+      llvm::format("%.1f", files.size() / median) << " files/s, peak RSS " << result.peak_rss_kb_ << " kB\n";
+  }
+  return 0;
+}
@@ -0,0 +1,318 @@
+#include "sys.h"
+#include "utils/AIAlert.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/raw_ostream.h"
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <string>
+#include "debug.h"
+
+// cwformat_gencorpus
+//
+// Generates C++ source files that stress specific parts of cwformat,
+// at a configurable size and density, for use with cwformat_bench:
+//
+// macros:        invocations of function-like macros with nested parentheses
+//                and nested invocations in their arguments (the CodeScanner
+//                path of TranslationUnit::process_gap).
+// comments:      comment-dense code, mixing C and C++ comments.
+// continuations: long #define's that are continued with backslash-newlines.
+// includes:      a deep chain of (guarded) headers, each including the next.
+// tables:        huge initializer tables.
+// mixed:         all of the above.
+//
+// Between the constructs of the requested kind, plain code is emitted;
+// the density is the percentage of constructs versus lines of plain code.
+// The output only depends on the options (including the seed), so that
+// the same corpus can be generated again on any machine.
+
+namespace cl = llvm::cl;
+
+cl::OptionCategory gencorpus_category("cwformat_gencorpus options");
+
+cl::opt<std::string> output_directory("o", cl::Required,
+    cl::desc("The directory to write the generated files to."), cl::value_desc("dir"), cl::cat(gencorpus_category));
+
+enum Kind { macros, comments, continuations, includes, tables, mixed };
+
+cl::opt<Kind> kind("kind",
+    cl::desc("What to stress:"),
+    cl::values(
+      clEnumVal(macros, "Function-like macro invocations with nested parentheses."),
+      clEnumVal(comments, "Comment-dense code."),
+      clEnumVal(continuations, "Long backslash-newline continued #define's."),
+      clEnumVal(includes, "Deep include chains."),
+      clEnumVal(tables, "Huge initializer tables."),
+      clEnumVal(mixed, "All of the above (default).")),
+    cl::init(mixed), cl::cat(gencorpus_category));
+
+cl::opt<unsigned int> number_of_files("files", cl::desc("The number of source files to generate (default 1)."),
+    cl::value_desc("N"), cl::init(1), cl::cat(gencorpus_category));
+
+cl::opt<uint64_t> file_size("size", cl::desc("The (approximate) size of each source file in bytes (default 100000)."),
+    cl::value_desc("bytes"), cl::init(100000), cl::cat(gencorpus_category));
+
+cl::opt<unsigned int> density("density", cl::desc("The percentage of constructs of the requested kind, versus lines of plain code (default 50)."),
+    cl::value_desc("percent"), cl::init(50), cl::cat(gencorpus_category));
+
+cl::opt<unsigned int> length("length",
+    cl::desc("The size of each construct: lines per comment block or #define, rows per table, arguments per macro invocation (default 16)."),
+    cl::value_desc("N"), cl::init(16), cl::cat(gencorpus_category));
+
+cl::opt<unsigned int> nesting("nesting", cl::desc("The nesting depth of macro invocations and parentheses (default 4)."),
+    cl::value_desc("N"), cl::init(4), cl::cat(gencorpus_category));
+
+cl::opt<unsigned int> depth("depth", cl::desc("The length of include chains (default 32)."),
+    cl::value_desc("N"), cl::init(32), cl::cat(gencorpus_category));
+
+cl::opt<uint64_t> seed("seed", cl::desc("The seed of the random number generator (default 1)."),
+    cl::value_desc("N"), cl::init(1), cl::cat(gencorpus_category));
+
+namespace {
+
+char const* const kind_names[] = { "macros", "comments", "continuations", "includes", "tables", "mixed" };
+
+void write_file(std::filesystem::path const& path, std::string const& content)
+{
+  std::ofstream ofile(path, std::ios::binary | std::ios::trunc);
+  if (!ofile.is_open())
+    THROW_LALERTE("Failed to create '[FILENAME]'", AIArgs("[FILENAME]", path.native()));
+  ofile << content;
+  ofile.close();
+  if (!ofile.good())
+    THROW_LALERT("Failed writing '[FILENAME]'", AIArgs("[FILENAME]", path.native()));
+}
+
+class Generator
+{
+ private:
+  std::mt19937_64 rng_;                 // Only used with operator%, because the standard distributions differ between implementations.
+  std::string out_;
+  unsigned int counter_ = 0;            // Used to make names unique.
+
+ public:
+  Generator(uint64_t seed) : rng_(seed) { }
+
+  // Generate one source file. The include chain, if any, is written to `include_directory`.
+  std::string source_file(unsigned int file_index, std::filesystem::path const& include_directory);
+
+ private:
+  unsigned int random(unsigned int n) { return rng_() % n; }
+  std::string name(char const* prefix) { return prefix + std::to_string(counter_++); }
+
+  void plain_code();
+  void macro_invocation();
+  void comment_block();
+  void continued_define();
+  void table();
+  void construct(Kind kind);
+
+  std::string macro_argument(unsigned int level);
+  void include_chain(unsigned int file_index, std::filesystem::path const& include_directory);
+};
+
+void Generator::plain_code()
+{
+  switch (random(3))
+  {
+    case 0:
+      out_ += "int " + name("plain_") + " = " + std::to_string(random(1000)) + " * 3 + 1;\n";
+      break;
+    case 1:
+      out_ += "static int " + name("function_") + "(int x, int y) { return x * " + std::to_string(random(100)) + " + y; }\n";
+      break;
+    case 2:
+      out_ += "struct " + name("Struct") + " { int a; double b; char const* c; };\n";
+      break;
+  }
+}
+
+// Return an argument of a macro invocation that contains `level` levels of nested parentheses and invocations.
+std::string Generator::macro_argument(unsigned int level)
+{
+  if (level == 0)
+    return std::to_string(random(100));
+  std::string inner = macro_argument(level - 1);
+  switch (random(3))
+  {
+    case 0:
+      return "(" + inner + ", " + std::to_string(random(100)) + ")";         // Parenthesized comma: not an argument separator.
+    case 1:
+      return "CALL1(" + inner + ")";
+    default:
+      return "CALL2((" + inner + "), f(" + std::to_string(random(100)) + ", " + std::to_string(random(100)) + "))";
+  }
+}
+
+void Generator::macro_invocation()
+{
+  out_ += "int " + name("macro_") + " = CALLN(";
+  for (unsigned int arg = 0; arg < length; ++arg)
+  {
+    if (arg > 0)
+      out_ += random(4) == 0 ? ",\n    " : ", ";
+    out_ += macro_argument(nesting);
+  }
+  out_ += ");\n";
+}
+
+void Generator::comment_block()
+{
+  for (unsigned int line = 0; line < length; ++line)
+  {
+    switch (random(3))
+    {
+      case 0:
+        out_ += "// A C++ comment, line " + std::to_string(line) + ", that is followed by another line.\n";
+        break;
+      case 1:
+        out_ += "/* A C comment */ int " + name("commented_") + " = 42; /* with more text after it */\n";
+        break;
+      case 2:
+        out_ += "/*\n * A multi-line C comment\n * with several lines of text.\n */\n";
+        break;
+    }
+  }
+}
+
+void Generator::continued_define()
+{
+  out_ += "#define " + name("CONTINUED_") + "(a, b) \\\n";
+  for (unsigned int line = 0; line < length; ++line)
+    out_ += "  do_something((a), (b), " + std::to_string(line) + "); \\\n";
+  out_ += "  do_something((a), (b), -1)\n";
+}
+
+void Generator::table()
+{
+  out_ += "static int const " + name("table_") + "[][8] = {\n";
+  for (unsigned int row = 0; row < length; ++row)
+  {
+    out_ += "  { ";
+    for (int column = 0; column < 8; ++column)
+      out_ += std::to_string(random(100000)) + (column < 7 ? ", " : " ");
+    out_ += "},\n";
+  }
+  out_ += "};\n";
+}
+
+void Generator::construct(Kind kind)
+{
+  switch (kind)
+  {
+    case macros:
+      macro_invocation();
+      break;
+    case comments:
+      comment_block();
+      break;
+    case continuations:
+      continued_define();
+      break;
+    case includes:
+      // The include chain is at the top of the file; the rest is plain code.
+      plain_code();
+      break;
+    case tables:
+      table();
+      break;
+    case mixed:
+    {
+      static constexpr Kind kinds[] = { macros, comments, continuations, tables };
+      construct(kinds[random(std::size(kinds))]);
+      break;
+    }
+  }
+}
+
+void Generator::include_chain(unsigned int file_index, std::filesystem::path const& include_directory)
+{
+  std::filesystem::create_directories(include_directory);
+  // Use an extension that cwformat_bench doesn't pick up, so that the headers aren't benchmarked as source files themselves.
+  auto header_name = [file_index](unsigned int level) {
+    return "chain_" + std::to_string(file_index) + "_" + std::to_string(level) + ".inc";
+  };
+  for (unsigned int level = 0; level < depth; ++level)
+  {
+    std::string const guard = "CHAIN_" + std::to_string(file_index) + "_" + std::to_string(level) + "_INC";
+    std::string header = "#ifndef " + guard + "\n#define " + guard + "\n\n";
+    if (level + 1 < depth)
+      header += "#include \"" + header_name(level + 1) + "\"\n\n";
+    header += "#define CHAIN_MACRO_" + std::to_string(level) + "(x) ((x) + " + std::to_string(level) + ")\n";
+    header += "int chain_function_" + std::to_string(level) + "(int);\n\n#endif // " + guard + "\n";
+    write_file(include_directory / header_name(level), header);
+  }
+  out_ += "#include \"" + include_directory.filename().native() + "/" + header_name(0) + "\"\n\n";
+}
+
+std::string Generator::source_file(unsigned int file_index, std::filesystem::path const& include_directory)
+{
+  out_.clear();
+  out_ += "// Generated by cwformat_gencorpus.\n\n";
+  if (kind == includes || kind == mixed)
+    include_chain(file_index, include_directory);
+  if (kind == macros || kind == mixed)
+    out_ +=
+      "#define CALL1(a) (a)\n"
+      "#define CALL2(a, b) ((a) + (b))\n"
+      "#define CALLN(...) f(__VA_ARGS__)\n\n";
+  while (out_.size() < file_size)
+  {
+    if (random(100) < density)
+      construct(kind);
+    else
+      plain_code();
+  }
+  return std::move(out_);
+}
+
+} // namespace
+
+int main(int argc, char* argv[])
+{
+  Debug(NAMESPACE_DEBUG::init());
+
+  cl::HideUnrelatedOptions(gencorpus_category);
+  cl::ParseCommandLineOptions(argc, argv, "Generate C++ source files that stress specific parts of cwformat.\n");
+
+  if (density > 100)
+  {
+    llvm::errs() << "cwformat_gencorpus: --density must be a percentage.\n";
+    return 1;
+  }
+
+  if (depth == 0 && (kind == includes || kind == mixed))
+  {
+    llvm::errs() << "cwformat_gencorpus: --depth must be at least 1 for --kind=" << kind_names[kind] << ".\n";
+    return 1;
+  }
+
+  try
+  {
+    std::filesystem::path const directory(output_directory.getValue());
+    std::filesystem::create_directories(directory);
+    Generator generator(seed);
+    uint64_t total_size = 0;
+    for (unsigned int file_index = 0; file_index < number_of_files; ++file_index)
+    {
+      std::string const content = generator.source_file(file_index, directory / "include");
+      write_file(directory / (kind_names[kind] + ("_" + std::to_string(file_index)) + ".cxx"), content);
+      total_size += content.size();
+    }
+    llvm::outs() << "Wrote " << number_of_files << " files (" << total_size << " bytes) to " << directory.native() << ".\n";
+  }
+  catch (AIAlert::Error const& error)
+  {
+    std::cerr << "cwformat_gencorpus: " << error << std::endl;
+    return 1;
+  }
+  catch (std::filesystem::filesystem_error const& error)
+  {
+    std::cerr << "cwformat_gencorpus: " << error.what() << std::endl;
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,133 @@
+#include "sys.h"
+#include "UnifiedDiff.h"
+#include "utils/AIAlert.h"
+#include <iostream>
+#include <string>
+#include <vector>
+#include "debug.h"
+
+namespace {
+
+int failures = 0;
+
+struct ExpectedFile
+{
+  std::string path_;
+  std::vector<FormatRanges::LineRange> line_ranges_;
+};
+
+void test_diff(llvm::StringRef diff, unsigned int strip, std::vector<ExpectedFile> const& expected)
+{
+  UnifiedDiff unified_diff(diff, strip);
+  std::vector<UnifiedDiff::File> const& files = unified_diff.files();
+  bool equal = files.size() == expected.size();
+  for (size_t i = 0; equal && i < files.size(); ++i)
+  {
+    equal = files[i].path_ == expected[i].path_ && files[i].line_ranges_.size() == expected[i].line_ranges_.size();
+    for (size_t j = 0; equal && j < files[i].line_ranges_.size(); ++j)
+      equal = files[i].line_ranges_[j].first_ == expected[i].line_ranges_[j].first_ &&
+              files[i].line_ranges_[j].last_ == expected[i].line_ranges_[j].last_;
+  }
+  if (!equal)
+  {
+    std::cout << "Failure: got";
+    for (UnifiedDiff::File const& file : files)
+    {
+      std::cout << ' ' << file.path_.native() << ':';
+      for (FormatRanges::LineRange const& line_range : file.line_ranges_)
+        std::cout << ' ' << line_range.first_ << '-' << line_range.last_;
+    }
+    std::cout << '\n';
+    ++failures;
+  }
+  ASSERT(equal);
+}
+
+void test_malformed(llvm::StringRef diff, unsigned int strip = 0)
+{
+  bool threw = false;
+  try
+  {
+    UnifiedDiff unified_diff(diff, strip);
+  }
+  catch (AIAlert::Error const&)
+  {
+    threw = true;
+  }
+  if (!threw)
+  {
+    std::cout << "Failure: no exception was thrown.\n";
+    ++failures;
+  }
+  ASSERT(threw);
+}
+
+} // namespace
+
+int main()
+{
+  Debug(NAMESPACE_DEBUG::init());
+
+  std::cout << "Test Case 0: Empty diff" << std::endl;
+  test_diff("", 0, {});
+
+  std::cout << "Test Case 1: git diff -U0 with strip 1" << std::endl;
+  test_diff(
+    "diff --git a/foo.cxx b/foo.cxx\n"
+    "index 1234567..89abcde 100644\n"
+    "--- a/foo.cxx\n"
+    "+++ b/foo.cxx\n"
+    "@@ -3 +3 @@ int main()\n"
+    "-  return 0;\n"
+    "+  return 1;\n"
+    "@@ -10,0 +11,2 @@\n"
+    "+// One.\n"
+    "+// Two.\n", 1, {{"foo.cxx", {{3, 3}, {11, 12}}}});
+
+  std::cout << "Test Case 2: Hunks that only delete lines, and deleted files" << std::endl;
+  test_diff(
+    "--- a/foo.cxx\n"
+    "+++ b/foo.cxx\n"
+    "@@ -5,2 +4,0 @@\n"
+    "-x\n"
+    "-y\n"
+    "--- a/bar.cxx\n"
+    "+++ /dev/null\n"
+    "@@ -1,2 +0,0 @@\n"
+    "-+++ b/baz.cxx\n"
+    "-@@ -1 +1 @@\n", 1, {});
+
+  std::cout << "Test Case 3: Added and removed lines that look like file headers" << std::endl;
+  test_diff(
+    "--- a/foo.cxx\n"
+    "+++ b/foo.cxx\n"
+    "@@ -1,3 +1,3 @@\n"
+    " int x;\n"
+    "--- y;\n"
+    "+++ y;\n"
+    " int z;\n"
+    "--- a/bar.cxx\n"
+    "+++ b/bar.cxx\n"
+    "@@ -7,0 +8 @@\n"
+    "+++ i;\n", 1, {{"foo.cxx", {{1, 3}}}, {"bar.cxx", {{8, 8}}}});
+
+  std::cout << "Test Case 4: Time stamps, CRLF, empty context lines and no newline at end of file" << std::endl;
+  test_diff(
+    "--- old/dir/foo.cxx\t2024-01-01 00:00:00\r\n"
+    "+++ new/dir/foo.cxx\t2024-01-02 00:00:00\r\n"
+    "@@ -1,3 +1,3 @@\r\n"
+    " a\r\n"
+    "\r\n"
+    "-b\r\n"
+    "\\ No newline at end of file\r\n"
+    "+c\r\n"
+    "\\ No newline at end of file\r\n", 2, {{"foo.cxx", {{1, 3}}}});
+
+  std::cout << "Test Case 5: Malformed diffs" << std::endl;
+  test_malformed("+++ b/foo.cxx\n@@ -1 @@\n");
+  test_malformed("+++ b/foo.cxx\n@@ -1 +x @@\n");
+  test_malformed("+++ b/foo.cxx\n@@ -1 +1 @@\n-a\n-b\n");
+  test_malformed("+++ foo.cxx\n", 1);
+
+  return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,175 @@
+#include "sys.h"
+#include "CachingFileSystem.h"
+#include <chrono>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <string_view>
+#include "debug.h"
+
+// Tests of the stat snapshot of CachingFileSystem: every run is simulated by a new CachingFileSystem that loads the
+// snapshot that the previous one saved, on top of a file system that counts how often it is asked something.
+
+namespace {
+
+int failures = 0;
+
+void check(bool condition, std::string_view what)
+{
+  if (!condition)
+  {
+    std::cout << "Failure: " << what << ".\n";
+    ++failures;
+  }
+  ASSERT(condition);
+}
+
+void write_file(std::filesystem::path const& path, std::string_view content)
+{
+  std::ofstream ofile(path, std::ios::binary | std::ios::trunc);
+  ofile.write(content.data(), content.size());
+}
+
+// Let `path` have been modified `seconds` ago, so that its listing isn't racy.
+void set_age(std::filesystem::path const& path, int seconds)
+{
+  std::filesystem::last_write_time(path, std::filesystem::file_time_type::clock::now() - std::chrono::seconds(seconds));
+}
+
+// The real file system, counting the calls.
+class CountingFileSystem : public llvm::vfs::ProxyFileSystem
+{
+ public:
+  int statuses_ = 0;
+  int listings_ = 0;
+
+  CountingFileSystem() : ProxyFileSystem(llvm::vfs::getRealFileSystem()) { }
+
+  llvm::ErrorOr<llvm::vfs::Status> status(llvm::Twine const& path) override
+  {
+    ++statuses_;
+    return ProxyFileSystem::status(path);
+  }
+
+  llvm::vfs::directory_iterator dir_begin(llvm::Twine const& dir, std::error_code& ec) override
+  {
+    ++listings_;
+    return ProxyFileSystem::dir_begin(dir, ec);
+  }
+
+  void reset() { statuses_ = listings_ = 0; }
+};
+
+struct Run
+{
+  llvm::IntrusiveRefCntPtr<CountingFileSystem> counting_file_system_;
+  llvm::IntrusiveRefCntPtr<CachingFileSystem> file_system_;
+
+  // Start a new run; loading the snapshot is not counted.
+  Run(std::filesystem::path const& snapshot_path) :
+    counting_file_system_(llvm::makeIntrusiveRefCnt<CountingFileSystem>()),
+    file_system_(llvm::makeIntrusiveRefCnt<CachingFileSystem>(counting_file_system_, snapshot_path))
+  {
+    counting_file_system_->reset();
+  }
+
+  bool exists(std::filesystem::path const& path) { return static_cast<bool>(file_system_->status(path.native())); }
+};
+
+} // namespace
+
+int main()
+{
+  Debug(NAMESPACE_DEBUG::init());
+
+  std::string directory_template = (std::filesystem::temp_directory_path() / "fscachetest-XXXXXX").native();
+  if (!::mkdtemp(directory_template.data()))
+  {
+    std::cout << "Failure: could not create a temporary directory.\n";
+    return 1;
+  }
+  std::filesystem::path const directory = directory_template;
+  std::filesystem::path const snapshot_path = directory / "cache" / "stat-snapshot";
+  // Two include directories; foo.h is only in the second one, like after resolving #include <foo.h> with -Iinc1 -Iinc2.
+  std::filesystem::path const inc1 = directory / "inc1";
+  std::filesystem::path const inc2 = directory / "inc2";
+  std::filesystem::create_directory(inc1);
+  std::filesystem::create_directory(inc2);
+  write_file(inc1 / "other.h", "");
+  write_file(inc2 / "foo.h", "");
+  set_age(inc1, 10);
+  set_age(inc2, 10);
+
+  std::cout << "Test Case 0: The candidates that don't exist are known from the snapshot" << std::endl;
+  {
+    {
+      Run run(snapshot_path);
+      check(!run.exists(inc1 / "foo.h"), "inc1/foo.h doesn't exist");
+      check(run.exists(inc2 / "foo.h"), "inc2/foo.h exists");
+      check(run.counting_file_system_->listings_ == 2, "the first run reads both directories");
+      run.file_system_->save();
+    }
+    Run run(snapshot_path);
+    check(!run.exists(inc1 / "foo.h"), "inc1/foo.h still doesn't exist");
+    check(run.exists(inc2 / "foo.h"), "inc2/foo.h still exists");
+    check(run.counting_file_system_->listings_ == 0, "the second run doesn't read the directories");
+    // Only the file that exists is stat-ed.
+    check(run.counting_file_system_->statuses_ == 1, "the second run doesn't look up the missing candidate");
+    run.file_system_->save();
+  }
+
+  std::cout << "Test Case 1: A header that is created later in a searched directory" << std::endl;
+  {
+    write_file(inc1 / "foo.h", "");
+    {
+      Run run(snapshot_path);
+      check(run.exists(inc1 / "foo.h"), "the new inc1/foo.h is found");
+      check(run.counting_file_system_->listings_ == 1, "the changed directory is read again");
+      run.file_system_->save();
+    }
+    // The listing of inc1 was read right after inc1 was modified, so it wasn't stored.
+    Run run(snapshot_path);
+    check(run.exists(inc1 / "foo.h"), "inc1/foo.h is still found");
+    check(run.counting_file_system_->listings_ == 1, "a listing that was read right after its directory changed isn't stored");
+    run.file_system_->save();
+  }
+
+  std::cout << "Test Case 2: A directory whose modification time changed" << std::endl;
+  {
+    {
+      set_age(inc1, 10);
+      Run run(snapshot_path);
+      check(!run.exists(inc1 / "bar.h"), "inc1/bar.h doesn't exist");
+      run.file_system_->save();
+    }
+    {
+      Run run(snapshot_path);
+      check(!run.exists(inc1 / "bar.h"), "inc1/bar.h still doesn't exist");
+      check(run.counting_file_system_->listings_ == 0, "the listing of inc1 is used");
+    }
+    // Nothing changed in inc1, except its modification time.
+    set_age(inc1, 5);
+    Run run(snapshot_path);
+    check(!run.exists(inc1 / "bar.h"), "inc1/bar.h doesn't exist after touching inc1");
+    check(run.counting_file_system_->listings_ == 1, "the listing of a directory with another modification time is not used");
+  }
+
+  std::cout << "Test Case 3: A directory that is created later" << std::endl;
+  {
+    std::filesystem::path const inc3 = directory / "inc3";
+    {
+      Run run(snapshot_path);
+      check(!run.exists(inc3 / "foo.h"), "inc3/foo.h doesn't exist");
+      run.file_system_->save();
+    }
+    std::filesystem::create_directory(inc3);
+    write_file(inc3 / "foo.h", "");
+    Run run(snapshot_path);
+    check(run.exists(inc3 / "foo.h"), "inc3/foo.h is found after inc3 was created");
+  }
+
+  std::filesystem::remove_all(directory);
+  return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,170 @@
+#include "sys.h"
+#include "InPlaceWriter.h"
+#include "OutputBuilder.h"
+#include "utils/AIAlert.h"
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <string>
+#include <string_view>
+#include <sys/stat.h>
+#include "debug.h"
+
+// Tests of InPlaceWriter: a file in a temporary directory is replaced (or not) and its content,
+// permissions and inode are checked afterwards.
+
+namespace {
+
+int failures = 0;
+
+void check(bool condition, std::string_view what)
+{
+  if (!condition)
+  {
+    std::cout << "Failure: " << what << ".\n";
+    ++failures;
+  }
+  ASSERT(condition);
+}
+
+void write_file(std::filesystem::path const& path, std::string_view content)
+{
+  std::ofstream ofile(path, std::ios::binary | std::ios::trunc);
+  ofile.write(content.data(), content.size());
+}
+
+std::string read_file(std::filesystem::path const& path)
+{
+  std::ifstream ifile(path, std::ios::binary);
+  return {std::istreambuf_iterator<char>(ifile), std::istreambuf_iterator<char>()};
+}
+
+struct stat stat_file(std::filesystem::path const& path)
+{
+  struct stat result{};
+  ::stat(path.c_str(), &result);
+  return result;
+}
+
+// Return the number of entries in `directory`.
+size_t number_of_entries(std::filesystem::path const& directory)
+{
+  return std::distance(std::filesystem::directory_iterator(directory), std::filesystem::directory_iterator{});
+}
+
+// Let an InPlaceWriter replace `path`, whose current content is `original`, with `output`.
+InPlaceWriter::Result commit(std::filesystem::path const& path, std::string_view original, std::string_view output,
+    InPlaceWriter::SyncPolicy sync_policy = InPlaceWriter::sync_none)
+{
+  OutputBuilder output_builder(original);
+  // Append what is equal to the original from the original itself, like TranslationUnit::print does.
+  size_t const common = output.starts_with(original) ? original.size() : 0;
+  output_builder.append(original.substr(0, common));
+  output_builder.insert(output.substr(common));
+  InPlaceWriter in_place_writer(path);
+  return in_place_writer.commit(output_builder, sync_policy);
+}
+
+} // namespace
+
+int main()
+{
+  Debug(NAMESPACE_DEBUG::init());
+
+  std::string directory_template = (std::filesystem::temp_directory_path() / "inplacetest-XXXXXX").native();
+  if (!::mkdtemp(directory_template.data()))
+  {
+    std::cout << "Failure: could not create a temporary directory.\n";
+    return 1;
+  }
+  std::filesystem::path const directory = directory_template;
+  std::filesystem::path const path = directory / "test.cxx";
+  std::string_view const original = "int  a;\n";
+  std::string_view const formatted = "int a;\n";
+
+  std::cout << "Test Case 0: Identical output doesn't touch the file" << std::endl;
+  {
+    write_file(path, original);
+    struct stat const before = stat_file(path);
+    check(commit(path, original, original) == InPlaceWriter::unchanged, "identical output is reported as unchanged");
+    struct stat const after = stat_file(path);
+    check(read_file(path) == original, "the content is unchanged");
+    check(after.st_ino == before.st_ino, "the inode is unchanged");
+    check(after.st_mtim.tv_sec == before.st_mtim.tv_sec && after.st_mtim.tv_nsec == before.st_mtim.tv_nsec, "the mtime is unchanged");
+  }
+
+  std::cout << "Test Case 1: Different output replaces the file atomically, keeping its permissions" << std::endl;
+  {
+    write_file(path, original);
+    std::filesystem::permissions(path, std::filesystem::perms::owner_read | std::filesystem::perms::owner_write |
+        std::filesystem::perms::group_read | std::filesystem::perms::others_read);
+    struct stat const before = stat_file(path);
+    check(commit(path, original, formatted) == InPlaceWriter::replaced, "different output is reported as replaced");
+    struct stat const after = stat_file(path);
+    check(read_file(path) == formatted, "the file has the new content");
+    check((after.st_mode & 07777) == 0644, "the permissions are preserved");
+    // The new content was written to a new file that was renamed over the original.
+    check(after.st_ino != before.st_ino, "the file was replaced by a new inode");
+    check(number_of_entries(directory) == 1, "no temporary file is left behind");
+  }
+
+  std::cout << "Test Case 2: A longer and a shorter output" << std::endl;
+  {
+    write_file(path, original);
+    std::string const longer = std::string(original) + "int b;\n";
+    check(commit(path, original, longer) == InPlaceWriter::replaced, "a longer output is a difference");
+    check(read_file(path) == longer, "the file has the longer content");
+    check(commit(path, longer, original) == InPlaceWriter::replaced, "a shorter output is a difference");
+    check(read_file(path) == original, "the file has the shorter content");
+  }
+
+  std::cout << "Test Case 3: A symbolic link is followed" << std::endl;
+  {
+    write_file(path, original);
+    std::filesystem::path const link = directory / "link.cxx";
+    std::filesystem::create_symlink(path.filename(), link);
+    check(commit(link, original, formatted) == InPlaceWriter::replaced, "the target of the link is replaced");
+    check(std::filesystem::is_symlink(link), "the link is still a symbolic link");
+    check(read_file(path) == formatted, "the file that the link points to has the new content");
+    std::filesystem::remove(link);
+  }
+
+  std::cout << "Test Case 4: The sync policies" << std::endl;
+  {
+    write_file(path, original);
+    check(commit(path, original, formatted, InPlaceWriter::sync_file) == InPlaceWriter::replaced, "the file is replaced with sync_file");
+    check(read_file(path) == formatted, "the file has the new content after sync_file");
+    check(commit(path, formatted, original, InPlaceWriter::sync_end) == InPlaceWriter::replaced, "the file is replaced with sync_end");
+    bool synced = true;
+    try
+    {
+      InPlaceWriter::sync_filesystems();
+    }
+    catch (AIAlert::Error const&)
+    {
+      synced = false;
+    }
+    check(synced, "sync_filesystems succeeds");
+    check(read_file(path) == original, "the file has the new content after sync_end");
+  }
+
+  std::cout << "Test Case 5: A failure leaves nothing behind" << std::endl;
+  {
+    bool thrown = false;
+    try
+    {
+      commit(directory / "missing.cxx", original, formatted);
+    }
+    catch (AIAlert::Error const&)
+    {
+      thrown = true;
+    }
+    check(thrown, "replacing a file that doesn't exist throws");
+    check(number_of_entries(directory) == 1, "no temporary file is left behind after a failure");
+  }
+
+  std::filesystem::remove_all(directory);
+  return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,51 @@
+#include "sys.h"
+#include "macro_definitions.h"
+#include "clang/Lex/MacroInfo.h"
+#include "clang/Lex/Preprocessor.h"
+#include "llvm/ADT/SmallString.h"
+#include "debug.h"
+
+void print_macro_definition(llvm::raw_ostream& os, clang::Preprocessor const& pp, clang::IdentifierInfo const& identifier,
+    clang::MacroInfo const& macro_info)
+{
+  os << "#define " << identifier.getName();
+  if (macro_info.isFunctionLike())
+  {
+    os << '(';
+    char const* separator = "";
+    for (clang::IdentifierInfo const* param : macro_info.params())
+    {
+      os << separator;
+      separator = ",";
+      if (param->getName() == "__VA_ARGS__")
+        os << "...";
+      else
+        os << param->getName();
+    }
+    if (macro_info.isGNUVarargs())
+      os << "...";                      // #define foo(x...)
+    os << ')';
+  }
+  if (macro_info.tokens_empty() || !macro_info.tokens_begin()->hasLeadingSpace())
+    os << ' ';
+  llvm::SmallString<128> spelling_buffer;
+  for (clang::Token const& token : macro_info.tokens())
+  {
+    if (token.hasLeadingSpace())
+      os << ' ';
+    os << pp.getSpelling(token, spelling_buffer);
+  }
+  os << '\n';
+}
+
+std::string current_macro_definition(clang::Preprocessor& pp, llvm::StringRef name)
+{
+  std::string definition;
+  clang::IdentifierInfo* identifier = pp.getIdentifierInfo(name);
+  if (clang::MacroInfo const* macro_info = pp.getMacroInfo(identifier))
+  {
+    llvm::raw_string_ostream os(definition);
+    print_macro_definition(os, pp, *identifier, *macro_info);
+  }
+  return definition;
+}
@@ -0,0 +1,18 @@
+#pragma once
+
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/raw_ostream.h"
+#include <string>
+
+namespace clang {
+class IdentifierInfo;
+class MacroInfo;
+class Preprocessor;
+} // namespace clang
+
+// Append the #define directive (including the trailing newline) that results in `macro_info` to `os`, like -dM does.
+void print_macro_definition(llvm::raw_ostream& os, clang::Preprocessor const& pp, clang::IdentifierInfo const& identifier,
+    clang::MacroInfo const& macro_info);
+
+// Return the #define directive of the macro `name` as it is currently defined in `pp`, or an empty string if it isn't defined.
+std::string current_macro_definition(clang::Preprocessor& pp, llvm::StringRef name);
@@ -0,0 +1,121 @@
+#include "sys.h"
+#include "ClangFrontend.h"
+#include "CompilationOptions.h"
+#include "FormatRanges.h"
+#include "OutputBuilder.h"
+#include "SourceFile.h"
+#include "TranslationUnit.h"
+#include "UnifiedDiff.h"
+#include <functional>
+#include <iostream>
+#include <optional>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "debug.h"
+
+// End-to-end tests of printing (part of) a file: the input is processed by a ClangFrontend
+// and the output of TranslationUnit::print is compared with the expected output, byte for byte.
+
+namespace {
+
+int failures = 0;
+
+using LineRanges = std::vector<FormatRanges::LineRange>;
+
+// Process `text` and return what is printed; only the lines of `line_ranges` are formatted, unless it is nullopt.
+std::string print_text(ClangFrontend& clang_frontend, std::string_view text, std::optional<LineRanges> const& line_ranges)
+{
+  SourceFile const source_file("<test>", {}, llvm::MemoryBuffer::getMemBufferCopy(llvm::StringRef(text.data(), text.size()), "<test>"));
+  std::optional<FormatRanges> format_ranges;
+  if (line_ranges)
+    format_ranges.emplace(source_file, *line_ranges, std::vector<FormatRanges::ByteRange>{});
+  TranslationUnit translation_unit(clang_frontend, source_file, "<test>", format_ranges ? &*format_ranges : nullptr);
+  translation_unit.process();
+  OutputBuilder output_builder;
+  translation_unit.print(output_builder);
+  std::ostringstream output;
+  output_builder.write_to(output);
+  return std::move(output).str();
+}
+
+// Process `text` and return the offset of the first difference between what is printed and `text`, using `mode`.
+size_t first_difference(ClangFrontend& clang_frontend, std::string_view text, LineRanges const& line_ranges, OutputBuilder::Mode mode)
+{
+  SourceFile const source_file("<test>", {}, llvm::MemoryBuffer::getMemBufferCopy(llvm::StringRef(text.data(), text.size()), "<test>"));
+  FormatRanges const format_ranges(source_file, line_ranges, std::vector<FormatRanges::ByteRange>{});
+  TranslationUnit translation_unit(clang_frontend, source_file, "<test>", &format_ranges);
+  translation_unit.process();
+  OutputBuilder output_builder(source_file.span(source_file.begin(), source_file.size()), mode);
+  translation_unit.print(output_builder);
+  return output_builder.first_difference();
+}
+
+void test_print(ClangFrontend& clang_frontend, std::string_view text, std::optional<LineRanges> const& line_ranges, std::string_view expected)
+{
+  std::string const result = print_text(clang_frontend, text, line_ranges);
+  if (result != expected)
+  {
+    std::cout << "Failure: got \"" << result << "\", expected: \"" << expected << "\".\n";
+    ++failures;
+  }
+  ASSERT(result == expected);
+}
+
+} // namespace
+
+int main()
+{
+  Debug(NAMESPACE_DEBUG::init());
+
+  CompilationOptions const options;
+  ClangFrontend clang_frontend(std::bind_front(&CompilationOptions::configure_header_search_options, &options),
+      std::bind_front(&CompilationOptions::configure_commandline_macro_definitions, &options),
+      std::bind_front(&CompilationOptions::configure_language_options, &options));
+
+  std::string_view const text = "int a;\nint  b;\n/* c */ int c;\nint d;\n";
+
+  std::cout << "Test Case 0: The whole file" << std::endl;
+  test_print(clang_frontend, text, std::nullopt, "// TranslationUnit: <test>\nNoaContainer: ");
+
+  std::cout << "Test Case 1: Two disjoint ranges get one header, and everything else is copied" << std::endl;
+  test_print(clang_frontend, text, LineRanges{{2, 2}, {4, 4}},
+      "int a;\n// TranslationUnit: <test>\nint  b;\n/* c */ int c;\nint d;\n");
+  test_print(clang_frontend, text, LineRanges{{1, 1}, {3, 3}},
+      "// TranslationUnit: <test>\nint a;\nint  b;\n/* c */ int c;\nint d;\n");
+
+  std::cout << "Test Case 2: The ranges of a diff" << std::endl;
+  {
+    UnifiedDiff const unified_diff(
+        "--- a/test.cxx\n"
+        "+++ b/test.cxx\n"
+        "@@ -2 +2 @@\n"
+        "-int b;\n"
+        "+int  b;\n"
+        "@@ -4,0 +4 @@\n"
+        "+int d;\n", 1);
+    ASSERT(unified_diff.files().size() == 1);
+    test_print(clang_frontend, text, unified_diff.files()[0].line_ranges_,
+        "int a;\n// TranslationUnit: <test>\nint  b;\n/* c */ int c;\nint d;\n");
+  }
+
+  std::cout << "Test Case 3: A range with only whitespace" << std::endl;
+  test_print(clang_frontend, "int a;\n\nint b;\n", LineRanges{{2, 2}}, "int a;\n// TranslationUnit: <test>\n\nint b;\n");
+
+  std::cout << "Test Case 4: Comparing only (--dry-run) finds the same first difference" << std::endl;
+  {
+    // The header is inserted at the start of line 2.
+    size_t const expected = 7;
+    size_t const built = first_difference(clang_frontend, text, LineRanges{{2, 2}, {4, 4}}, OutputBuilder::build_output);
+    size_t const compared = first_difference(clang_frontend, text, LineRanges{{2, 2}, {4, 4}}, OutputBuilder::compare_only);
+    if (built != expected || compared != expected)
+    {
+      std::cout << "Failure: first difference at " << built << " and " << compared << ", expected " << expected << ".\n";
+      ++failures;
+    }
+    ASSERT(built == expected && compared == expected);
+  }
+
+  return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,90 @@
+#include "sys.h"
+#include "FormatRanges.h"
+#include "SourceFile.h"
+#include <iostream>
+#include <string_view>
+#include <vector>
+#include "debug.h"
+
+namespace {
+
+int failures = 0;
+
+using LineRanges = std::vector<FormatRanges::LineRange>;
+using ByteRanges = std::vector<FormatRanges::ByteRange>;
+
+void test_ranges(std::string_view text, LineRanges const& line_ranges, ByteRanges const& byte_ranges, ByteRanges const& expected)
+{
+  SourceFile const source_file("<test>", {}, llvm::MemoryBuffer::getMemBuffer(llvm::StringRef(text.data(), text.size()), "<test>"));
+  FormatRanges const format_ranges(source_file, line_ranges, byte_ranges);
+  ByteRanges const& ranges = format_ranges.ranges();
+  bool equal = ranges.size() == expected.size();
+  for (size_t i = 0; equal && i < ranges.size(); ++i)
+    equal = ranges[i].begin_ == expected[i].begin_ && ranges[i].end_ == expected[i].end_;
+  if (!equal)
+  {
+    std::cout << "Failure: got";
+    for (FormatRanges::ByteRange const& range : ranges)
+      std::cout << " [" << range.begin_ << ", " << range.end_ << ')';
+    std::cout << '\n';
+    ++failures;
+  }
+  ASSERT(equal);
+}
+
+void test_intersects(FormatRanges const& format_ranges, FormatRanges::offset_type begin, FormatRanges::offset_type end, bool expected)
+{
+  bool const result = format_ranges.intersects(begin, end);
+  if (result != expected)
+  {
+    std::cout << "Failure: intersects(" << begin << ", " << end << ") returns " << result << ", expected: " << expected << ".\n";
+    ++failures;
+  }
+  ASSERT(result == expected);
+}
+
+} // namespace
+
+int main()
+{
+  Debug(NAMESPACE_DEBUG::init());
+
+  std::string_view const text = "one\ntwo\nthree\nfour\n";
+  // Offsets:                    0123 4567 890123 45678 9
+
+  std::cout << "Test Case 0: Line ranges" << std::endl;
+  test_ranges(text, {{2, 2}}, {}, {{4, 8}});
+  test_ranges(text, {{1, 1}, {3, 4}}, {}, {{0, 4}, {8, 19}});
+  test_ranges(text, {{4, 100}}, {}, {{14, 19}});
+  test_ranges(text, {{5, 5}}, {}, {});                  // Past the end.
+
+  std::cout << "Test Case 1: Byte ranges are extended to whole lines" << std::endl;
+  test_ranges(text, {}, {{5, 6}}, {{4, 8}});
+  test_ranges(text, {}, {{3, 5}}, {{0, 8}});            // From the newline of "one" into "two".
+  test_ranges(text, {}, {{8, 8}}, {{8, 14}});           // Empty: the line that contains it.
+  test_ranges(text, {}, {{10, 4294967295U}}, {{8, 19}});        // Until the end of the file.
+  test_ranges(text, {}, {{19, 19}}, {{14, 19}});        // At the end of the file.
+  test_ranges(text, {}, {{20, 25}}, {});                // Past the end.
+
+  std::cout << "Test Case 2: Sorting and merging" << std::endl;
+  test_ranges(text, {{3, 3}, {1, 1}}, {{5, 5}}, {{0, 14}});
+  test_ranges(text, {{4, 4}}, {{0, 1}}, {{0, 4}, {14, 19}});
+
+  std::cout << "Test Case 3: A last line without newline" << std::endl;
+  test_ranges("a\nb", {{2, 2}}, {}, {{2, 3}});
+  test_ranges("a\nb", {}, {{3, 3}}, {{2, 3}});
+
+  std::cout << "Test Case 4: intersects" << std::endl;
+  {
+    SourceFile const source_file("<test>", {}, llvm::MemoryBuffer::getMemBuffer(llvm::StringRef(text.data(), text.size()), "<test>"));
+    FormatRanges const format_ranges(source_file, {{2, 2}}, {});      // [4, 8)
+    test_intersects(format_ranges, 0, 4, false);
+    test_intersects(format_ranges, 0, 5, true);
+    test_intersects(format_ranges, 7, 9, true);
+    test_intersects(format_ranges, 8, 9, false);
+    test_intersects(format_ranges, 4, 4, true);         // Empty, inside.
+    test_intersects(format_ranges, 8, 8, false);        // Empty, at the end.
+  }
+
+  return failures == 0 ? 0 : 1;
+}
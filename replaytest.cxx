@@ -0,0 +1,170 @@
+#include "sys.h"
+#include "ClangFrontend.h"
+#include "CompilationOptions.h"
+#include "FrontendSettings.h"
+#include "GuardedHeaderDiskCache.h"
+#include "SourceFile.h"
+#include "Statistics.h"
+#include "TranslationUnit.h"
+#include <chrono>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <string_view>
+#include "debug.h"
+
+// Tests of replaying guarded headers (--replay-guarded-headers and --header-cache): a TU that includes a header
+// is processed twice, and the statistics tell whether the second time the header was entered or replayed.
+
+namespace {
+
+int failures = 0;
+
+void check(bool condition, std::string_view what)
+{
+  if (!condition)
+  {
+    std::cout << "Failure: " << what << ".\n";
+    ++failures;
+  }
+  ASSERT(condition);
+}
+
+void write_file(std::filesystem::path const& path, std::string_view content)
+{
+  std::ofstream ofile(path, std::ios::binary | std::ios::trunc);
+  ofile.write(content.data(), content.size());
+}
+
+// Let `path` have been modified `seconds` ago.
+void set_age(std::filesystem::path const& path, int seconds)
+{
+  std::filesystem::last_write_time(path, std::filesystem::file_time_type::clock::now() - std::chrono::seconds(seconds));
+}
+
+std::unique_ptr<ClangFrontend> create_frontend(CompilationOptions const& options, FrontendSettings const& settings)
+{
+  return std::make_unique<ClangFrontend>(std::bind_front(&CompilationOptions::configure_header_search_options, &options),
+      std::bind_front(&CompilationOptions::configure_commandline_macro_definitions, &options),
+      std::bind_front(&CompilationOptions::configure_language_options, &options), settings);
+}
+
+struct Counts
+{
+  uint64_t entered_;
+  uint64_t replayed_;
+};
+
+// Process `text` and return the number of headers that were entered and replayed.
+Counts process(ClangFrontend& clang_frontend, std::string_view text)
+{
+  SourceFile const source_file("<test>", {}, llvm::MemoryBuffer::getMemBufferCopy(llvm::StringRef(text.data(), text.size()), "<test>"));
+  Statistics::File statistics;
+  {
+    TranslationUnit translation_unit(clang_frontend, source_file, "<test>", nullptr, &statistics);
+    translation_unit.process();
+  }
+  return {statistics.headers_entered_, statistics.headers_replayed_};
+}
+
+// Process `text` twice with the same frontend; the header that it includes must be replayed the second time iff `replayable`.
+void test_replay(ClangFrontend& clang_frontend, std::string_view text, bool replayable, std::string_view what)
+{
+  Counts const first = process(clang_frontend, text);
+  check(first.entered_ == 1 && first.replayed_ == 0, std::string(what) + ": the first TU enters the header");
+  Counts const second = process(clang_frontend, text);
+  if (replayable)
+    check(second.entered_ == 0 && second.replayed_ == 1, std::string(what) + ": the second TU replays the header");
+  else
+    check(second.entered_ == 1 && second.replayed_ == 0, std::string(what) + ": the second TU enters the header again");
+}
+
+} // namespace
+
+int main()
+{
+  Debug(NAMESPACE_DEBUG::init());
+
+  std::string directory_template = (std::filesystem::temp_directory_path() / "replaytest-XXXXXX").native();
+  if (!::mkdtemp(directory_template.data()))
+  {
+    std::cout << "Failure: could not create a temporary directory.\n";
+    return 1;
+  }
+  std::filesystem::path const directory = directory_template;
+  std::filesystem::path const inc1 = directory / "inc1";
+  std::filesystem::path const inc2 = directory / "inc2";
+  std::filesystem::create_directory(inc1);
+  std::filesystem::create_directory(inc2);
+
+  CompilationOptions options;
+  options.include_directories_.emplace_back(clang::frontend::Angled, inc1.native());
+  options.include_directories_.emplace_back(clang::frontend::Angled, inc2.native());
+
+  FrontendSettings settings;
+  settings.replay_guarded_headers_ = true;
+
+  std::cout << "Test Case 0: Pragmas that can't be replayed" << std::endl;
+  {
+    write_file(inc2 / "plain.h", "#ifndef PLAIN_H\n#define PLAIN_H\n#define PLAIN 1\n#pragma GCC diagnostic push\n#pragma GCC diagnostic pop\n#endif\n");
+    write_file(inc2 / "push.h", "#ifndef PUSH_H\n#define PUSH_H\n#pragma push_macro(\"X\")\n#endif\n");
+    write_file(inc2 / "pop.h", "#ifndef POP_H\n#define POP_H\n#pragma pop_macro(\"X\")\n#endif\n");
+    write_file(inc2 / "poison.h", "#ifndef POISON_H\n#define POISON_H\n#pragma GCC poison P\n#endif\n");
+    write_file(inc2 / "alias.h", "#ifndef ALIAS_H\n#define ALIAS_H\n#pragma include_alias(\"a.h\", \"plain.h\")\n#endif\n");
+    write_file(inc2 / "operator.h", "#ifndef OPERATOR_H\n#define OPERATOR_H\n_Pragma(\"GCC diagnostic push\")\n_Pragma(\"GCC diagnostic pop\")\n#endif\n");
+
+    std::unique_ptr<ClangFrontend> clang_frontend = create_frontend(options, settings);
+    test_replay(*clang_frontend, "#include <plain.h>\n", true, "other pragmas");
+    test_replay(*clang_frontend, "#include <push.h>\n", false, "#pragma push_macro");
+    test_replay(*clang_frontend, "#define X 1\n#pragma push_macro(\"X\")\n#include <pop.h>\n", false, "#pragma pop_macro");
+    test_replay(*clang_frontend, "#include <poison.h>\n", false, "#pragma GCC poison");
+    test_replay(*clang_frontend, "#include <alias.h>\n", false, "#pragma include_alias");
+    test_replay(*clang_frontend, "#include <operator.h>\n", false, "_Pragma");
+  }
+
+  // The records of outer.h depend on where #include <inner.h> is found: first inc1 is searched, then inc2.
+  write_file(inc2 / "outer.h", "#ifndef OUTER_H\n#define OUTER_H\n#include <inner.h>\n#endif\n");
+  write_file(inc2 / "inner.h", "#ifndef INNER_H\n#define INNER_H\n#define INNER 2\n#endif\n");
+  std::string_view const text = "#include <outer.h>\n";
+  std::filesystem::path const index_path = directory / "cache" / "guarded-headers";
+
+  // Process `text` with a new frontend, using the disk cache that the previous run saved; return whether outer.h was replayed.
+  auto run = [&]() -> bool {
+    FrontendSettings disk_settings = settings;
+    disk_settings.guarded_header_disk_cache_ = std::make_shared<GuardedHeaderDiskCache>(index_path);
+    std::unique_ptr<ClangFrontend> clang_frontend = create_frontend(options, disk_settings);
+    Counts const counts = process(*clang_frontend, text);
+    disk_settings.guarded_header_disk_cache_->save();
+    return counts.replayed_ == 1 && counts.entered_ == 0;
+  };
+
+  std::cout << "Test Case 1: A later run replays a header that didn't change" << std::endl;
+  {
+    set_age(inc1, 10);
+    set_age(inc2, 10);
+    check(!run(), "the first run enters outer.h");
+    check(run(), "the second run replays outer.h");
+  }
+
+  std::cout << "Test Case 2: A header that is created later in a searched directory" << std::endl;
+  {
+    write_file(inc1 / "inner.h", "#ifndef INNER_H\n#define INNER_H\n#define INNER 1\n#endif\n");
+    check(!run(), "outer.h is entered again when inner.h is created in inc1");
+    check(run(), "after that outer.h is replayed again");
+  }
+
+  std::cout << "Test Case 3: A directory whose modification time changed" << std::endl;
+  {
+    // Nothing changed in inc1, except its modification time.
+    set_age(inc1, 5);
+    check(!run(), "outer.h is entered again when the modification time of inc1 changed");
+    check(run(), "after that outer.h is replayed again");
+  }
+
+  std::filesystem::remove_all(directory);
+  return failures == 0 ? 0 : 1;
+}
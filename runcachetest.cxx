@@ -0,0 +1,114 @@
+#include "sys.h"
+#include "RunCache.h"
+#include <chrono>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <string_view>
+#include "debug.h"
+
+// Tests of RunCache: every run is simulated by a new RunCache that loads the index that the
+// previous one saved, like cwformat --incremental does.
+
+namespace {
+
+int failures = 0;
+
+void check(bool condition, std::string_view what)
+{
+  if (!condition)
+  {
+    std::cout << "Failure: " << what << ".\n";
+    ++failures;
+  }
+  ASSERT(condition);
+}
+
+void write_file(std::filesystem::path const& path, std::string_view content)
+{
+  std::ofstream ofile(path, std::ios::binary | std::ios::trunc);
+  ofile.write(content.data(), content.size());
+}
+
+constexpr uint64_t options_hash = 0x0123456789abcdef;
+
+} // namespace
+
+int main()
+{
+  Debug(NAMESPACE_DEBUG::init());
+
+  std::string directory_template = (std::filesystem::temp_directory_path() / "runcachetest-XXXXXX").native();
+  if (!::mkdtemp(directory_template.data()))
+  {
+    std::cout << "Failure: could not create a temporary directory.\n";
+    return 1;
+  }
+  std::filesystem::path const directory = directory_template;
+  std::filesystem::path const index_path = directory / "cache" / "run-index";
+  std::filesystem::path const path = directory / "test.cxx";
+  write_file(path, "int a;\n");
+
+  std::cout << "Test Case 0: A file that was found to be formatted is skipped by the next run" << std::endl;
+  {
+    {
+      // The first run: --dry-run finds no difference.
+      RunCache run_cache(index_path);
+      check(!run_cache.is_up_to_date(path, options_hash), "an unknown file is not up to date");
+      run_cache.mark_formatted(path, options_hash);
+      run_cache.save();
+    }
+    check(std::filesystem::exists(index_path), "the index was written");
+    // The second run.
+    RunCache run_cache(index_path);
+    check(run_cache.is_up_to_date(path, options_hash), "the second run skips the file");
+  }
+
+  std::cout << "Test Case 1: Different options" << std::endl;
+  {
+    RunCache run_cache(index_path);
+    check(!run_cache.is_up_to_date(path, options_hash + 1), "a file is not up to date for other options");
+  }
+
+  std::cout << "Test Case 2: A file that changed" << std::endl;
+  {
+    // Same size, only the modification time differs.
+    write_file(path, "int b;\n");
+    std::filesystem::last_write_time(path, std::filesystem::last_write_time(path) + std::chrono::seconds(1));
+    RunCache run_cache(index_path);
+    check(!run_cache.is_up_to_date(path, options_hash), "a modified file is not up to date");
+  }
+
+  std::cout << "Test Case 3: A file that was replaced" << std::endl;
+  {
+    {
+      RunCache run_cache(index_path);
+      run_cache.mark_formatted(path, options_hash);
+      run_cache.save();
+    }
+    // Like -i does: a new file (with a new inode) is renamed over the original.
+    std::filesystem::path const temp_path = directory / "test.cxx.tmp";
+    write_file(temp_path, "int b;\n");
+    std::filesystem::last_write_time(temp_path, std::filesystem::last_write_time(path));
+    std::filesystem::rename(temp_path, path);
+    RunCache run_cache(index_path);
+    check(!run_cache.is_up_to_date(path, options_hash), "a replaced file is not up to date");
+  }
+
+  std::cout << "Test Case 4: An index of an unknown format is ignored" << std::endl;
+  {
+    {
+      RunCache run_cache(index_path);
+      run_cache.mark_formatted(path, options_hash);
+      run_cache.save();
+    }
+    write_file(index_path, "cwformat-run-index 0\n");
+    RunCache run_cache(index_path);
+    check(!run_cache.is_up_to_date(path, options_hash), "nothing is loaded from an index with the wrong magic");
+  }
+
+  std::filesystem::remove_all(directory);
+  return failures == 0 ? 0 : 1;
+}